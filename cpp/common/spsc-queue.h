@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace ic4_examples
+{
+	// Bounded single-producer/single-consumer queue.
+	//
+	// try_push is wait-free and never blocks the producer, e.g. a sink callback. The consumer can block in pop_wait,
+	// the producer only touches the mutex to wake it if it is actually waiting.
+	template<typename T>
+	class spsc_queue
+	{
+	public:
+		explicit spsc_queue(size_t capacity)
+			: slots_(capacity + 1)
+		{
+		}
+
+		size_t capacity() const
+		{
+			return slots_.size() - 1;
+		}
+
+		// Returns false if the queue is full, value is left untouched in that case
+		bool try_push(T&& value)
+		{
+			auto tail = tail_.load(std::memory_order_relaxed);
+			auto next = (tail + 1) % slots_.size();
+			if (next == head_.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+			slots_[tail] = std::move(value);
+			tail_.store(next);
+
+			auto len = size();
+			auto hwm = high_water_mark_.load(std::memory_order_relaxed);
+			if (len > hwm)
+			{
+				high_water_mark_.store(len, std::memory_order_relaxed);
+			}
+
+			// Sequentially consistent together with the store to tail_, pairs with pop_wait
+			if (consumer_waiting_.load())
+			{
+				std::lock_guard<std::mutex> lck(mtx_);
+				cond_.notify_one();
+			}
+			return true;
+		}
+
+		bool try_pop(T& value)
+		{
+			auto head = head_.load(std::memory_order_relaxed);
+			if (head == tail_.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+			value = std::move(slots_[head]);
+			slots_[head] = T();
+			head_.store((head + 1) % slots_.size(), std::memory_order_release);
+			return true;
+		}
+
+		// Waits up to timeout for an element
+		template<class Rep, class Period>
+		bool pop_wait(T& value, std::chrono::duration<Rep, Period> timeout)
+		{
+			if (try_pop(value))
+			{
+				return true;
+			}
+
+			std::unique_lock<std::mutex> lck(mtx_);
+			consumer_waiting_.store(true);
+			cond_.wait_for(lck, timeout, [this] { return !empty(); });
+			consumer_waiting_.store(false);
+			lck.unlock();
+
+			return try_pop(value);
+		}
+
+		bool empty() const
+		{
+			return head_.load() == tail_.load();
+		}
+
+		size_t size() const
+		{
+			auto head = head_.load(std::memory_order_acquire);
+			auto tail = tail_.load(std::memory_order_acquire);
+			return (tail + slots_.size() - head) % slots_.size();
+		}
+
+		// Largest number of queued elements seen by try_push
+		size_t high_water_mark() const
+		{
+			return high_water_mark_.load(std::memory_order_relaxed);
+		}
+
+		void reset_high_water_mark()
+		{
+			high_water_mark_.store(size(), std::memory_order_relaxed);
+		}
+
+	private:
+		std::vector<T> slots_;
+		std::atomic<size_t> head_{ 0 };
+		std::atomic<size_t> tail_{ 0 };
+		std::atomic<size_t> high_water_mark_{ 0 };
+
+		std::atomic<bool> consumer_waiting_{ false };
+		std::mutex mtx_;
+		std::condition_variable cond_;
+	};
+}
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bench
+{
+    using clock = std::chrono::steady_clock;
+
+    // Same counters as ic4::Grabber::StreamStatistics, so device and synthetic runs share the reporting code.
+    struct stream_counters
+    {
+        uint64_t device_delivered = 0;
+        uint64_t device_transmission_error = 0;
+        uint64_t device_underrun = 0;
+        uint64_t transform_delivered = 0;
+        uint64_t transform_underrun = 0;
+        uint64_t sink_delivered = 0;
+        uint64_t sink_underrun = 0;
+        uint64_t sink_ignored = 0;
+    };
+
+    template<class TFunc>
+    void for_each_counter( const stream_counters& c, TFunc&& func )
+    {
+        func( "device_delivered", c.device_delivered );
+        func( "device_transmission_error", c.device_transmission_error );
+        func( "device_underrun", c.device_underrun );
+        func( "transform_delivered", c.transform_delivered );
+        func( "transform_underrun", c.transform_underrun );
+        func( "sink_delivered", c.sink_delivered );
+        func( "sink_underrun", c.sink_underrun );
+        func( "sink_ignored", c.sink_ignored );
+    }
+
+    inline auto operator-( const stream_counters& a, const stream_counters& b ) -> stream_counters
+    {
+        stream_counters r;
+        r.device_delivered = a.device_delivered - b.device_delivered;
+        r.device_transmission_error = a.device_transmission_error - b.device_transmission_error;
+        r.device_underrun = a.device_underrun - b.device_underrun;
+        r.transform_delivered = a.transform_delivered - b.transform_delivered;
+        r.transform_underrun = a.transform_underrun - b.transform_underrun;
+        r.sink_delivered = a.sink_delivered - b.sink_delivered;
+        r.sink_underrun = a.sink_underrun - b.sink_underrun;
+        r.sink_ignored = a.sink_ignored - b.sink_ignored;
+        return r;
+    }
+
+    struct config
+    {
+        double duration_s = 10.0;
+        int sample_interval_ms = 1000;
+        int num_buffers = 0;            // 0 = sink default (device) or 8 (synthetic)
+        std::string json_filename;      // "-" writes to stdout
+
+        bool synthetic = false;
+        double synthetic_fps = 100.0;
+        int synthetic_width = 1920;
+        int synthetic_height = 1080;
+    };
+
+    // Records the host arrival time of every frame.
+    // on_frame() is only called from a single sink callback thread, frames() and bytes() may be polled concurrently.
+    class frame_recorder
+    {
+    public:
+        void reserve( size_t expected_frames )
+        {
+            intervals_us_.reserve( expected_frames );
+        }
+
+        void on_frame( size_t bytes )
+        {
+            auto now = clock::now();
+            if( frames_ > 0 ) {
+                intervals_us_.push_back( std::chrono::duration<double, std::micro>( now - last_arrival_ ).count() );
+            }
+            last_arrival_ = now;
+            bytes_ += bytes;
+            frames_ += 1;
+        }
+
+        uint64_t frames() const { return frames_; }
+        uint64_t bytes() const { return bytes_; }
+
+        // Only valid after the stream was stopped
+        const std::vector<double>& intervals_us() const { return intervals_us_; }
+
+    private:
+        std::atomic<uint64_t> frames_{ 0 };
+        std::atomic<uint64_t> bytes_{ 0 };
+        clock::time_point last_arrival_;
+        std::vector<double> intervals_us_;
+    };
+
+    struct interval_summary
+    {
+        size_t count = 0;
+        double mean_us = 0;
+        double stddev_us = 0;
+        double min_us = 0;
+        double p50_us = 0;
+        double p90_us = 0;
+        double p99_us = 0;
+        double p999_us = 0;
+        double max_us = 0;
+    };
+
+    // Nearest-rank percentile, sorted must not be empty
+    inline double percentile( const std::vector<double>& sorted, double pct )
+    {
+        auto rank = static_cast<size_t>( std::ceil( pct / 100.0 * sorted.size() ) );
+        return sorted[std::min( sorted.size() - 1, rank > 0 ? rank - 1 : 0 )];
+    }
+
+    inline auto summarize_intervals( std::vector<double> values ) -> interval_summary
+    {
+        interval_summary s;
+        s.count = values.size();
+        if( values.empty() ) {
+            return s;
+        }
+
+        std::sort( values.begin(), values.end() );
+
+        double sum = 0;
+        for( auto v : values ) {
+            sum += v;
+        }
+        s.mean_us = sum / values.size();
+
+        double sq_sum = 0;
+        for( auto v : values ) {
+            sq_sum += (v - s.mean_us) * (v - s.mean_us);
+        }
+        s.stddev_us = std::sqrt( sq_sum / values.size() );
+
+        s.min_us = values.front();
+        s.p50_us = percentile( values, 50.0 );
+        s.p90_us = percentile( values, 90.0 );
+        s.p99_us = percentile( values, 99.0 );
+        s.p999_us = percentile( values, 99.9 );
+        s.max_us = values.back();
+        return s;
+    }
+
+    struct sample
+    {
+        double time_s = 0;
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        stream_counters counters;
+    };
+
+    struct result
+    {
+        std::string source;
+        double duration_s = 0;
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        interval_summary intervals;
+        stream_counters counters_delta;
+        std::vector<sample> samples;
+
+        double fps() const { return duration_s > 0 ? frames / duration_s : 0; }
+        double mb_per_s() const { return duration_s > 0 ? bytes / duration_s / 1e6 : 0; }
+    };
+
+    // Samples frame count and stream statistics every sample_interval_ms until duration_s has elapsed.
+    // The first sample is taken immediately and acts as the baseline for all deltas.
+    inline auto run_sampling( const config& cfg, const frame_recorder& recorder, const std::function<stream_counters()>& fetch_counters ) -> result
+    {
+        result res;
+
+        auto begin = clock::now();
+        auto end = begin + std::chrono::duration_cast<clock::duration>( std::chrono::duration<double>( cfg.duration_s ) );
+        auto interval = std::chrono::milliseconds( std::max( 1, cfg.sample_interval_ms ) );
+
+        auto take_sample = [&]
+        {
+            sample s;
+            s.time_s = std::chrono::duration<double>( clock::now() - begin ).count();
+            s.frames = recorder.frames();
+            s.bytes = recorder.bytes();
+            s.counters = fetch_counters();
+            res.samples.push_back( s );
+        };
+
+        take_sample();
+        for( auto next = begin + interval; next < end; next += interval )
+        {
+            std::this_thread::sleep_until( next );
+            take_sample();
+        }
+        std::this_thread::sleep_until( end );
+        take_sample();
+
+        auto& first = res.samples.front();
+        auto& last = res.samples.back();
+        res.duration_s = last.time_s - first.time_s;
+        res.frames = last.frames - first.frames;
+        res.bytes = last.bytes - first.bytes;
+        res.counters_delta = last.counters - first.counters;
+        return res;
+    }
+
+    // In-process frame source that emulates a camera streaming into a QueueSink.
+    //
+    // A producer thread fills Mono8 frames at a fixed rate into buffers taken from a free queue, and a consumer
+    // thread hands them to the callback and requeues them. When the consumer falls behind and the free queue runs
+    // empty, the frame is counted as sink_underrun, just like the QueueSink does for a real device.
+    class synthetic_source
+    {
+    public:
+        synthetic_source( double fps, size_t frame_size, size_t num_buffers )
+            : period_( std::chrono::duration_cast<clock::duration>( std::chrono::duration<double>( 1.0 / fps ) ) )
+        {
+            buffers_.resize( num_buffers );
+            for( auto& buf : buffers_ )
+            {
+                buf.resize( frame_size );
+                free_queue_.push_back( &buf );
+            }
+        }
+
+        ~synthetic_source()
+        {
+            stop();
+        }
+
+        void start( std::function<void( const std::vector<uint8_t>& )> on_frame )
+        {
+            on_frame_ = std::move( on_frame );
+            stop_requested_ = false;
+            consumer_ = std::thread( [this] { consumer_thread(); } );
+            producer_ = std::thread( [this] { producer_thread(); } );
+        }
+
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lck{ mtx_ };
+                stop_requested_ = true;
+            }
+            cond_.notify_all();
+
+            if( producer_.joinable() ) {
+                producer_.join();
+            }
+            if( consumer_.joinable() ) {
+                consumer_.join();
+            }
+        }
+
+        stream_counters statistics() const
+        {
+            std::lock_guard<std::mutex> lck{ mtx_ };
+            return counters_;
+        }
+
+    private:
+        void producer_thread()
+        {
+            uint8_t pattern = 0;
+            auto next = clock::now();
+            while( true )
+            {
+                std::this_thread::sleep_until( next );
+                next += period_;
+
+                std::vector<uint8_t>* buf = nullptr;
+                {
+                    std::lock_guard<std::mutex> lck{ mtx_ };
+                    if( stop_requested_ ) {
+                        return;
+                    }
+                    counters_.device_delivered += 1;
+                    counters_.transform_delivered += 1;
+                    if( free_queue_.empty() ) {
+                        counters_.sink_underrun += 1;
+                        continue;
+                    }
+                    buf = free_queue_.front();
+                    free_queue_.pop_front();
+                }
+
+                // Touch the whole frame to generate the memory traffic of a real transfer
+                std::memset( buf->data(), pattern++, buf->size() );
+
+                {
+                    std::lock_guard<std::mutex> lck{ mtx_ };
+                    counters_.sink_delivered += 1;
+                    output_queue_.push_back( buf );
+                }
+                cond_.notify_one();
+            }
+        }
+
+        void consumer_thread()
+        {
+            while( true )
+            {
+                std::vector<uint8_t>* buf = nullptr;
+                {
+                    std::unique_lock<std::mutex> lck{ mtx_ };
+                    cond_.wait( lck, [this] { return stop_requested_ || !output_queue_.empty(); } );
+                    if( stop_requested_ ) {
+                        return;
+                    }
+                    buf = output_queue_.front();
+                    output_queue_.pop_front();
+                }
+
+                on_frame_( *buf );
+
+                {
+                    std::lock_guard<std::mutex> lck{ mtx_ };
+                    free_queue_.push_back( buf );
+                }
+            }
+        }
+
+        clock::duration period_;
+        std::function<void( const std::vector<uint8_t>& )> on_frame_;
+
+        std::vector<std::vector<uint8_t>> buffers_;
+
+        mutable std::mutex mtx_;
+        std::condition_variable cond_;
+        bool stop_requested_ = false;
+        std::deque<std::vector<uint8_t>*> free_queue_;
+        std::deque<std::vector<uint8_t>*> output_queue_;
+        stream_counters counters_;
+
+        std::thread producer_;
+        std::thread consumer_;
+    };
+}
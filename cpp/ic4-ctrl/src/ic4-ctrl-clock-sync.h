@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace clock_sync
+{
+    struct config
+    {
+        int samples = 100;
+        int interval_ms = 10;
+    };
+
+    // One latch: the device timestamp and the host steady_clock time in the middle of the latch command
+    struct sample
+    {
+        int64_t host_ns = 0;
+        int64_t device_ns = 0;
+        double latch_us = 0;        // Duration of the latch command, an upper bound for the error of host_ns
+    };
+
+    // Streaming least-squares fit of device_ns = offset_ns + slope * host_ns.
+    //
+    // The sums are kept as running means and co-moments (Welford) of the values relative to the first sample, so the
+    // 64-bit nanosecond timestamps do not lose precision in double arithmetic.
+    class linear_fit
+    {
+    public:
+        void add( int64_t host_ns, int64_t device_ns )
+        {
+            if( count_ == 0 ) {
+                host_base_ = host_ns;
+                device_base_ = device_ns;
+            }
+            double x = static_cast<double>( host_ns - host_base_ );
+            double y = static_cast<double>( device_ns - device_base_ );
+
+            count_ += 1;
+            double dx = x - mean_x_;
+            mean_x_ += dx / count_;
+            double dy = y - mean_y_;
+            mean_y_ += dy / count_;
+            m_xx_ += dx * (x - mean_x_);
+            m_yy_ += dy * (y - mean_y_);
+            m_xy_ += dx * (y - mean_y_);
+        }
+
+        size_t count() const { return count_; }
+
+        double slope() const
+        {
+            return m_xx_ > 0 ? m_xy_ / m_xx_ : 1.0;
+        }
+
+        // Device time at host steady_clock time 0
+        int64_t offset_ns() const
+        {
+            long double intercept = static_cast<long double>( mean_y_ ) - static_cast<long double>( slope() ) * mean_x_;
+            return device_base_ + static_cast<int64_t>( std::llround( intercept - static_cast<long double>( slope() ) * host_base_ ) );
+        }
+
+        // Drift of the device clock against the host clock in parts per million
+        double drift_ppm() const
+        {
+            return (slope() - 1.0) * 1e6;
+        }
+
+        // Standard deviation of the residuals in ns
+        double residual_rms_ns() const
+        {
+            if( count_ < 3 || m_xx_ <= 0 ) {
+                return 0;
+            }
+            double ssr = m_yy_ - m_xy_ * m_xy_ / m_xx_;
+            return std::sqrt( std::max( 0.0, ssr ) / static_cast<double>( count_ - 2 ) );
+        }
+
+        // Host steady_clock time that corresponds to a device timestamp, e.g. ImageBuffer::MetaData::device_timestamp_ns
+        int64_t host_ns( int64_t device_ns ) const
+        {
+            long double y = static_cast<long double>( device_ns - device_base_ );
+            long double intercept = static_cast<long double>( mean_y_ ) - static_cast<long double>( slope() ) * mean_x_;
+            return host_base_ + static_cast<int64_t>( std::llround( (y - intercept) / slope() ) );
+        }
+
+        double residual_ns( const sample& s ) const
+        {
+            double x = static_cast<double>( s.host_ns - host_base_ );
+            double y = static_cast<double>( s.device_ns - device_base_ );
+            return y - (mean_y_ + slope() * (x - mean_x_));
+        }
+
+    private:
+        size_t count_ = 0;
+        int64_t host_base_ = 0;
+        int64_t device_base_ = 0;
+        double mean_x_ = 0;
+        double mean_y_ = 0;
+        double m_xx_ = 0;
+        double m_yy_ = 0;
+        double m_xy_ = 0;
+    };
+}
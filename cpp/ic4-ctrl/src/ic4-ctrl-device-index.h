@@ -0,0 +1,359 @@
+#pragma once
+
+#include <ic4/ic4.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ic4-ctrl-helper.h"
+
+#if !defined WIN32
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace device_index
+{
+    // Everything ic4-ctrl needs to identify a device without keeping the ic4::DeviceInfo around
+    struct entry
+    {
+        std::string serial;
+        std::string unique_name;
+        std::string model_name;
+        std::string user_id;
+        std::string version;
+        std::string interface_name;
+        std::string transport_layer_name;
+        std::string ip_address;     // only for GigEVision devices
+    };
+
+    inline auto format_ipv4( int64_t v ) -> std::string
+    {
+        return std::to_string( (v >> 24) & 0xFF ) + "." + std::to_string( (v >> 16) & 0xFF ) + "."
+            + std::to_string( (v >> 8) & 0xFF ) + "." + std::to_string( v & 0xFF );
+    }
+
+    // The cache is kept in a per-user directory, so other users can neither replace it nor redirect the write through a symlink.
+    // Returns an empty string if no such directory is known; the cache is not used then.
+    inline auto default_cache_filename() -> std::string
+    {
+#if defined WIN32
+        return helper::get_env_var( "TEMP" ) + "\\ic4-ctrl-devices.cache";
+#else
+        auto dir = helper::get_env_var( "XDG_CACHE_HOME" );
+        if( dir.empty() && !helper::get_env_var( "HOME" ).empty() ) {
+            dir = helper::get_env_var( "HOME" ) + "/.cache";
+        }
+        if( dir.empty() ) {
+            dir = helper::get_env_var( "XDG_RUNTIME_DIR" );
+        }
+        if( dir.empty() ) {
+            return {};
+        }
+        return dir + "/ic4-ctrl/devices.cache";
+#endif
+    }
+
+    // Hash index over the identifiers of all devices, built from a single enumeration or loaded from a cache file.
+    class index
+    {
+    public:
+        // With details == false, only the identifiers that need no extra device access are filled in: user id, version and
+        // IP address stay empty. Such an index must not be saved as the cache.
+        static auto enumerate( bool details = true ) -> index
+        {
+            index idx;
+            idx.devices_ = ic4::DeviceEnum::enumDevices();
+
+            std::vector<ic4::Interface> gige_interfaces;
+            std::vector<std::string> gige_interface_names;
+            for( auto&& dev : idx.devices_ )
+            {
+                auto itf = dev.getInterface();
+
+                entry e;
+                e.serial = dev.serial();
+                e.unique_name = dev.uniqueName();
+                e.model_name = dev.modelName();
+                e.interface_name = itf.interfaceDisplayName();
+                e.transport_layer_name = itf.transportLayerName();
+                if( details ) {
+                    e.user_id = dev.userID( ic4::Error::Ignore() );
+                    e.version = dev.version( ic4::Error::Ignore() );
+                }
+                idx.entries_.push_back( e );
+
+                if( details && itf.transportLayerType( ic4::Error::Ignore() ) == ic4::TransportLayerType::GigEVision
+                    && std::find( gige_interface_names.begin(), gige_interface_names.end(), e.interface_name ) == gige_interface_names.end() )
+                {
+                    gige_interfaces.push_back( itf );
+                    gige_interface_names.push_back( e.interface_name );
+                }
+            }
+            for( auto&& itf : gige_interfaces ) {
+                idx.fetch_ip_addresses( itf );
+            }
+
+            idx.build_maps();
+            return idx;
+        }
+
+        // Fails if the file does not exist, is malformed, empty or older than ttl
+        static bool load( const std::string& filename, std::chrono::seconds ttl, index& idx )
+        {
+            if( filename.empty() ) {
+                return false;
+            }
+
+            std::ifstream f( filename );
+            std::string line;
+            if( !f || !std::getline( f, line ) ) {
+                return false;
+            }
+
+            auto header = split( line );
+            if( header.size() != 3 || header[0] != "ic4-ctrl-device-cache" || header[1] != "1" ) {
+                return false;
+            }
+            int64_t created = 0;
+            if( !helper::from_chars_helper( header[2], created ) || now_s() - created > ttl.count() || now_s() < created ) {
+                return false;
+            }
+
+            index rval;
+            while( std::getline( f, line ) )
+            {
+                auto fields = split( line );
+                if( fields.size() != 8 ) {
+                    return false;
+                }
+                entry e;
+                e.serial = fields[0];
+                e.unique_name = fields[1];
+                e.model_name = fields[2];
+                e.user_id = fields[3];
+                e.version = fields[4];
+                e.interface_name = fields[5];
+                e.transport_layer_name = fields[6];
+                e.ip_address = fields[7];
+                rval.entries_.push_back( e );
+            }
+            if( rval.entries_.empty() ) {
+                return false;
+            }
+
+            rval.build_maps();
+            idx = std::move( rval );
+            return true;
+        }
+
+        void save( const std::string& filename ) const
+        {
+            if( filename.empty() ) {
+                return;
+            }
+
+            std::string contents = "ic4-ctrl-device-cache\t1\t" + std::to_string( now_s() ) + "\n";
+            for( auto&& e : entries_ )
+            {
+                contents += sanitize( e.serial ) + '\t' + sanitize( e.unique_name ) + '\t' + sanitize( e.model_name ) + '\t'
+                    + sanitize( e.user_id ) + '\t' + sanitize( e.version ) + '\t' + sanitize( e.interface_name ) + '\t'
+                    + sanitize( e.transport_layer_name ) + '\t' + sanitize( e.ip_address ) + "\n";
+            }
+
+            // Write to a temporary file first so that a concurrent load never sees a partial file
+#if defined WIN32
+            auto tmp_filename = filename + ".tmp";
+            {
+                std::ofstream f( tmp_filename, std::ios::trunc );
+                if( !f ) {
+                    return;
+                }
+                f << contents;
+            }
+            std::remove( filename.c_str() );
+            std::rename( tmp_filename.c_str(), filename.c_str() );
+#else
+            // Missing directories, e.g. ~/.cache on a fresh account, are created and only accessible by the user.
+            // The temporary file gets a unique name and is created exclusively, it never follows a symlink planted at a predictable name.
+            for( auto slash = filename.find( '/', 1 ); slash != std::string::npos; slash = filename.find( '/', slash + 1 ) )
+            {
+                if( ::mkdir( filename.substr( 0, slash ).c_str(), 0700 ) != 0 && errno != EEXIST ) {
+                    return;
+                }
+            }
+
+            std::string tmp_filename = filename + ".XXXXXX";
+            int fd = ::mkstemp( &tmp_filename[0] );
+            if( fd < 0 ) {
+                return;
+            }
+            bool ok = ::write( fd, contents.data(), contents.size() ) == static_cast<ssize_t>( contents.size() );
+            ok = ::close( fd ) == 0 && ok;
+            if( !ok || std::rename( tmp_filename.c_str(), filename.c_str() ) != 0 ) {
+                ::unlink( tmp_filename.c_str() );
+            }
+#endif
+        }
+
+        const std::vector<entry>& entries() const { return entries_; }
+
+        // True if the index was built by enumerate(), false if it was loaded from a cache file
+        bool is_live() const { return !devices_.empty(); }
+
+        // Resolution order: serial, unique name, model name, user id, IP address and then the index into the device list
+        auto find( const std::string& id ) const -> const entry*
+        {
+            for( auto* map : { &by_serial_, &by_unique_name_, &by_model_name_, &by_user_id_, &by_ip_address_ } )
+            {
+                auto it = map->find( id );
+                if( it != map->end() ) {
+                    return &entries_[it->second];
+                }
+            }
+
+            int64_t idx = 0;
+            if( helper::from_chars_helper( id, idx ) && idx >= 0 && idx < static_cast<int64_t>( entries_.size() ) ) {
+                return &entries_[static_cast<size_t>( idx )];
+            }
+            return nullptr;
+        }
+
+        // Returns the ic4::DeviceInfo for the entry.
+        // For an index loaded from the cache only the device's interface is enumerated, which skips discovery on all others.
+        // Returns nullptr if the device is no longer present.
+        auto device_info( const entry& e ) const -> std::unique_ptr<ic4::DeviceInfo>
+        {
+            if( is_live() ) {
+                return std::make_unique<ic4::DeviceInfo>( devices_[static_cast<size_t>( &e - entries_.data() )] );
+            }
+
+            for( auto&& itf : ic4::DeviceEnum::enumInterfaces() )
+            {
+                if( itf.interfaceDisplayName() != e.interface_name || itf.transportLayerName() != e.transport_layer_name ) {
+                    continue;
+                }
+                for( auto&& dev : itf.enumDevices() )
+                {
+                    if( dev.uniqueName() == e.unique_name ) {
+                        return std::make_unique<ic4::DeviceInfo>( dev );
+                    }
+                }
+            }
+            return nullptr;
+        }
+
+    private:
+        static int64_t now_s()
+        {
+            return std::chrono::duration_cast<std::chrono::seconds>( std::chrono::system_clock::now().time_since_epoch() ).count();
+        }
+
+        static auto split( const std::string& line ) -> std::vector<std::string>
+        {
+            std::vector<std::string> fields;
+            size_t begin = 0;
+            while( true )
+            {
+                auto end = line.find( '\t', begin );
+                fields.push_back( line.substr( begin, end - begin ) );
+                if( end == std::string::npos ) {
+                    return fields;
+                }
+                begin = end + 1;
+            }
+        }
+
+        static auto sanitize( std::string str ) -> std::string
+        {
+            for( auto& c : str ) {
+                if( c == '\t' || c == '\n' || c == '\r' ) {
+                    c = ' ';
+                }
+            }
+            return str;
+        }
+
+        // The interface property map lists the IP address of every device found on it, selected by DeviceSelector.
+        // DeviceSelector is restored afterwards, other users of the interface may rely on its value.
+        void fetch_ip_addresses( const ic4::Interface& itf )
+        {
+            ic4::Error err;
+            auto map = itf.interfacePropertyMap( err );
+            if( err.isError() ) {
+                return;
+            }
+            auto selector = map.findInteger( "DeviceSelector", err );
+            if( err.isError() ) {
+                return;
+            }
+            auto max = selector.maximum( err );
+            if( err.isError() ) {
+                return;
+            }
+            auto prev_selection = selector.getValue( err );
+            bool restore_selection = err.isSuccess();
+
+            auto itf_name = itf.interfaceDisplayName();
+            for( int64_t i = 0; i <= max; ++i )
+            {
+                if( !selector.setValue( i, err ) ) {
+                    continue;
+                }
+                auto ip = map.getValueInt64( "GevDeviceIPAddress", err );
+                if( err.isError() ) {
+                    continue;
+                }
+                auto serial = map.getValueString( "DeviceSerialNumber", err );
+                if( err.isError() ) {
+                    continue;
+                }
+                for( auto& e : entries_ )
+                {
+                    if( e.interface_name == itf_name && e.serial == serial ) {
+                        e.ip_address = format_ipv4( ip );
+                    }
+                }
+            }
+
+            if( restore_selection ) {
+                selector.setValue( prev_selection, ic4::Error::Ignore() );
+            }
+        }
+
+        // The first device wins if several devices share an identifier, e.g. the model name
+        void build_maps()
+        {
+            for( size_t i = 0; i < entries_.size(); ++i )
+            {
+                const auto& e = entries_[i];
+                by_serial_.emplace( e.serial, i );
+                by_unique_name_.emplace( e.unique_name, i );
+                by_model_name_.emplace( e.model_name, i );
+                if( !e.user_id.empty() ) {
+                    by_user_id_.emplace( e.user_id, i );
+                }
+                if( !e.ip_address.empty() ) {
+                    by_ip_address_.emplace( e.ip_address, i );
+                }
+            }
+        }
+
+        std::vector<entry> entries_;
+        std::vector<ic4::DeviceInfo> devices_;
+
+        std::unordered_map<std::string, size_t> by_serial_;
+        std::unordered_map<std::string, size_t> by_unique_name_;
+        std::unordered_map<std::string, size_t> by_model_name_;
+        std::unordered_map<std::string, size_t> by_user_id_;
+        std::unordered_map<std::string, size_t> by_ip_address_;
+    };
+}
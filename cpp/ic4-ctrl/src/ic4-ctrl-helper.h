@@ -2,11 +2,15 @@
 #pragma once
 
 #include <stdlib.h> // getenv, setenv
+#include <cstdio>
 #include <string>
 
 #if defined WIN32
 #define NOMINMAX
 #include <windows.h>
+#else
+#include <fcntl.h>  // open
+#include <unistd.h> // fsync, close, getcwd
 #endif
 
 namespace helper
@@ -42,7 +46,40 @@ namespace helper
         }
     }
 
+    // Appends the JSON escaped str to out, without surrounding quotes. Writes directly to the caller's buffer, so that no
+    // temporary string is allocated per field.
+    template<typename OutputIt>
+    auto json_escape_to( OutputIt out, const std::string& str ) -> OutputIt
+    {
+        static const char hex_digits[] = "0123456789abcdef";
 
+        for( char c : str )
+        {
+            switch( c )
+            {
+            case '"':   *out++ = '\\'; *out++ = '"'; break;
+            case '\\':  *out++ = '\\'; *out++ = '\\'; break;
+            case '\n':  *out++ = '\\'; *out++ = 'n'; break;
+            case '\r':  *out++ = '\\'; *out++ = 'r'; break;
+            case '\t':  *out++ = '\\'; *out++ = 't'; break;
+            default:
+                if( static_cast<unsigned char>( c ) < 0x20 )
+                {
+                    auto u = static_cast<unsigned char>( c );
+                    for( char e : { '\\', 'u', '0', '0' } ) {
+                        *out++ = e;
+                    }
+                    *out++ = hex_digits[u >> 4];
+                    *out++ = hex_digits[u & 0xF];
+                }
+                else
+                {
+                    *out++ = c;
+                }
+            }
+        }
+        return out;
+    }
 
 #if defined WIN32
     inline void set_env_var( std::string env_name, std::string value )
@@ -62,6 +99,27 @@ namespace helper
         ::free( buf );
         return str;
     }
+
+    inline auto absolute_path( const std::string& path ) -> std::string
+    {
+        char buf[MAX_PATH];
+        if( ::_fullpath( buf, path.c_str(), sizeof( buf ) ) == nullptr ) {
+            return path;
+        }
+        return buf;
+    }
+
+    // Flushes the written contents of the file to the storage device
+    inline bool sync_file( const std::string& filename )
+    {
+        HANDLE h = ::CreateFileA( filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+        if( h == INVALID_HANDLE_VALUE ) {
+            return false;
+        }
+        bool rval = ::FlushFileBuffers( h ) != 0;
+        ::CloseHandle( h );
+        return rval;
+    }
 #else
     inline void set_env_var( std::string env_name, std::string value )
     {
@@ -76,6 +134,30 @@ namespace helper
         }
         return std::string{ ptr };
     }
+
+    inline auto absolute_path( const std::string& path ) -> std::string
+    {
+        if( path.empty() || path[0] == '/' ) {
+            return path;
+        }
+        char buf[4096];
+        if( ::getcwd( buf, sizeof( buf ) ) == nullptr ) {
+            return path;
+        }
+        return std::string{ buf } + "/" + path;
+    }
+
+    // Flushes the written contents of the file to the storage device
+    inline bool sync_file( const std::string& filename )
+    {
+        int fd = ::open( filename.c_str(), O_RDONLY );
+        if( fd < 0 ) {
+            return false;
+        }
+        bool rval = ::fsync( fd ) == 0;
+        ::close( fd );
+        return rval;
+    }
 #endif
 
 }
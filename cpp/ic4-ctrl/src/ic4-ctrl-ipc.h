@@ -0,0 +1,241 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Line protocol used between `ic4-ctrl serve` and `ic4-ctrl --server <socket> <subcommand>`.
+//
+// Request:  One line of tab-separated fields, the first field is the output format and the second the command name,
+//           e.g. "text\tprop\t0\tExposureTime=1000\n".
+// Response: "<exit-code> <payload-size>\n" followed by payload-size bytes of command output.
+namespace ipc
+{
+    inline auto make_address( const std::string& path ) -> sockaddr_un
+    {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if( path.size() >= sizeof( addr.sun_path ) ) {
+            throw std::runtime_error( "Socket path '" + path + "' is too long" );
+        }
+        std::memcpy( addr.sun_path, path.c_str(), path.size() + 1 );
+        return addr;
+    }
+
+    // Owns a socket file descriptor
+    class socket_handle
+    {
+    public:
+        socket_handle() = default;
+        explicit socket_handle( int fd ) : fd_( fd ) {}
+        ~socket_handle()
+        {
+            if( fd_ >= 0 ) {
+                ::close( fd_ );
+            }
+        }
+        socket_handle( socket_handle&& other ) : fd_( other.fd_ ) { other.fd_ = -1; }
+        socket_handle& operator=( socket_handle&& other )
+        {
+            std::swap( fd_, other.fd_ );
+            return *this;
+        }
+        socket_handle( const socket_handle& ) = delete;
+        socket_handle& operator=( const socket_handle& ) = delete;
+
+        int fd() const { return fd_; }
+        bool valid() const { return fd_ >= 0; }
+
+    private:
+        int fd_ = -1;
+    };
+
+    inline auto listen_socket( const std::string& path ) -> socket_handle
+    {
+        auto addr = make_address( path );
+
+        socket_handle s{ ::socket( AF_UNIX, SOCK_STREAM, 0 ) };
+        if( !s.valid() ) {
+            throw std::runtime_error( std::string( "Failed to create socket: " ) + std::strerror( errno ) );
+        }
+
+        // Remove a stale socket file left behind by a previous server, but never a regular file or the socket of a running server
+        struct stat st = {};
+        if( ::lstat( path.c_str(), &st ) == 0 )
+        {
+            if( !S_ISSOCK( st.st_mode ) ) {
+                throw std::runtime_error( "'" + path + "' exists and is not a socket" );
+            }
+
+            socket_handle probe{ ::socket( AF_UNIX, SOCK_STREAM, 0 ) };
+            if( probe.valid() && ::connect( probe.fd(), reinterpret_cast<const sockaddr*>( &addr ), sizeof( addr ) ) == 0 ) {
+                throw std::runtime_error( "Another server is already listening on '" + path + "'" );
+            }
+            if( errno != ECONNREFUSED ) {
+                throw std::runtime_error( "Failed to check socket '" + path + "': " + std::strerror( errno ) );
+            }
+            ::unlink( path.c_str() );
+        }
+
+        if( ::bind( s.fd(), reinterpret_cast<const sockaddr*>( &addr ), sizeof( addr ) ) != 0 ) {
+            throw std::runtime_error( "Failed to bind socket '" + path + "': " + std::strerror( errno ) );
+        }
+        if( ::listen( s.fd(), 16 ) != 0 ) {
+            throw std::runtime_error( "Failed to listen on socket '" + path + "': " + std::strerror( errno ) );
+        }
+        return s;
+    }
+
+    // Makes blocking reads and writes on the socket fail with EAGAIN after timeout_ms, so that a client that stops sending or
+    // receiving cannot block the server
+    inline void set_timeout( int fd, int timeout_ms )
+    {
+        timeval tv = {};
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = ( timeout_ms % 1000 ) * 1000;
+        ::setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+        ::setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+    }
+
+    inline auto connect_socket( const std::string& path ) -> socket_handle
+    {
+        auto addr = make_address( path );
+
+        socket_handle s{ ::socket( AF_UNIX, SOCK_STREAM, 0 ) };
+        if( !s.valid() ) {
+            throw std::runtime_error( std::string( "Failed to create socket: " ) + std::strerror( errno ) );
+        }
+        if( ::connect( s.fd(), reinterpret_cast<const sockaddr*>( &addr ), sizeof( addr ) ) != 0 ) {
+            throw std::runtime_error( "Failed to connect to server '" + path + "': " + std::strerror( errno ) );
+        }
+        return s;
+    }
+
+    inline bool write_all( int fd, const char* data, size_t size )
+    {
+        while( size > 0 )
+        {
+            auto n = ::send( fd, data, size, MSG_NOSIGNAL );
+            if( n < 0 )
+            {
+                if( errno == EINTR ) {
+                    continue;
+                }
+                return false;
+            }
+            data += n;
+            size -= static_cast<size_t>( n );
+        }
+        return true;
+    }
+
+    inline bool read_exact( int fd, char* data, size_t size )
+    {
+        while( size > 0 )
+        {
+            auto n = ::recv( fd, data, size, 0 );
+            if( n < 0 && errno == EINTR ) {
+                continue;
+            }
+            if( n <= 0 ) {
+                return false;
+            }
+            data += n;
+            size -= static_cast<size_t>( n );
+        }
+        return true;
+    }
+
+    // Reads up to and excluding the next '\n'. Returns false if the connection was closed or the socket timeout (see set_timeout) elapsed before.
+    inline bool read_line( int fd, std::string& line, size_t max_size = 1024 * 1024 )
+    {
+        line.clear();
+        char c = 0;
+        while( read_exact( fd, &c, 1 ) )
+        {
+            if( c == '\n' ) {
+                return true;
+            }
+            if( line.size() >= max_size ) {
+                return false;
+            }
+            line += c;
+        }
+        return false;
+    }
+
+    inline auto join_fields( const std::vector<std::string>& fields ) -> std::string
+    {
+        std::string line;
+        for( size_t i = 0; i < fields.size(); ++i )
+        {
+            if( fields[i].find_first_of( "\t\n" ) != std::string::npos ) {
+                throw std::runtime_error( "Argument '" + fields[i] + "' cannot be forwarded to the server, it contains a tab or newline" );
+            }
+            if( i > 0 ) {
+                line += '\t';
+            }
+            line += fields[i];
+        }
+        return line;
+    }
+
+    inline auto split_fields( const std::string& line ) -> std::vector<std::string>
+    {
+        std::vector<std::string> fields;
+        size_t begin = 0;
+        while( true )
+        {
+            auto end = line.find( '\t', begin );
+            fields.push_back( line.substr( begin, end - begin ) );
+            if( end == std::string::npos ) {
+                return fields;
+            }
+            begin = end + 1;
+        }
+    }
+
+    inline bool write_response( int fd, int exit_code, const char* payload, size_t size )
+    {
+        auto header = std::to_string( exit_code ) + " " + std::to_string( size ) + "\n";
+        return write_all( fd, header.data(), header.size() ) && write_all( fd, payload, size );
+    }
+
+    // Sends the request and waits for the response. Returns the exit code reported by the server.
+    inline int call( const std::string& path, const std::vector<std::string>& fields, std::string& payload )
+    {
+        auto s = connect_socket( path );
+
+        auto request = join_fields( fields ) + "\n";
+        if( !write_all( s.fd(), request.data(), request.size() ) ) {
+            throw std::runtime_error( std::string( "Failed to send request: " ) + std::strerror( errno ) );
+        }
+
+        std::string header;
+        if( !read_line( s.fd(), header, 64 ) ) {
+            throw std::runtime_error( "Server closed the connection without a response" );
+        }
+
+        int exit_code = 0;
+        unsigned long long size = 0;
+        if( std::sscanf( header.c_str(), "%d %llu", &exit_code, &size ) != 2 ) {
+            throw std::runtime_error( "Malformed response header '" + header + "'" );
+        }
+
+        payload.resize( static_cast<size_t>( size ) );
+        if( size > 0 && !read_exact( s.fd(), &payload[0], payload.size() ) ) {
+            throw std::runtime_error( "Server closed the connection before the response was complete" );
+        }
+        return exit_code;
+    }
+}
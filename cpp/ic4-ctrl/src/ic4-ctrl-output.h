@@ -0,0 +1,202 @@
+#pragma once
+
+#include <fmt/format.h>
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "ic4-ctrl-helper.h"
+
+namespace output
+{
+    enum class format
+    {
+        text,
+        json,       // All records of a command as one JSON array
+        ndjson,     // One JSON object per line
+    };
+
+    inline bool parse_format( const std::string& str, format& fmt )
+    {
+        if( str == "text" ) {
+            fmt = format::text;
+        } else if( str == "json" ) {
+            fmt = format::json;
+        } else if( str == "ndjson" ) {
+            fmt = format::ndjson;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    inline auto to_string( format fmt ) -> const char*
+    {
+        switch( fmt )
+        {
+        case format::json:      return "json";
+        case format::ndjson:    return "ndjson";
+        case format::text:
+        default:                return "text";
+        }
+    }
+
+    // Builds one JSON object per record in a preallocated buffer and passes the complete record to the sink with a single write.
+    //
+    //  record_writer out{ format::ndjson, sink };
+    //  out.begin_record().field( "name", "ExposureTime" ).field( "value", 1000.0 );
+    //  out.end_record();
+    class record_writer
+    {
+    public:
+        using sink_func = void (*)( const char* data, size_t size );
+
+        record_writer( format fmt, sink_func sink, size_t reserve = 64 * 1024 )
+            : format_( fmt ), sink_( sink )
+        {
+            buf_.reserve( reserve );
+            need_comma_.reserve( 16 );
+        }
+
+        ~record_writer()
+        {
+            finish();
+        }
+
+        record_writer( const record_writer& ) = delete;
+        record_writer& operator=( const record_writer& ) = delete;
+
+        record_writer& begin_record()
+        {
+            buf_.clear();
+            need_comma_.clear();
+            if( format_ == format::json ) {
+                append( num_records_ == 0 ? "[\n" : ",\n" );
+            }
+            open( '{' );
+            return *this;
+        }
+
+        void end_record()
+        {
+            close( '}' );
+            if( format_ != format::json ) {
+                append( "\n" );
+            }
+            sink_( buf_.data(), buf_.size() );
+            buf_.clear();
+            num_records_ += 1;
+        }
+
+        // Terminates the JSON array. Called by the destructor, a partially built record is discarded.
+        void finish()
+        {
+            if( finished_ ) {
+                return;
+            }
+            finished_ = true;
+
+            if( format_ == format::json )
+            {
+                buf_.clear();
+                append( num_records_ == 0 ? "[]\n" : "\n]\n" );
+                sink_( buf_.data(), buf_.size() );
+            }
+        }
+
+        record_writer& field( const char* name, const std::string& value )  { key( name ); append_string( value ); return *this; }
+        record_writer& field( const char* name, const char* value )         { key( name ); append_string( value ); return *this; }
+        record_writer& field( const char* name, bool value )                { key( name ); append( value ? "true" : "false" ); return *this; }
+        record_writer& field( const char* name, double value )              { key( name ); append_double( value ); return *this; }
+        record_writer& field_null( const char* name )                       { key( name ); append( "null" ); return *this; }
+
+        template<class T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, int>::type = 0>
+        record_writer& field( const char* name, T value )
+        {
+            key( name );
+            fmt::format_to( std::back_inserter( buf_ ), "{}", value );
+            return *this;
+        }
+
+        // Array elements
+        record_writer& value( const std::string& value )    { element(); append_string( value ); return *this; }
+        record_writer& value( double value )                { element(); append_double( value ); return *this; }
+
+        template<class T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, int>::type = 0>
+        record_writer& value( T value )
+        {
+            element();
+            fmt::format_to( std::back_inserter( buf_ ), "{}", value );
+            return *this;
+        }
+
+        record_writer& begin_object( const char* name ) { key( name ); open( '{' ); return *this; }
+        record_writer& begin_object()                   { element(); open( '{' ); return *this; }
+        record_writer& end_object()                     { close( '}' ); return *this; }
+
+        record_writer& begin_array( const char* name )  { key( name ); open( '[' ); return *this; }
+        record_writer& end_array()                      { close( ']' ); return *this; }
+
+    private:
+        void append( const char* str )
+        {
+            buf_.append( str, str + std::char_traits<char>::length( str ) );
+        }
+
+        void append_string( const std::string& str )
+        {
+            buf_.push_back( '"' );
+            helper::json_escape_to( std::back_inserter( buf_ ), str );
+            buf_.push_back( '"' );
+        }
+
+        // JSON has no representation for nan and inf
+        void append_double( double v )
+        {
+            if( std::isfinite( v ) ) {
+                fmt::format_to( std::back_inserter( buf_ ), "{}", v );
+            } else {
+                append( "null" );
+            }
+        }
+
+        void element()
+        {
+            if( need_comma_.back() ) {
+                buf_.push_back( ',' );
+            }
+            need_comma_.back() = true;
+        }
+
+        void key( const char* name )
+        {
+            element();
+            buf_.push_back( '"' );
+            append( name );
+            append( "\":" );
+        }
+
+        void open( char c )
+        {
+            buf_.push_back( c );
+            need_comma_.push_back( false );
+        }
+
+        void close( char c )
+        {
+            buf_.push_back( c );
+            need_comma_.pop_back();
+        }
+
+        format format_;
+        sink_func sink_;
+
+        fmt::memory_buffer buf_;
+        std::vector<bool> need_comma_;
+        size_t num_records_ = 0;
+        bool finished_ = false;
+    };
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <ic4/ic4.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <istream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ic4_helper
+{
+    struct prop_assignment
+    {
+        std::string name;
+        std::string value;
+        int line = 0;
+    };
+
+    // Parses one "Name=Value" assignment per line. Empty lines and lines starting with '#' are skipped.
+    inline auto parse_prop_assignments( std::istream& in ) -> std::vector<prop_assignment>
+    {
+        auto trim = []( const std::string& str ) -> std::string
+        {
+            auto begin = str.find_first_not_of( " \t\r" );
+            if( begin == std::string::npos ) {
+                return {};
+            }
+            auto end = str.find_last_not_of( " \t\r" );
+            return str.substr( begin, end - begin + 1 );
+        };
+
+        std::vector<prop_assignment> rval;
+        std::string line;
+        int line_number = 0;
+        while( std::getline( in, line ) )
+        {
+            line_number += 1;
+            line = trim( line );
+            if( line.empty() || line[0] == '#' ) {
+                continue;
+            }
+
+            auto f = line.find( '=' );
+            if( f == std::string::npos || f == 0 ) {
+                throw std::runtime_error( "Line " + std::to_string( line_number ) + ": expected 'Name=Value', got '" + line + "'" );
+            }
+
+            prop_assignment a;
+            a.name = trim( line.substr( 0, f ) );
+            a.value = trim( line.substr( f + 1 ) );
+            a.line = line_number;
+            rval.push_back( a );
+        }
+        return rval;
+    }
+
+    // Properties that define the image format are applied first, in this order, because the valid ranges of later
+    // properties depend on them: Width/Height on PixelFormat, binning and decimation; OffsetX/OffsetY on Width/Height;
+    // frame rate and exposure limits on all of them.
+    inline int prop_apply_rank( const std::string& name )
+    {
+        static const char* const format_properties[][4] = {
+            { "PixelFormat", "BinningHorizontal", "BinningVertical", nullptr },
+            { "DecimationHorizontal", "DecimationVertical", "BinningSelector", nullptr },
+            { "Width", "Height", nullptr, nullptr },
+            { "OffsetX", "OffsetY", "OffsetAutoCenter", nullptr },
+        };
+
+        int rank = 0;
+        for( auto&& names : format_properties )
+        {
+            for( auto n : names )
+            {
+                if( n && name == n ) {
+                    return rank;
+                }
+            }
+            rank += 1;
+        }
+        return rank;
+    }
+
+    // Orders the assignments so that they can be applied in one go.
+    //
+    // An assignment to a selector (e.g. GainSelector) and the assignments to the properties it selects that follow it
+    // form a group that keeps its order, so "GainSelector=Red, Gain=2, GainSelector=Blue, Gain=3" still means the same.
+    // The groups are then stable-sorted by prop_apply_rank(). Throws if a property does not exist.
+    inline auto order_prop_assignments( ic4::PropertyMap& map, const std::vector<prop_assignment>& lst ) -> std::vector<prop_assignment>
+    {
+        struct group
+        {
+            int rank = 0;
+            std::vector<prop_assignment> members;
+        };
+        std::vector<group> groups;
+        std::map<std::string, size_t> group_of_selected;   // Selected property name -> group of the last assignment to its selector
+
+        for( auto&& a : lst )
+        {
+            ic4::Error err;
+            auto prop = map.find( a.name, err );
+            if( err.isError() || !prop.is_valid() ) {
+                throw std::runtime_error( "Line " + std::to_string( a.line ) + ": failed to find property '" + a.name + "'" );
+            }
+
+            size_t group_index = groups.size();
+            auto it = group_of_selected.find( a.name );
+            if( it != group_of_selected.end() && !prop.isSelector() ) {
+                group_index = it->second;
+            } else {
+                groups.emplace_back();
+                groups.back().rank = prop_apply_rank( a.name );
+            }
+
+            auto& g = groups[group_index];
+            g.rank = std::min( g.rank, prop_apply_rank( a.name ) );
+            g.members.push_back( a );
+
+            if( prop.isSelector() )
+            {
+                for( auto&& selected : prop.selectedProperties( ic4::Error::Ignore() ) ) {
+                    group_of_selected[selected.name()] = group_index;
+                }
+            }
+        }
+
+        std::stable_sort( groups.begin(), groups.end(), []( const group& a, const group& b ) { return a.rank < b.rank; } );
+
+        std::vector<prop_assignment> rval;
+        rval.reserve( lst.size() );
+        for( auto&& g : groups ) {
+            rval.insert( rval.end(), g.members.begin(), g.members.end() );
+        }
+        return rval;
+    }
+
+    // Lets apply_prop_batch() stop and restart the data stream of a grabber
+    struct stream_control
+    {
+        std::function<bool()> is_streaming;
+        std::function<void()> stop;
+        std::function<void()> start;
+    };
+
+    struct prop_batch_result
+    {
+        size_t applied = 0;
+        bool stream_restarted = false;
+        double elapsed_ms = 0;          // Including stream stop and restart
+
+        // Only set if an assignment failed
+        bool failed = false;
+        prop_assignment failed_assignment;
+        std::string error;
+        size_t rolled_back = 0;
+        std::vector<std::string> rollback_errors;
+        std::vector<std::string> not_restorable;   // Applied, but not rolled back because the previous value could not be read
+    };
+
+    // Applies the ordered assignments as one transaction.
+    //
+    // If stream is set and the stream is running while one of the properties is locked, the stream is stopped once before
+    // the first assignment and restarted after the last one. If an assignment fails, all assignments applied before it
+    // are reverted in reverse order, and the stream is restarted anyway.
+    inline auto apply_prop_batch( ic4::PropertyMap& map, const std::vector<prop_assignment>& ordered, const stream_control* stream ) -> prop_batch_result
+    {
+        struct undo_entry
+        {
+            std::string name;
+            std::string previous_value;
+            std::vector<std::pair<std::string, std::string>> selector_state;
+        };
+
+        // The selectors that are assigned in this batch, with the properties they select
+        std::map<std::string, std::vector<std::string>> batch_selectors;
+        for( auto&& a : ordered )
+        {
+            auto prop = map.find( a.name );
+            if( prop.isSelector() && batch_selectors.find( a.name ) == batch_selectors.end() )
+            {
+                auto& selected_names = batch_selectors[a.name];
+                for( auto&& selected : prop.selectedProperties( ic4::Error::Ignore() ) ) {
+                    selected_names.push_back( selected.name() );
+                }
+            }
+        }
+
+        prop_batch_result res;
+        auto begin = std::chrono::steady_clock::now();
+
+        bool stop_stream = false;
+        if( stream && stream->is_streaming() )
+        {
+            for( auto&& a : ordered )
+            {
+                if( map.find( a.name ).isLocked() ) {
+                    stop_stream = true;
+                    break;
+                }
+            }
+        }
+        if( stop_stream ) {
+            stream->stop();
+        }
+
+        std::vector<undo_entry> undo;
+        undo.reserve( ordered.size() );
+        for( auto&& a : ordered )
+        {
+            undo_entry u;
+            u.name = a.name;
+
+            // The value of a selected property is only meaningful together with the current state of its selectors
+            for( auto&& sel : batch_selectors )
+            {
+                if( std::find( sel.second.begin(), sel.second.end(), a.name ) != sel.second.end() ) {
+                    u.selector_state.emplace_back( sel.first, map.getValueString( sel.first, ic4::Error::Ignore() ) );
+                }
+            }
+
+            ic4::Error err;
+            u.previous_value = map.getValueString( a.name, err );
+            bool can_undo = !err.isError();
+
+            if( !map.setValue( a.name, a.value, err ) )
+            {
+                res.failed = true;
+                res.failed_assignment = a;
+                res.error = err.message();
+                break;
+            }
+
+            res.applied += 1;
+            if( can_undo ) {
+                undo.push_back( std::move( u ) );
+            } else {
+                res.not_restorable.push_back( a.name );
+            }
+        }
+
+        if( res.failed )
+        {
+            for( auto it = undo.rbegin(); it != undo.rend(); ++it )
+            {
+                ic4::Error err;
+                for( auto&& sel : it->selector_state ) {
+                    map.setValue( sel.first, sel.second, ic4::Error::Ignore() );
+                }
+                if( map.setValue( it->name, it->previous_value, err ) ) {
+                    res.rolled_back += 1;
+                } else {
+                    res.rollback_errors.push_back( it->name + ": " + err.message() );
+                }
+            }
+        }
+
+        if( stop_stream )
+        {
+            stream->start();
+            res.stream_restarted = true;
+        }
+
+        res.elapsed_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - begin ).count();
+        return res;
+    }
+}
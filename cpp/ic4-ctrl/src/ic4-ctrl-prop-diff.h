@@ -0,0 +1,424 @@
+#pragma once
+
+#include <ic4/ic4.h>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ic4-ctrl-helper.h"
+#include "ic4-ctrl-property-info.h"
+
+namespace ic4_helper
+{
+    struct prop_snapshot_value
+    {
+        std::string name;
+        std::string value;
+    };
+
+    namespace detail
+    {
+        inline auto xml_unescape( const std::string& str ) -> std::string
+        {
+            static const std::pair<const char*, char> entities[] = {
+                { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' },
+            };
+
+            std::string rval;
+            rval.reserve( str.size() );
+            for( size_t i = 0; i < str.size(); ++i )
+            {
+                bool replaced = false;
+                if( str[i] == '&' )
+                {
+                    for( auto&& e : entities )
+                    {
+                        if( str.compare( i, std::char_traits<char>::length( e.first ), e.first ) == 0 ) {
+                            rval.push_back( e.second );
+                            i += std::char_traits<char>::length( e.first ) - 1;
+                            replaced = true;
+                            break;
+                        }
+                    }
+                }
+                if( !replaced ) {
+                    rval.push_back( str[i] );
+                }
+            }
+            return rval;
+        }
+
+        // Returns the value of attribute `name` of the element text between '<' and '>', or false if it has none
+        inline bool xml_attribute( const std::string& element, const char* name, std::string& value )
+        {
+            auto key = std::string( " " ) + name + "=";
+            auto pos = element.find( key );
+            if( pos == std::string::npos || pos + key.size() >= element.size() ) {
+                return false;
+            }
+            auto quote = element[pos + key.size()];
+            if( quote != '"' && quote != '\'' ) {
+                return false;
+            }
+            auto begin = pos + key.size() + 1;
+            auto end = element.find( quote, begin );
+            if( end == std::string::npos ) {
+                return false;
+            }
+            value = xml_unescape( element.substr( begin, end - begin ) );
+            return true;
+        }
+    }
+
+    // Parses the output of ic4::PropertyMap::serialize into the property values in file order.
+    // XML files contribute every element that has both a name and a value attribute, other files are read as
+    // GenApi feature persistence text with one "Name<whitespace>Value" per line and '#' comments.
+    inline auto parse_prop_snapshot( const std::string& text ) -> std::vector<prop_snapshot_value>
+    {
+        std::vector<prop_snapshot_value> rval;
+
+        auto first = text.find_first_not_of( " \t\r\n\xEF\xBB\xBF" );
+        if( first != std::string::npos && text[first] == '<' )
+        {
+            for( auto pos = text.find( '<', first ); pos != std::string::npos; pos = text.find( '<', pos + 1 ) )
+            {
+                auto end = text.find( '>', pos );
+                if( end == std::string::npos ) {
+                    break;
+                }
+                auto element = text.substr( pos, end - pos );
+                for( auto& c : element ) {
+                    if( c == '\t' || c == '\r' || c == '\n' ) {
+                        c = ' ';
+                    }
+                }
+
+                prop_snapshot_value v;
+                if( detail::xml_attribute( element, "name", v.name ) && detail::xml_attribute( element, "value", v.value ) ) {
+                    rval.push_back( std::move( v ) );
+                }
+                pos = end;
+            }
+            return rval;
+        }
+
+        size_t begin = 0;
+        while( begin < text.size() )
+        {
+            auto end = text.find( '\n', begin );
+            if( end == std::string::npos ) {
+                end = text.size();
+            }
+            auto line = text.substr( begin, end - begin );
+            begin = end + 1;
+
+            auto name_begin = line.find_first_not_of( " \t\r" );
+            if( name_begin == std::string::npos || line[name_begin] == '#' ) {
+                continue;
+            }
+            auto name_end = line.find_first_of( " \t", name_begin );
+            if( name_end == std::string::npos ) {
+                continue;
+            }
+            auto value_begin = line.find_first_not_of( " \t", name_end );
+            auto value_end = line.find_last_not_of( " \t\r" );
+
+            prop_snapshot_value v;
+            v.name = line.substr( name_begin, name_end - name_begin );
+            if( value_begin != std::string::npos && value_begin <= value_end ) {
+                v.value = line.substr( value_begin, value_end - value_begin + 1 );
+            }
+            rval.push_back( std::move( v ) );
+        }
+        return rval;
+    }
+
+    enum class prop_diff_status
+    {
+        differs,
+        missing,        // The property does not exist on the device
+        unavailable,    // The property exists but is not available in the current device state
+        unreadable,     // Reading the value failed
+    };
+
+    inline auto to_string( prop_diff_status status ) -> const char*
+    {
+        switch( status )
+        {
+        case prop_diff_status::missing:     return "missing";
+        case prop_diff_status::unavailable: return "unavailable";
+        case prop_diff_status::unreadable:  return "unreadable";
+        case prop_diff_status::differs:
+        default:                            return "differs";
+        }
+    }
+
+    struct prop_diff
+    {
+        std::string name;
+        std::string selectors;          // Selector state the value belongs to, e.g. "GainSelector=Red", empty if none
+        std::string expected;
+        std::string actual;
+        prop_diff_status status = prop_diff_status::differs;
+    };
+
+    struct prop_diff_result
+    {
+        size_t compared = 0;
+        size_t skipped = 0;             // Command, Register, Category and Port properties
+        std::vector<prop_diff> diffs;
+        double elapsed_ms = 0;
+    };
+
+    // Compares the value read by gather_property_info() with the saved value.
+    // Numbers are compared numerically, enumerations by entry name or int value, so formatting differences are not drift.
+    // Returns false for property types that have no comparable value. readable is false if the live value could not be read.
+    inline bool compare_prop_value( const property_info& live, const std::string& expected, std::string& actual, bool& equal, bool& readable )
+    {
+        auto take = [&]( const auto& attr, std::string str ) -> bool
+        {
+            readable = attr.ok;
+            if( !attr.ok ) {
+                return false;
+            }
+            actual = std::move( str );
+            return true;
+        };
+
+        equal = false;
+        switch( live.type )
+        {
+        case ic4::PropType::Integer:
+        {
+            if( take( live.int_value, std::to_string( live.int_value.value ) ) )
+            {
+                int64_t v = 0;
+                equal = helper::from_chars_helper( expected, v ) && v == live.int_value.value;
+            }
+            return true;
+        }
+        case ic4::PropType::Float:
+        {
+            if( take( live.float_value, fmt::format( "{}", live.float_value.value ) ) )
+            {
+                // The serialized text may have been rounded
+                char* end = nullptr;
+                double v = std::strtod( expected.c_str(), &end );
+                double a = live.float_value.value;
+                equal = end != expected.c_str() && (v == a || std::abs( v - a ) <= 1e-9 * std::max( std::abs( v ), std::abs( a ) ));
+            }
+            return true;
+        }
+        case ic4::PropType::Enumeration:
+        {
+            if( take( live.selected_entry, live.selected_entry.value ) )
+            {
+                int64_t v = 0;
+                equal = expected == live.selected_entry.value
+                    || (live.int_value.ok && helper::from_chars_helper( expected, v ) && v == live.int_value.value);
+            }
+            return true;
+        }
+        case ic4::PropType::Boolean:
+        {
+            if( take( live.bool_value, live.bool_value.value ? "true" : "false" ) )
+            {
+                bool v = expected == "1" || expected == "true" || expected == "True";
+                bool valid = v || expected == "0" || expected == "false" || expected == "False";
+                equal = valid && v == live.bool_value.value;
+            }
+            return true;
+        }
+        case ic4::PropType::String:
+        {
+            if( take( live.string_value, live.string_value.value ) ) {
+                equal = expected == live.string_value.value;
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // Compares the live property map against a snapshot parsed by parse_prop_snapshot().
+    //
+    // Values that follow an assignment to a selector in the snapshot belong to that selector state, e.g. the file lists
+    // "GainSelector=Red, Gain=2, GainSelector=Blue, Gain=3". Values without selector state are compared in a single pass
+    // over PropertyMap::all(), looking each property up in a hash map of the snapshot. Each distinct selector state is
+    // then set once, its values are compared, and all selectors touched are restored to their values before the diff.
+    inline auto diff_prop_snapshot( ic4::PropertyMap& map, const std::vector<prop_snapshot_value>& snapshot ) -> prop_diff_result
+    {
+        using selector_state = std::vector<std::pair<std::string, std::string>>;
+
+        struct group
+        {
+            std::unordered_map<std::string, std::string> values;    // Name -> expected value, the last one in the file wins
+            std::vector<std::string> order;
+        };
+
+        prop_diff_result res;
+        auto begin = std::chrono::steady_clock::now();
+
+        std::map<selector_state, group> groups;
+        std::unordered_map<std::string, std::unordered_set<std::string>> selected_by;    // Selector -> names it selects
+        selector_state current;                                                         // Selector values seen so far, in file order
+
+        for( auto&& v : snapshot )
+        {
+            ic4::Error err;
+            auto prop = map.find( v.name, err );
+            if( err.isError() || !prop.is_valid() )
+            {
+                res.diffs.push_back( { v.name, {}, v.value, {}, prop_diff_status::missing } );
+                continue;
+            }
+
+            selector_state context;
+            for( auto&& sel : current )
+            {
+                if( selected_by[sel.first].count( v.name ) ) {
+                    context.push_back( sel );
+                }
+            }
+
+            auto& g = groups[context];
+            if( g.values.find( v.name ) == g.values.end() ) {
+                g.order.push_back( v.name );
+            }
+            g.values[v.name] = v.value;
+
+            if( prop.isSelector( ic4::Error::Ignore() ) )
+            {
+                auto it = selected_by.find( v.name );
+                if( it == selected_by.end() )
+                {
+                    auto& names = selected_by[v.name];
+                    for( auto&& selected : prop.selectedProperties( ic4::Error::Ignore() ) ) {
+                        names.insert( selected.name() );
+                    }
+                }
+
+                bool found = false;
+                for( auto& sel : current )
+                {
+                    if( sel.first == v.name ) {
+                        sel.second = v.value;
+                        found = true;
+                    }
+                }
+                if( !found ) {
+                    current.emplace_back( v.name, v.value );
+                }
+            }
+        }
+
+        auto join_state = []( const selector_state& state ) -> std::string
+        {
+            std::string rval;
+            for( auto&& sel : state ) {
+                rval += (rval.empty() ? "" : ", ") + sel.first + "=" + sel.second;
+            }
+            return rval;
+        };
+
+        auto compare = [&res]( const ic4::Property& prop, const std::string& expected, const std::string& selectors )
+        {
+            auto info = gather_property_info( prop );
+            if( !info.is_available && info.type != ic4::PropType::Command && info.type != ic4::PropType::Category )
+            {
+                res.compared += 1;
+                res.diffs.push_back( { info.name, selectors, expected, {}, prop_diff_status::unavailable } );
+                return;
+            }
+
+            std::string actual;
+            bool equal = false;
+            bool readable = false;
+            if( !compare_prop_value( info, expected, actual, equal, readable ) ) {
+                res.skipped += 1;
+                return;
+            }
+            res.compared += 1;
+            if( !readable ) {
+                res.diffs.push_back( { info.name, selectors, expected, {}, prop_diff_status::unreadable } );
+            } else if( !equal ) {
+                res.diffs.push_back( { info.name, selectors, expected, actual, prop_diff_status::differs } );
+            }
+        };
+
+        // Values without selector state: one pass over the live map
+        auto base = groups.find( selector_state{} );
+        if( base != groups.end() )
+        {
+            auto& g = base->second;
+            std::unordered_set<std::string> visited;
+            for( auto&& prop : map.all( ic4::Error::Ignore() ) )
+            {
+                auto name = prop.name( ic4::Error::Ignore() );
+                auto it = g.values.find( name );
+                if( it != g.values.end() && visited.insert( name ).second ) {
+                    compare( prop, it->second, {} );
+                }
+            }
+            // Properties that are not part of the category tree
+            for( auto&& name : g.order )
+            {
+                if( !visited.count( name ) ) {
+                    compare( map.find( name ), g.values[name], {} );
+                }
+            }
+        }
+
+        // Values that depend on a selector state
+        selector_state restore;
+        for( auto&& entry : groups )
+        {
+            if( entry.first.empty() ) {
+                continue;
+            }
+            for( auto&& sel : entry.first )
+            {
+                bool saved = false;
+                for( auto&& r : restore ) {
+                    saved = saved || r.first == sel.first;
+                }
+                if( !saved ) {
+                    restore.emplace_back( sel.first, map.getValueString( sel.first, ic4::Error::Ignore() ) );
+                }
+            }
+
+            auto selectors = join_state( entry.first );
+            bool selected = true;
+            for( auto&& sel : entry.first ) {
+                selected = map.setValue( sel.first, sel.second, ic4::Error::Ignore() ) && selected;
+            }
+            for( auto&& name : entry.second.order )
+            {
+                auto& expected = entry.second.values[name];
+                if( !selected ) {
+                    res.compared += 1;
+                    res.diffs.push_back( { name, selectors, expected, {}, prop_diff_status::unreadable } );
+                    continue;
+                }
+                compare( map.find( name ), expected, selectors );
+            }
+        }
+        for( auto it = restore.rbegin(); it != restore.rend(); ++it ) {
+            map.setValue( it->first, it->second, ic4::Error::Ignore() );
+        }
+
+        res.elapsed_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - begin ).count();
+        return res;
+    }
+}
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <ic4/ic4.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ic4_helper
+{
+    // Result of a single property getter. On failure, value is left default-constructed and error holds the error code.
+    template<typename T>
+    struct attribute
+    {
+        bool ok = false;
+        ic4::ErrorCode error = ic4::ErrorCode::NoError;
+        T value = {};
+
+        bool not_implemented() const { return !ok && error == ic4::ErrorCode::GenICamNotImplemented; }
+    };
+
+    template<typename T, class Tprop, class TMethod>
+    auto fetch_attribute( Tprop& prop, TMethod method_address, ic4::Error& err ) -> attribute<T>
+    {
+        attribute<T> rval;
+        T v = (prop.*method_address)(err);
+        if( err.isError() ) {
+            rval.error = err.code();
+        } else {
+            rval.ok = true;
+            rval.value = std::move( v );
+        }
+        return rval;
+    }
+
+    // Attributes every property has
+    struct property_common
+    {
+        ic4::PropType type = ic4::PropType::Invalid;
+        std::string name;
+        std::string display_name;
+        std::string description;
+        std::string tooltip;
+        ic4::PropVisibility visibility = ic4::PropVisibility::Beginner;
+        bool is_available = false;
+        bool is_locked = false;
+        bool is_read_only = false;
+        bool is_selector = false;
+        std::vector<std::string> selected_properties;
+    };
+
+    struct enum_entry_info : property_common
+    {
+        attribute<int64_t> int_value;   // only fetched if available
+    };
+
+    // Flat snapshot of all attributes of a property, gathered by gather_property_info().
+    // Only the members that belong to `type` are filled in. Values that are not shown for the current state of the property
+    // (e.g. Min/Max of a read-only property) are not fetched at all, their attribute stays !ok with ErrorCode::NoError.
+    struct property_info : property_common
+    {
+        // Integer and Float
+        ic4::PropIntRepresentation int_representation = ic4::PropIntRepresentation::PureNumber;
+        ic4::PropFloatRepresentation float_representation = ic4::PropFloatRepresentation::PureNumber;
+        ic4::PropDisplayNotation display_notation = ic4::PropDisplayNotation::Automatic;
+        int64_t display_precision = 0;
+        std::string unit;
+        ic4::PropIncrementMode increment_mode = ic4::PropIncrementMode::Increment;
+
+        attribute<int64_t> int_min;
+        attribute<int64_t> int_max;
+        attribute<int64_t> int_inc;
+        attribute<std::vector<int64_t>> int_valid_value_set;
+        attribute<int64_t> int_value;       // Integer value, Enumeration and EnumEntry int value
+
+        attribute<double> float_min;
+        attribute<double> float_max;
+        attribute<double> float_inc;
+        attribute<std::vector<double>> float_valid_value_set;
+        attribute<double> float_value;
+
+        // Enumeration
+        std::vector<enum_entry_info> entries;
+        attribute<std::string> selected_entry;
+
+        // Boolean, String
+        attribute<bool> bool_value;
+        attribute<std::string> string_value;
+        attribute<uint64_t> string_max_length;
+
+        // Category
+        std::vector<std::string> features;
+
+        // Register
+        attribute<uint64_t> register_size;
+        attribute<std::vector<uint8_t>> register_value;
+    };
+
+    namespace detail
+    {
+        inline void gather_common( const ic4::Property& property, property_common& info )
+        {
+            info.type = property.type();
+            info.name = property.name();
+            info.display_name = property.displayName();
+            info.description = property.description();
+            info.tooltip = property.tooltip();
+            info.visibility = property.visibility();
+            info.is_available = property.isAvailable();
+            info.is_locked = property.isLocked();
+            info.is_read_only = property.isReadOnly();
+            info.is_selector = property.isSelector();
+            if( info.is_selector )
+            {
+                for( auto&& selected : property.selectedProperties() ) {
+                    info.selected_properties.push_back( selected.name() );
+                }
+            }
+        }
+
+        // Maps a PropType to its ic4 property class and the code that reads the type-specific attributes.
+        // gather() is only called after gather_common(), so it can rely on is_available and is_read_only.
+        template<ic4::PropType T>
+        struct prop_visitor
+        {
+            static void gather( const ic4::Property& /*property*/, property_info& /*info*/, ic4::Error& /*err*/ ) {}
+        };
+
+        template<>
+        struct prop_visitor<ic4::PropType::Integer>
+        {
+            static void gather( const ic4::Property& property, property_info& info, ic4::Error& err )
+            {
+                ic4::PropInteger prop = property.asInteger();
+                info.increment_mode = prop.incrementMode();
+                info.int_representation = prop.representation();
+                info.unit = prop.unit();
+
+                if( !info.is_available ) {
+                    return;
+                }
+                if( !info.is_read_only )
+                {
+                    info.int_min = fetch_attribute<int64_t>( prop, &ic4::PropInteger::minimum, err );
+                    info.int_max = fetch_attribute<int64_t>( prop, &ic4::PropInteger::maximum, err );
+                    if( info.increment_mode == ic4::PropIncrementMode::Increment ) {
+                        info.int_inc = fetch_attribute<int64_t>( prop, &ic4::PropInteger::increment, err );
+                    }
+                }
+                if( info.increment_mode == ic4::PropIncrementMode::ValueSet ) {
+                    info.int_valid_value_set = fetch_attribute<std::vector<int64_t>>( prop, &ic4::PropInteger::validValueSet, err );
+                }
+                info.int_value = fetch_attribute<int64_t>( prop, &ic4::PropInteger::getValue, err );
+            }
+        };
+
+        template<>
+        struct prop_visitor<ic4::PropType::Float>
+        {
+            static void gather( const ic4::Property& property, property_info& info, ic4::Error& err )
+            {
+                ic4::PropFloat prop = property.asFloat();
+                info.increment_mode = prop.incrementMode();
+                info.float_representation = prop.representation();
+                info.unit = prop.unit();
+                info.display_notation = prop.displayNotation();
+                info.display_precision = prop.displayPrecision();
+
+                if( !info.is_available ) {
+                    return;
+                }
+                if( !info.is_read_only )
+                {
+                    info.float_min = fetch_attribute<double>( prop, &ic4::PropFloat::minimum, err );
+                    info.float_max = fetch_attribute<double>( prop, &ic4::PropFloat::maximum, err );
+                }
+                if( info.increment_mode == ic4::PropIncrementMode::Increment ) {
+                    info.float_inc = fetch_attribute<double>( prop, &ic4::PropFloat::increment, err );
+                } else if( info.increment_mode == ic4::PropIncrementMode::ValueSet ) {
+                    info.float_valid_value_set = fetch_attribute<std::vector<double>>( prop, &ic4::PropFloat::validValueSet, err );
+                }
+                info.float_value = fetch_attribute<double>( prop, &ic4::PropFloat::getValue, err );
+            }
+        };
+
+        template<>
+        struct prop_visitor<ic4::PropType::EnumEntry>
+        {
+            static void gather_entry( ic4::PropEnumEntry& prop, enum_entry_info& info, ic4::Error& err )
+            {
+                if( info.is_available ) {
+                    info.int_value = fetch_attribute<int64_t>( prop, &ic4::PropEnumEntry::intValue, err );
+                }
+            }
+
+            static void gather( const ic4::Property& property, property_info& info, ic4::Error& err )
+            {
+                if( info.is_available )
+                {
+                    ic4::PropEnumEntry prop = property.asEnumEntry();
+                    info.int_value = fetch_attribute<int64_t>( prop, &ic4::PropEnumEntry::intValue, err );
+                }
+            }
+        };
+
+        template<>
+        struct prop_visitor<ic4::PropType::Enumeration>
+        {
+            static void gather( const ic4::Property& property, property_info& info, ic4::Error& err )
+            {
+                ic4::PropEnumeration prop = property.asEnumeration();
+                for( auto&& entry : prop.entries( ic4::Error::Ignore() ) )
+                {
+                    enum_entry_info entry_info;
+                    gather_common( entry, entry_info );
+                    prop_visitor<ic4::PropType::EnumEntry>::gather_entry( entry, entry_info, err );
+                    info.entries.push_back( std::move( entry_info ) );
+                }
+
+                if( !info.is_available ) {
+                    return;
+                }
+                auto selected = prop.selectedEntry( err );
+                if( err.isError() ) {
+                    info.selected_entry.error = info.int_value.error = err.code();
+                    return;
+                }
+                info.selected_entry.ok = true;
+                info.selected_entry.value = selected.name();
+
+                // The int value of the selected entry is already known, no need to ask the device again
+                for( auto&& entry : info.entries )
+                {
+                    if( entry.name == info.selected_entry.value && entry.int_value.ok ) {
+                        info.int_value = entry.int_value;
+                        return;
+                    }
+                }
+                info.int_value = fetch_attribute<int64_t>( prop, &ic4::PropEnumeration::getIntValue, err );
+            }
+        };
+
+        template<>
+        struct prop_visitor<ic4::PropType::Boolean>
+        {
+            static void gather( const ic4::Property& property, property_info& info, ic4::Error& err )
+            {
+                if( info.is_available )
+                {
+                    ic4::PropBoolean prop = property.asBoolean();
+                    info.bool_value = fetch_attribute<bool>( prop, &ic4::PropBoolean::getValue, err );
+                }
+            }
+        };
+
+        template<>
+        struct prop_visitor<ic4::PropType::String>
+        {
+            static void gather( const ic4::Property& property, property_info& info, ic4::Error& err )
+            {
+                if( !info.is_available ) {
+                    return;
+                }
+                ic4::PropString prop = property.asString();
+                info.string_value = fetch_attribute<std::string>( prop, &ic4::PropString::getValue, err );
+                info.string_max_length = fetch_attribute<uint64_t>( prop, &ic4::PropString::maxLength, err );
+            }
+        };
+
+        template<>
+        struct prop_visitor<ic4::PropType::Category>
+        {
+            static void gather( const ic4::Property& property, property_info& info, ic4::Error& /*err*/ )
+            {
+                for( auto&& feature : property.asCategory().features( ic4::Error::Ignore() ) ) {
+                    info.features.push_back( feature.name() );
+                }
+            }
+        };
+
+        template<>
+        struct prop_visitor<ic4::PropType::Register>
+        {
+            static void gather( const ic4::Property& property, property_info& info, ic4::Error& err )
+            {
+                ic4::PropRegister prop = property.asRegister();
+                info.register_size = fetch_attribute<uint64_t>( prop, &ic4::PropRegister::size, err );
+                if( info.is_available ) {
+                    info.register_value = fetch_attribute<std::vector<uint8_t>>( prop, &ic4::PropRegister::getValue, err );
+                }
+            }
+        };
+
+        using gather_func = void (*)( const ic4::Property& property, property_info& info, ic4::Error& err );
+
+        struct visitor_table_entry
+        {
+            ic4::PropType type;
+            gather_func gather;
+        };
+
+        template<ic4::PropType T>
+        constexpr auto make_entry() -> visitor_table_entry
+        {
+            return { T, &prop_visitor<T>::gather };
+        }
+
+        // Command and Port have no attributes besides the common ones
+        constexpr visitor_table_entry visitor_table[] = {
+            make_entry<ic4::PropType::Integer>(),
+            make_entry<ic4::PropType::Float>(),
+            make_entry<ic4::PropType::Enumeration>(),
+            make_entry<ic4::PropType::Boolean>(),
+            make_entry<ic4::PropType::String>(),
+            make_entry<ic4::PropType::Command>(),
+            make_entry<ic4::PropType::Category>(),
+            make_entry<ic4::PropType::Register>(),
+            make_entry<ic4::PropType::Port>(),
+            make_entry<ic4::PropType::EnumEntry>(),
+        };
+    }
+
+    // Reads all attributes of a property in one pass, sharing a single ic4::Error between all getters.
+    inline auto gather_property_info( const ic4::Property& property ) -> property_info
+    {
+        property_info info;
+        detail::gather_common( property, info );
+
+        ic4::Error err;
+        for( auto&& entry : detail::visitor_table )
+        {
+            if( entry.type == info.type )
+            {
+                entry.gather( property, info, err );
+                break;
+            }
+        }
+        return info;
+    }
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace helper
+{
+    // Fixed-size work-stealing pool with a bounded number of pending jobs.
+    //
+    // Every worker owns a deque. Submitted jobs are distributed round-robin, a worker takes jobs from the front
+    // of its own deque and steals from the back of the other deques once its own deque is empty.
+    // Jobs that are waiting in a deque count against max_pending, jobs that are currently executing do not.
+    class thread_pool
+    {
+    public:
+        thread_pool( size_t num_threads, size_t max_pending )
+            : max_pending_( max_pending > 0 ? max_pending : 1 )
+        {
+            if( num_threads == 0 ) {
+                num_threads = 1;
+            }
+            for( size_t i = 0; i < num_threads; ++i ) {
+                queues_.push_back( std::make_unique<worker_queue>() );
+            }
+            for( size_t i = 0; i < num_threads; ++i ) {
+                workers_.emplace_back( [this, i] { worker_thread( i ); } );
+            }
+        }
+
+        ~thread_pool()
+        {
+            {
+                std::lock_guard<std::mutex> lck{ mtx_ };
+                stop_requested_ = true;
+            }
+            job_available_.notify_all();
+            for( auto& t : workers_ ) {
+                t.join();
+            }
+        }
+
+        thread_pool( const thread_pool& ) = delete;
+        thread_pool& operator=( const thread_pool& ) = delete;
+
+        size_t num_threads() const { return workers_.size(); }
+        size_t max_pending() const { return max_pending_; }
+
+        // Returns false without queuing the job if max_pending jobs are already waiting.
+        bool try_submit( std::function<void()> job )
+        {
+            {
+                std::lock_guard<std::mutex> lck{ mtx_ };
+                if( num_pending_ + num_reserved_ >= max_pending_ ) {
+                    return false;
+                }
+                num_reserved_ += 1;
+            }
+            push( std::move( job ) );
+            return true;
+        }
+
+        // Blocks while max_pending jobs are waiting.
+        void submit( std::function<void()> job )
+        {
+            {
+                std::unique_lock<std::mutex> lck{ mtx_ };
+                space_available_.wait( lck, [this] { return num_pending_ + num_reserved_ < max_pending_; } );
+                num_reserved_ += 1;
+            }
+            push( std::move( job ) );
+        }
+
+        // Blocks until all submitted jobs have finished executing.
+        void wait_idle()
+        {
+            std::unique_lock<std::mutex> lck{ mtx_ };
+            idle_.wait( lck, [this] { return num_pending_ == 0 && num_reserved_ == 0 && num_active_ == 0; } );
+        }
+
+    private:
+        struct worker_queue
+        {
+            std::mutex mtx;
+            std::deque<std::function<void()>> jobs;
+        };
+
+        // The job is added to a deque before it is counted as pending, so a worker that claimed a pending job
+        // is guaranteed to find one in some deque.
+        void push( std::function<void()> job )
+        {
+            auto& q = *queues_[next_queue_++ % queues_.size()];
+            {
+                std::lock_guard<std::mutex> lck{ q.mtx };
+                q.jobs.push_back( std::move( job ) );
+            }
+            {
+                std::lock_guard<std::mutex> lck{ mtx_ };
+                num_reserved_ -= 1;
+                num_pending_ += 1;
+            }
+            job_available_.notify_one();
+        }
+
+        auto take( size_t worker_index ) -> std::function<void()>
+        {
+            std::function<void()> job;
+            while( true )
+            {
+                // Index 0 is the worker's own deque, which is served from the front, all others are stolen from.
+                for( size_t i = 0; i < queues_.size(); ++i )
+                {
+                    auto& q = *queues_[(worker_index + i) % queues_.size()];
+                    std::lock_guard<std::mutex> lck{ q.mtx };
+                    if( q.jobs.empty() ) {
+                        continue;
+                    }
+                    if( i == 0 ) {
+                        job = std::move( q.jobs.front() );
+                        q.jobs.pop_front();
+                    } else {
+                        job = std::move( q.jobs.back() );
+                        q.jobs.pop_back();
+                    }
+                    return job;
+                }
+                // The deques are scanned one after the other, so a concurrent push/pop can make a scan miss the
+                // claimed job. It is guaranteed to be in one of the deques, so just scan again.
+                std::this_thread::yield();
+            }
+        }
+
+        void worker_thread( size_t worker_index )
+        {
+            while( true )
+            {
+                {
+                    std::unique_lock<std::mutex> lck{ mtx_ };
+                    job_available_.wait( lck, [this] { return stop_requested_ || num_pending_ > 0; } );
+                    if( num_pending_ == 0 ) {
+                        return;
+                    }
+                    num_pending_ -= 1;
+                    num_active_ += 1;
+                }
+                space_available_.notify_one();
+
+                auto job = take( worker_index );
+                job();
+                job = nullptr;
+
+                {
+                    std::lock_guard<std::mutex> lck{ mtx_ };
+                    num_active_ -= 1;
+                    if( num_pending_ == 0 && num_reserved_ == 0 && num_active_ == 0 ) {
+                        idle_.notify_all();
+                    }
+                }
+            }
+        }
+
+        size_t max_pending_;
+
+        std::vector<std::unique_ptr<worker_queue>> queues_;
+        std::atomic<size_t> next_queue_{ 0 };
+
+        std::mutex mtx_;
+        std::condition_variable job_available_;
+        std::condition_variable space_available_;
+        std::condition_variable idle_;
+        size_t num_pending_ = 0;
+        size_t num_reserved_ = 0;
+        size_t num_active_ = 0;
+        bool stop_requested_ = false;
+
+        std::vector<std::thread> workers_;
+    };
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace watch
+{
+    struct config
+    {
+        std::vector<std::string> properties;
+        bool stream = false;
+        double duration_s = 0;          // 0 = until interrupted
+        double max_rate_hz = 10;        // Upper limit for output batches per second
+        int stats_interval_ms = 1000;
+        size_t ring_capacity = 1024;
+    };
+
+    struct event
+    {
+        double time_s = 0;
+        std::string name;
+        std::string value;
+    };
+
+    // Fixed-capacity ring of property change events, filled from notification callbacks and drained by the output loop.
+    // When the output loop falls behind, the oldest events are overwritten and counted as lost.
+    class event_ring
+    {
+    public:
+        explicit event_ring( size_t capacity )
+            : events_( capacity > 0 ? capacity : 1 )
+        {
+        }
+
+        void push( event ev )
+        {
+            std::lock_guard<std::mutex> lck{ mtx_ };
+            events_[(first_ + size_) % events_.size()] = std::move( ev );
+            if( size_ < events_.size() ) {
+                size_ += 1;
+            } else {
+                first_ = (first_ + 1) % events_.size();
+                lost_ += 1;
+            }
+        }
+
+        // Moves all queued events to out, oldest first
+        void drain( std::vector<event>& out )
+        {
+            std::lock_guard<std::mutex> lck{ mtx_ };
+            for( size_t i = 0; i < size_; ++i ) {
+                out.push_back( std::move( events_[(first_ + i) % events_.size()] ) );
+            }
+            first_ = 0;
+            size_ = 0;
+        }
+
+        uint64_t lost() const
+        {
+            std::lock_guard<std::mutex> lck{ mtx_ };
+            return lost_;
+        }
+
+    private:
+        mutable std::mutex mtx_;
+        std::vector<event> events_;
+        size_t first_ = 0;
+        size_t size_ = 0;
+        uint64_t lost_ = 0;
+    };
+
+    struct coalesced_event
+    {
+        double time_s = 0;      // Time of the last change
+        std::string name;
+        std::string value;      // Last value
+        size_t changes = 0;
+    };
+
+    // Merges all events of a property into one entry holding the last value, in the order the properties first changed
+    inline auto coalesce( const std::vector<event>& events ) -> std::vector<coalesced_event>
+    {
+        std::vector<coalesced_event> rval;
+        for( auto&& ev : events )
+        {
+            coalesced_event* entry = nullptr;
+            for( auto& e : rval )
+            {
+                if( e.name == ev.name ) {
+                    entry = &e;
+                    break;
+                }
+            }
+            if( !entry )
+            {
+                rval.emplace_back();
+                entry = &rval.back();
+                entry->name = ev.name;
+            }
+            entry->time_s = ev.time_s;
+            entry->value = ev.value;
+            entry->changes += 1;
+        }
+        return rval;
+    }
+}
@@ -11,24 +11,60 @@
 
 #include <CLI/CLI.hpp>
 #include <fmt/core.h>
+#include <fmt/format.h>
 
 
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <condition_variable>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <set>
+#include <sstream>
 #include <string>
 #include <stdexcept>
+#include <thread>
 
 #include "ic4_enum_to_string.h"
 #include "ic4-ctrl-helper.h"
+#include "ic4-ctrl-bench.h"
+#include "ic4-ctrl-thread-pool.h"
+#include "ic4-ctrl-device-index.h"
+#include "ic4-ctrl-output.h"
+#include "ic4-ctrl-property-info.h"
+#include "ic4-ctrl-prop-batch.h"
+#include "ic4-ctrl-prop-diff.h"
+#include "ic4-ctrl-watch.h"
+#include "ic4-ctrl-clock-sync.h"
+
+#ifndef WIN32
+#include "ic4-ctrl-ipc.h"
+
+#include <signal.h> // sigaction
+#endif
 
 static void    print_property( int offset, const ic4::Property& property );
 
+// When set, print() appends to this buffer instead of writing to stdout. `serve` uses this to send the output of a command to the client.
+static fmt::memory_buffer* print_capture = nullptr;
+
 template<class ... Targs>
 void print( fmt::format_string<Targs...> fmt, Targs&& ... args )
 {
+    if( print_capture ) {
+        fmt::format_to( std::back_inserter( *print_capture ), fmt, std::forward<Targs>( args )... );
+        return;
+    }
     fmt::print( fmt, std::forward<Targs>( args )... );
 }
 
@@ -36,46 +72,130 @@ template<class ... Targs>
 void print( int offset, fmt::format_string<Targs...> fmt, Targs&& ... args )
 {
     for( int i = 0; i < offset; ++i ) {
-        fmt::print( "    " );
+        ::print( "    " );
     }
-    fmt::print( fmt, std::forward<Targs>( args )... );
+    ::print( fmt, std::forward<Targs>( args )... );
 }
 
-static auto find_device( std::string id ) -> std::unique_ptr<ic4::DeviceInfo>
+// Set by --format. With json or ndjson, the reporting functions write records through an output::record_writer instead of print().
+static output::format output_format = output::format::text;
+
+// Sink for output::record_writer, honors print_capture like print()
+static void write_output( const char* data, size_t size )
 {
-    ic4::DeviceEnum devEnum;
-    auto list = devEnum.enumDevices();
-    if( list.size() == 0 ) {
-        throw std::runtime_error( "No devices are available" );
+    if( print_capture ) {
+        print_capture->append( data, data + size );
+        return;
+    }
+    std::fwrite( data, 1, size, stdout );
+}
+
+static bool output_is_json()
+{
+    return output_format != output::format::text;
+}
+
+// Discovery cache used by find_device and the device listings, enabled by --cache-ttl
+static std::string device_cache_filename;
+static int device_cache_ttl_s = 0;
+
+// Startup phases reported by --timing
+struct StartupTiming
+{
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    double parse_ms = 0;
+    double init_library_ms = 0;
+    double cache_load_ms = 0;
+    double enumerate_ms = 0;
+};
+static StartupTiming startup_timing;
+
+static double ms_since( std::chrono::steady_clock::time_point t )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - t ).count();
+}
+
+static bool library_initialized = false;
+
+// Set when a device enumeration thread was left running after its timeout. The library must not be shut down below it,
+// so main skips ic4::exitLibrary and ends the process with std::quick_exit instead.
+static std::atomic<bool> enumeration_abandoned{ false };
+
+// ic4::initLibrary loads all GenTL producers, which dominates the run time of short commands. It is only called by the
+// commands that need it: version and system never do, list-serial only when the discovery cache cannot be used.
+static void ensure_library_initialized()
+{
+    if( library_initialized ) {
+        return;
     }
 
-    for( auto&& dev : list )
+    auto begin = std::chrono::steady_clock::now();
+    ic4::InitLibraryConfig config =
     {
-        if( dev.serial() == id ) {
-            return std::make_unique<ic4::DeviceInfo>( dev );
-        }
+        ic4::ErrorHandlerBehavior::Throw,
+        ic4::LogLevel::Off
+    };
+    ic4::initLibrary(config);
+    library_initialized = true;
+    startup_timing.init_library_ms += ms_since( begin );
+}
+
+// With details == false, see device_index::index::enumerate, the index is not written to the cache
+static auto enumerate_device_index( bool details = true ) -> device_index::index
+{
+    ensure_library_initialized();
+
+    auto begin = std::chrono::steady_clock::now();
+    auto idx = device_index::index::enumerate( details );
+    startup_timing.enumerate_ms += ms_since( begin );
+
+    if( details && device_cache_ttl_s > 0 && !idx.entries().empty() ) {
+        idx.save( device_cache_filename );
     }
-    for( auto&& dev : list )
+    return idx;
+}
+
+static auto load_device_index( bool details = true ) -> device_index::index
+{
+    device_index::index idx;
+    if( device_cache_ttl_s > 0 )
     {
-        if( dev.uniqueName() == id ) {
-            return std::make_unique<ic4::DeviceInfo>( dev );
+        auto begin = std::chrono::steady_clock::now();
+        bool loaded = device_index::index::load( device_cache_filename, std::chrono::seconds( device_cache_ttl_s ), idx );
+        startup_timing.cache_load_ms += ms_since( begin );
+        if( loaded ) {
+            return idx;
         }
     }
-    for( auto&& dev : list )
+    return enumerate_device_index( details );
+}
+
+static auto find_device( std::string id ) -> std::unique_ptr<ic4::DeviceInfo>
+{
+    auto idx = load_device_index();
+    if( idx.entries().empty() ) {
+        throw std::runtime_error( "No devices are available" );
+    }
+
+    auto entry = idx.find( id );
+    if( entry )
     {
-        if( dev.modelName() == id ) {
-            return std::make_unique<ic4::DeviceInfo>( dev );
+        auto dev = idx.device_info( *entry );
+        if( dev ) {
+            return dev;
         }
     }
-    int64_t index = 0;
-    if( helper::from_chars_helper( id, index ) )
-    {
-        if( index < 0 || index >= static_cast<int64_t>(list.size()) )
-            return {};
+    if( idx.is_live() ) {
+        return {};
+    }
 
-        return std::make_unique<ic4::DeviceInfo>( list.at( index ) );
+    // The cache is stale, the device is gone or was added after the cache was written
+    idx = enumerate_device_index();
+    entry = idx.find( id );
+    if( !entry ) {
+        return {};
     }
-    return {};
+    return idx.device_info( *entry );
 }
 
 static auto find_interface( std::string id ) -> std::unique_ptr<ic4::Interface>
@@ -86,18 +206,20 @@ static auto find_interface( std::string id ) -> std::unique_ptr<ic4::Interface>
         throw std::runtime_error( "No devices are available" );
     }
 
-    for( auto&& dev : list )
+    // Single pass, a display name match takes precedence over a transport layer name match
+    const ic4::Interface* by_transport_layer = nullptr;
+    for( auto&& itf : list )
     {
-        if( dev.interfaceDisplayName() == id ) {
-            return std::make_unique<ic4::Interface>( dev );
+        if( itf.interfaceDisplayName() == id ) {
+            return std::make_unique<ic4::Interface>( itf );
         }
-    }
-    for( auto&& dev : list )
-    {
-        if( dev.transportLayerName() == id ) {
-            return std::make_unique<ic4::Interface>( dev );
+        if( !by_transport_layer && itf.transportLayerName() == id ) {
+            by_transport_layer = &itf;
         }
     }
+    if( by_transport_layer ) {
+        return std::make_unique<ic4::Interface>( *by_transport_layer );
+    }
     int64_t index = 0;
     if( helper::from_chars_helper( id, index ) )
     {
@@ -109,17 +231,99 @@ static auto find_interface( std::string id ) -> std::unique_ptr<ic4::Interface>
     return {};
 }
 
-static auto list_all_by_connection() -> void
+struct InterfaceEnumResult
+{
+	std::vector<ic4::DeviceInfo> devices;
+	std::string error;
+	double elapsed_ms = 0;
+};
+
+// Enumerates the devices of all interfaces concurrently, so that a slow discovery on one interface does not delay the others.
+// Returns one future per interface, in the order of list. All of them are ready or past the deadline when this returns.
+static auto enum_devices_per_interface( const std::vector<ic4::Interface>& list, std::chrono::milliseconds timeout ) -> std::vector<std::future<InterfaceEnumResult>>
+{
+	std::vector<std::future<InterfaceEnumResult>> results;
+	std::vector<std::thread> threads;
+	for (auto&& itf : list)
+	{
+		std::packaged_task<InterfaceEnumResult()> task( [itf]
+		{
+			InterfaceEnumResult res;
+			auto start = std::chrono::steady_clock::now();
+			ic4::Error err;
+			res.devices = itf.enumDevices( err );
+			if (err.isError()) {
+				res.error = err.message();
+			}
+			res.elapsed_ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+			return res;
+		} );
+		results.push_back( task.get_future() );
+		threads.emplace_back( std::move( task ) );
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		if (results[i].wait_until( deadline ) == std::future_status::ready) {
+			threads[i].join();
+		} else {
+			// The enumeration cannot be cancelled, leave it running and ignore its result.
+			// main does not call ic4::exitLibrary while it might still be inside the library, see enumeration_abandoned.
+			enumeration_abandoned = true;
+			threads[i].detach();
+		}
+	}
+	return results;
+}
+
+static auto list_all_by_connection( std::chrono::milliseconds timeout ) -> void
 {
 	ic4::DeviceEnum devEnum;
 	auto list = devEnum.enumInterfaces();
 
+	if (output_is_json())
+	{
+		auto results = enum_devices_per_interface( list, timeout );
+
+		output::record_writer out{ output_format, write_output };
+		for (size_t i = 0; i < list.size(); ++i)
+		{
+			auto& itf = list.at(i);
+			out.begin_record()
+				.field( "transport_layer_name", itf.transportLayerName() )
+				.field( "interface_name", itf.interfaceDisplayName() );
+
+			if (results[i].wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready)
+			{
+				out.field( "timed_out", true ).field( "elapsed_ms", static_cast<double>( timeout.count() ) );
+				out.end_record();
+				continue;
+			}
+
+			auto res = results[i].get();
+			out.field( "timed_out", false ).field( "elapsed_ms", res.elapsed_ms );
+			if (!res.error.empty()) {
+				out.field( "error", res.error );
+			}
+			out.begin_array( "devices" );
+			for (auto&& device : res.devices) {
+				out.begin_object().field( "model_name", device.modelName() ).field( "serial", device.serial() ).end_object();
+			}
+			out.end_array();
+			out.end_record();
+		}
+		return;
+	}
+
 	print("Device tree:\n");
 	if (list.empty()) {
 		print(1, "No Interfaces found\n");
 	}
 	else
 	{
+		auto results = enum_devices_per_interface( list, timeout );
+
 		std::set<std::string> transport_layer_list;
 
 		for (auto&& e : list) {
@@ -133,15 +337,26 @@ static auto list_all_by_connection() -> void
 				auto& itf = list.at(i);
 				if (transportLayerName == itf.transportLayerName())
 				{
-					print(2, "{}\n", itf.interfaceDisplayName());
+					if (results[i].wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready)
+					{
+						print(2, "{} (timed out after {} ms)\n", itf.interfaceDisplayName(), timeout.count());
+						print(3, "Device enumeration did not finish\n");
+						print("\n");
+						continue;
+					}
+
+					auto res = results[i].get();
+					print(2, "{} ({:.1f} ms)\n", itf.interfaceDisplayName(), res.elapsed_ms);
 
-					auto dev_list = itf.enumDevices();
-					if (dev_list.empty()) {
+					if (!res.error.empty()) {
+						print(3, "Device enumeration failed: {}\n", res.error);
+					}
+					else if (res.devices.empty()) {
 						print(3, "No devices\n");
 					}
 					else
 					{
-						for (auto&& device : dev_list) {
+						for (auto&& device : res.devices) {
 							print(3, "{:24} {:8}\n", device.modelName(), device.serial());
 						}
 					}
@@ -153,10 +368,36 @@ static auto list_all_by_connection() -> void
 	}
 }
 
+static void write_device_entry_fields( output::record_writer& out, const device_index::entry& dev )
+{
+    out.field( "model_name", dev.model_name )
+        .field( "serial", dev.serial )
+        .field( "user_id", dev.user_id )
+        .field( "unique_name", dev.unique_name )
+        .field( "device_version", dev.version )
+        .field( "interface_name", dev.interface_name )
+        .field( "transport_layer_name", dev.transport_layer_name );
+    if( !dev.ip_address.empty() ) {
+        out.field( "ip_address", dev.ip_address );
+    }
+}
+
 static auto list_devices() -> void
 {
-	ic4::DeviceEnum devEnum;
-	auto list = devEnum.enumDevices();
+	auto idx = load_device_index();
+	auto& list = idx.entries();
+
+	if (output_is_json())
+	{
+		output::record_writer out{ output_format, write_output };
+		for (size_t i = 0; i < list.size(); ++i)
+		{
+			out.begin_record().field( "index", i );
+			write_device_entry_fields( out, list[i] );
+			out.end_record();
+		}
+		return;
+	}
 
 	print("Device list:\n");
 	if (list.empty()) {
@@ -167,7 +408,7 @@ static auto list_devices() -> void
 	print(1, "Index   {:24} {:8} {}\n", "ModelName", "Serial", "InterfaceName");
 	int index = 0;
 	for (auto&& e : list) {
-		print(1, "{:^5}   {:24} {:8} {}\n", index, e.modelName(), e.serial(), e.getInterface().transportLayerName());
+		print(1, "{:^5}   {:24} {:8} {}\n", index, e.model_name, e.serial, e.transport_layer_name);
 		index += 1;
 	}
 }
@@ -177,6 +418,20 @@ static auto list_interfaces() -> void
     ic4::DeviceEnum devEnum;
     auto list = devEnum.enumInterfaces();
 
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        for( size_t i = 0; i < list.size(); ++i )
+        {
+            out.begin_record()
+                .field( "index", i )
+                .field( "transport_layer_name", list[i].transportLayerName() )
+                .field( "interface_name", list[i].interfaceDisplayName() );
+            out.end_record();
+        }
+        return;
+    }
+
     print( "Interface list:\n" );
 	if (list.empty()) {
 		print(1, "No Interfaces found\n");
@@ -205,28 +460,56 @@ static auto list_interfaces() -> void
 
 static void list_serials()
 {
-    ic4::DeviceEnum devEnum;
-    auto list = devEnum.enumDevices();
+    // Serials need neither the IP addresses nor the user ids
+    auto idx = load_device_index( false );
+
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        for( auto&& d : idx.entries() )
+        {
+            out.begin_record().field( "serial", d.serial );
+            out.end_record();
+        }
+        return;
+    }
 
-    for (auto&& d : list)
+    for (auto&& d : idx.entries())
     {
-        print("{} ", d.serial());
+        print("{} ", d.serial);
     }
 }
 
 static void print_device( std::string id )
 {
-    auto dev = find_device( id );
+    auto idx = load_device_index();
+    auto dev = idx.find( id );
+    if( !dev && !idx.is_live() ) {
+        idx = enumerate_device_index();
+        dev = idx.find( id );
+    }
     if( !dev ) {
         throw std::runtime_error( fmt::format( "Failed to find device for id '{}'\n", id ) );
     }
 
-	print("ModelName:     '{}'\n", dev->modelName());
-	print("Serial:        '{}'\n", dev->serial());
-	print("UserID:        '{}'\n", dev->userID());
-	print("UniqueName:    '{}'\n", dev->uniqueName());
-	print("DeviceVersion: '{}'\n", dev->version());
-	print("InterfaceName: '{}'\n", dev->getInterface().transportLayerName());
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        out.begin_record();
+        write_device_entry_fields( out, *dev );
+        out.end_record();
+        return;
+    }
+
+	print("ModelName:     '{}'\n", dev->model_name);
+	print("Serial:        '{}'\n", dev->serial);
+	print("UserID:        '{}'\n", dev->user_id);
+	print("UniqueName:    '{}'\n", dev->unique_name);
+	print("DeviceVersion: '{}'\n", dev->version);
+	print("InterfaceName: '{}'\n", dev->transport_layer_name);
+	if (!dev->ip_address.empty()) {
+		print("IPAddress:     '{}'\n", dev->ip_address);
+	}
 }
 
 static void print_interface( std::string id )
@@ -236,37 +519,40 @@ static void print_interface( std::string id )
         throw std::runtime_error( fmt::format( "Failed to find device for id '{}'\n", id ) );
     }
 
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        out.begin_record()
+            .field( "interface_name", dev->interfaceDisplayName() )
+            .field( "transport_layer_name", dev->transportLayerName() )
+            .field( "transport_layer_type", ic4_helper::toString( dev->transportLayerType() ) )
+            .field( "transport_layer_version", dev->transportLayerVersion() );
+        out.end_record();
+        return;
+    }
+
     print( "DisplayName:           '{}'\n", dev->interfaceDisplayName() );
     print( "TransportLayerName:    '{}'\n", dev->transportLayerName() );
     print( "TransportLayerType:    '{}'\n", ic4_helper::toString( dev->transportLayerType() ) );
     print( "TransportLayerVersion: '{}'\n", dev->transportLayerVersion() );
 }
 
-template<typename TPropType, class Tprop, class TMethod>
-auto fetch_PropertyMethod_value( Tprop& prop, TMethod method_address ) -> std::string
+// Formats an attribute like the text dump always did: "n/a" if the feature is not implemented, "err" for all other errors
+template<typename T>
+auto format_attribute( const ic4_helper::attribute<T>& attr ) -> std::string
 {
-    ic4::Error err;
-    TPropType v = (prop.*method_address)(err);
-    if( err.isError() ) {
-        if( err.code() == ic4::ErrorCode::GenICamNotImplemented ) {
-            return "n/a";
-        }
-        return "err";
+    if( !attr.ok ) {
+        return attr.not_implemented() ? "n/a" : "err";
     }
-    return fmt::format( "{}", v );
+    return fmt::format( "{}", attr.value );
 }
 
-template<class TMethod>
-auto fetch_PropertyMethod_value( ic4::PropInteger& prop, TMethod method_address, ic4::PropIntRepresentation int_rep ) -> std::string
+static auto format_attribute( const ic4_helper::attribute<int64_t>& attr, ic4::PropIntRepresentation int_rep ) -> std::string
 {
-    ic4::Error err;
-    int64_t v = (prop.*method_address)(err);
-    if( err.isError() ) {
-        if( err.code() == ic4::ErrorCode::GenICamNotImplemented ) {
-            return "n/a";
-        }
-        return "err";
+    if( !attr.ok ) {
+        return attr.not_implemented() ? "n/a" : "err";
     }
+    int64_t v = attr.value;
     switch( int_rep )
     {
     case ic4::PropIntRepresentation::Boolean:       return fmt::format( "{}", v != 0 ? 1 : 0 );
@@ -297,168 +583,125 @@ auto fetch_PropertyMethod_value( ic4::PropInteger& prop, TMethod method_address,
     }
 }
 
-static void    print_property( int offset, const ic4::Property& property )
+static void print_property_common( int offset, const ic4_helper::property_common& info )
 {
     using namespace ic4_helper;
 
-    auto prop_type = property.type();
-    print( offset + 0, "{:24} - Type: {}, DisplayName: {}\n", property.name(), toString( prop_type ), property.displayName() );
-    print( offset + 1, "Description: {}\n", property.description() );
-    print( offset + 1, "Tooltip: {}\n", property.tooltip() );
+    print( offset + 0, "{:24} - Type: {}, DisplayName: {}\n", info.name, toString( info.type ), info.display_name );
+    print( offset + 1, "Description: {}\n", info.description );
+    print( offset + 1, "Tooltip: {}\n", info.tooltip );
     print( offset + 3, "\n" );
-    print( offset + 1, "Visibility: {}, Available: {}, Locked: {}, ReadOnly: {}\n", toString( property.visibility() ), property.isAvailable(), property.isLocked(), property.isReadOnly() );
+    print( offset + 1, "Visibility: {}, Available: {}, Locked: {}, ReadOnly: {}\n", toString( info.visibility ), info.is_available, info.is_locked, info.is_read_only );
 
-    if( property.isSelector() )
+    if( info.is_selector )
     {
         print( offset + 1, "Selected properties:\n" );
-        for( auto&& selected : property.selectedProperties() )
+        for( auto&& selected : info.selected_properties )
         {
-            print( offset + 2, "{}\n", selected.name() );
+            print( offset + 2, "{}\n", selected );
         }
     }
+}
+
+template<typename T>
+static void print_valid_value_set( int offset, const ic4_helper::attribute<std::vector<T>>& vvset )
+{
+    if( !vvset.ok ) {
+        print( offset + 1, "Failed to fetch ValidValueSet\n" );
+        return;
+    }
+    print( offset + 1, "ValidValueSet:\n" );
+    for( auto&& val : vvset.value ) {
+        print( offset + 2, "{}\n", val );
+    }
+    print( "\n" );
+}
+
+static void print_property_info( int offset, const ic4_helper::property_info& info )
+{
+    using namespace ic4_helper;
 
-    switch( prop_type )
+    print_property_common( offset, info );
+
+    switch( info.type )
     {
     case ic4::PropType::Integer:
     {
-        ic4::PropInteger prop = property.asInteger();
-        auto inc_mode = prop.incrementMode();
-        auto rep = prop.representation();
-
-        print( offset + 1, "Representation: '{}', Unit: '{}', IncrementMode: '{}'\n", toString( rep ), prop.unit(), toString( inc_mode ) );
+        auto rep = info.int_representation;
+        print( offset + 1, "Representation: '{}', Unit: '{}', IncrementMode: '{}'\n", toString( rep ), info.unit, toString( info.increment_mode ) );
 
-        if( prop.isAvailable() )
+        if( info.is_available )
         {
-            if( !prop.isReadOnly() ) {
-                print( offset + 1, "Min: {}, Max: {}\n",
-                    fetch_PropertyMethod_value( prop, &ic4::PropInteger::minimum, rep ),
-                    fetch_PropertyMethod_value( prop, &ic4::PropInteger::maximum, rep )
-                );
+            if( !info.is_read_only ) {
+                print( offset + 1, "Min: {}, Max: {}\n", format_attribute( info.int_min, rep ), format_attribute( info.int_max, rep ) );
             }
-            if( inc_mode == ic4::PropIncrementMode::Increment ) {
-                if( !prop.isReadOnly() )
-                {
-                    print( offset + 1, "Inc: {}\n",
-                        fetch_PropertyMethod_value( prop, &ic4::PropInteger::increment, rep )
-                    );
+            if( info.increment_mode == ic4::PropIncrementMode::Increment ) {
+                if( !info.is_read_only ) {
+                    print( offset + 1, "Inc: {}\n", format_attribute( info.int_inc, rep ) );
                 }
             }
-            else if( inc_mode == ic4::PropIncrementMode::ValueSet )
-            {
-                ic4::Error err;
-                std::vector<int64_t> vvset = prop.validValueSet(err);
-                if( err.isError() ) {
-                    print( offset + 1, "Failed to fetch ValidValueSet\n" );
-                }
-                else
-                {
-                    print( offset + 1, "ValidValueSet:\n" );
-                    for( auto&& val : vvset ) {
-                        print( offset + 2, "{}\n", val );
-                    }
-                    print( "\n" );
-                }
+            else if( info.increment_mode == ic4::PropIncrementMode::ValueSet ) {
+                print_valid_value_set( offset, info.int_valid_value_set );
             }
-            print( offset + 1, "Value: {}\n",
-                fetch_PropertyMethod_value( prop, &ic4::PropInteger::getValue, rep )
-            );
+            print( offset + 1, "Value: {}\n", format_attribute( info.int_value, rep ) );
         }
         break;
     }
     case ic4::PropType::Float:
     {
-        ic4::PropFloat prop = property.asFloat();
-        auto inc_mode = prop.incrementMode();
-
         print( offset + 1, "Representation: '{}', Unit: '{}', IncrementMode: '{}', DisplayNotation: {}, DisplayPrecision: {}\n",
-            toString( prop.representation() ), prop.unit(), toString( inc_mode ), toString( prop.displayNotation() ), prop.displayPrecision() );
+            toString( info.float_representation ), info.unit, toString( info.increment_mode ), toString( info.display_notation ), info.display_precision );
 
-        if( prop.isAvailable() )
+        if( info.is_available )
         {
-            if( !prop.isReadOnly() ) {
-                print( offset + 1, "Min: {}, Max: {}\n",
-                    fetch_PropertyMethod_value<double>( prop, &ic4::PropFloat::minimum ),
-                    fetch_PropertyMethod_value<double>( prop, &ic4::PropFloat::maximum )
-                );
+            if( !info.is_read_only ) {
+                print( offset + 1, "Min: {}, Max: {}\n", format_attribute( info.float_min ), format_attribute( info.float_max ) );
             }
-
-            if( inc_mode == ic4::PropIncrementMode::Increment ) {
-                print( offset + 1, "Inc: {}\n",
-                    fetch_PropertyMethod_value<double>( prop, &ic4::PropFloat::increment )
-                );
+            if( info.increment_mode == ic4::PropIncrementMode::Increment ) {
+                print( offset + 1, "Inc: {}\n", format_attribute( info.float_inc ) );
             }
-            else if( inc_mode == ic4::PropIncrementMode::ValueSet )
-            {
-                ic4::Error err;
-                std::vector<double> vvset = prop.validValueSet(err);
-                if( err.isError() ) {
-                    print( offset + 1, "Failed to fetch ValidValueSet\n" );
-                }
-                else
-                {
-                    print( offset + 1, "ValidValueSet:\n" );
-                    for( auto&& val : vvset ) {
-                        print( offset + 2, "{}\n", val );
-                    }
-                    print( "\n" );
-                }
+            else if( info.increment_mode == ic4::PropIncrementMode::ValueSet ) {
+                print_valid_value_set( offset, info.float_valid_value_set );
             }
-
-            print( offset + 1, "Value: {}\n",
-                fetch_PropertyMethod_value<double>( prop, &ic4::PropFloat::getValue )
-            );
+            print( offset + 1, "Value: {}\n", format_attribute( info.float_value ) );
         }
         break;
     }
     case ic4::PropType::Enumeration:
     {
-        auto prop = property.asEnumeration();
         print( offset + 1, "EnumEntries:\n" );
-        for( auto&& entry : prop.entries( ic4::Error::Ignore() ) )
+        for( auto&& entry : info.entries )
         {
-            auto prop_enum_entry = entry.asEnumEntry();
-
-            print_property( offset + 2, prop_enum_entry );
+            print_property_common( offset + 2, entry );
+            if( entry.is_available ) {
+                print( offset + 3, "IntValue: {}\n", format_attribute( entry.int_value ) );
+            }
+            print( "\n" );
+            print( "\n" );
             print( "\n" );
         }
 
-        if( prop.isAvailable() )
+        if( info.is_available )
         {
-            ic4::Error err;
-            auto selected_entry = prop.selectedEntry( err );
-            if( err ) {
+            if( !info.selected_entry.ok ) {
                 print( offset + 1, "Value: {}, SelectedEntry.Name: '{}'\n", "err", "err" );
-            }
-            else
-            {
-                print( offset + 1, "Value: {}, SelectedEntry.Name: '{}'\n",
-                    fetch_PropertyMethod_value<int64_t>( prop, &ic4::PropEnumeration::getIntValue ),
-                    selected_entry.name()
-                );
+            } else {
+                print( offset + 1, "Value: {}, SelectedEntry.Name: '{}'\n", format_attribute( info.int_value ), info.selected_entry.value );
             }
         }
         break;
     }
     case ic4::PropType::Boolean:
     {
-        auto prop = property.asBoolean();
-
-        if( prop.isAvailable() ) {
-            print( offset + 1, "Value: {}\n",
-                fetch_PropertyMethod_value<bool>( prop, &ic4::PropBoolean::getValue )
-            );
+        if( info.is_available ) {
+            print( offset + 1, "Value: {}\n", format_attribute( info.bool_value ) );
         }
         break;
     }
     case ic4::PropType::String:
     {
-        auto prop = property.asString();
-
-        if( prop.isAvailable() ) {
-            print( offset + 1, "Value: '{}', MaxLength: {}\n",
-                fetch_PropertyMethod_value<std::string>( prop, &ic4::PropString::getValue ),
-                fetch_PropertyMethod_value<uint64_t>( prop, &ic4::PropString::maxLength )
-            );
+        if( info.is_available ) {
+            print( offset + 1, "Value: '{}', MaxLength: {}\n", format_attribute( info.string_value ), format_attribute( info.string_max_length ) );
         }
         break;
     }
@@ -469,28 +712,22 @@ static void    print_property( int offset, const ic4::Property& property )
     }
     case ic4::PropType::Category:
     {
-        auto prop = property.asCategory();
         print( offset + 1, "Features:\n" );
-        for( auto&& feature : prop.features( ic4::Error::Ignore() ) )
+        for( auto&& feature : info.features )
         {
-            print( offset + 2, "{}\n", feature.name() );
+            print( offset + 2, "{}\n", feature );
         }
         break;
     }
     case ic4::PropType::Register:
     {
-        ic4::PropRegister prop = property.asRegister();
-
-        print( offset + 1, "Size: {}\n", 
-            fetch_PropertyMethod_value<uint64_t>( prop, &ic4::PropRegister::size )
-        );
-        if( prop.isAvailable() ) {
-            ic4::Error err;
-            std::vector<uint8_t> vec = prop.getValue( err );
-            if( err.isError() ) {
+        print( offset + 1, "Size: {}\n", format_attribute( info.register_size ) );
+        if( info.is_available ) {
+            if( !info.register_value.ok ) {
                 print( offset + 1, "Value: 'err'" );
             }
             else {
+                const auto& vec = info.register_value.value;
                 std::string str;
                 size_t max_entries_to_print = 16;
                 for( size_t i = 0; i < std::min( max_entries_to_print, vec.size() ); ++i ) {
@@ -513,10 +750,8 @@ static void    print_property( int offset, const ic4::Property& property )
     }
     case ic4::PropType::EnumEntry:
     {
-        ic4::PropEnumEntry prop = property.asEnumEntry();
-
-        if( prop.isAvailable() ) {
-            print( offset + 1, "IntValue: {}\n", fetch_PropertyMethod_value<int64_t>( prop, &ic4::PropEnumEntry::intValue ) );
+        if( info.is_available ) {
+            print( offset + 1, "IntValue: {}\n", format_attribute( info.int_value ) );
         }
         print( "\n" );
         break;
@@ -527,91 +762,425 @@ static void    print_property( int offset, const ic4::Property& property )
     print( "\n" );
 }
 
-static auto split_prop_entry( const std::string& prop_string ) -> std::pair<std::string,std::string>
+static void    print_property( int offset, const ic4::Property& property )
 {
-    auto f = prop_string.find( '=' );
-    if( f == std::string::npos ) {
-        return { prop_string, std::string{} };
+    print_property_info( offset, ic4_helper::gather_property_info( property ) );
+}
+
+// Writes the attribute, or null if reading it failed
+template<typename T>
+void write_attribute_field( output::record_writer& out, const char* name, const ic4_helper::attribute<T>& attr )
+{
+    if( attr.ok ) {
+        out.field( name, attr.value );
+    } else {
+        out.field_null( name );
     }
+}
 
-    return { prop_string.substr( 0, f ), prop_string.substr( f + 1 ) };
+template<typename T>
+void write_valid_value_set_field( output::record_writer& out, const ic4_helper::attribute<std::vector<T>>& vvset )
+{
+    if( !vvset.ok ) {
+        out.field_null( "valid_value_set" );
+        return;
+    }
+    out.begin_array( "valid_value_set" );
+    for( auto&& val : vvset.value ) {
+        out.value( val );
+    }
+    out.end_array();
 }
 
-static void set_property_from_assign_entry( ic4::PropertyMap& property_map, const std::string& prop_name, const std::string& prop_value )
+static void write_property_common_fields( output::record_writer& out, const ic4_helper::property_common& info )
 {
-    print( "Setting property '{}' to '{}'\n", prop_name, prop_value );
+    using namespace ic4_helper;
 
-    ic4::Error err;
-    if (!property_map.setValue(prop_name, prop_value, err))
+    out.field( "name", info.name )
+        .field( "type", toString( info.type ) )
+        .field( "display_name", info.display_name )
+        .field( "description", info.description )
+        .field( "tooltip", info.tooltip )
+        .field( "visibility", toString( info.visibility ) )
+        .field( "available", info.is_available )
+        .field( "locked", info.is_locked )
+        .field( "read_only", info.is_read_only );
+
+    if( info.is_selector )
     {
-        print("Failed to set value '{}' on property '{}'. Message: {}\n", prop_value, prop_name, err.message());
+        out.begin_array( "selected_properties" );
+        for( auto&& selected : info.selected_properties ) {
+            out.value( selected );
+        }
+        out.end_array();
     }
 }
 
-static void print_or_set_PropertyMap_entries( ic4::PropertyMap& map, const std::vector<std::string>& lst )
+// JSON counterpart of print_property_info(), writes one record per property
+static void write_property_record( output::record_writer& out, const ic4_helper::property_info& info )
 {
-    if( lst.empty() )
+    using namespace ic4_helper;
+
+    out.begin_record();
+    write_property_common_fields( out, info );
+
+    switch( info.type )
     {
-        for( auto&& property : map.all() )
+    case ic4::PropType::Integer:
+    {
+        out.field( "representation", toString( info.int_representation ) )
+            .field( "unit", info.unit )
+            .field( "increment_mode", toString( info.increment_mode ) );
+
+        if( info.is_available )
         {
-            print_property( 0, property );
+            if( !info.is_read_only )
+            {
+                write_attribute_field( out, "min", info.int_min );
+                write_attribute_field( out, "max", info.int_max );
+                if( info.increment_mode == ic4::PropIncrementMode::Increment ) {
+                    write_attribute_field( out, "inc", info.int_inc );
+                }
+            }
+            if( info.increment_mode == ic4::PropIncrementMode::ValueSet ) {
+                write_valid_value_set_field( out, info.int_valid_value_set );
+            }
+            write_attribute_field( out, "value", info.int_value );
         }
+        break;
     }
-    else
+    case ic4::PropType::Float:
     {
-        for( auto&& entry : lst )
+        out.field( "representation", toString( info.float_representation ) )
+            .field( "unit", info.unit )
+            .field( "increment_mode", toString( info.increment_mode ) )
+            .field( "display_notation", toString( info.display_notation ) )
+            .field( "display_precision", info.display_precision );
+
+        if( info.is_available )
         {
-            auto parse_entry = split_prop_entry( entry );
-            if( !parse_entry.second.empty() )
+            if( !info.is_read_only )
             {
-                set_property_from_assign_entry( map, parse_entry.first, parse_entry.second );
+                write_attribute_field( out, "min", info.float_min );
+                write_attribute_field( out, "max", info.float_max );
             }
-            else
-            {
-                auto property = map.find( entry );
-                if( property.is_valid() ) {
-                    print_property( 0, property );
-                } else {
-                    print( "Failed to find property for name: '{}'\n", entry );
-                }
+            if( info.increment_mode == ic4::PropIncrementMode::Increment ) {
+                write_attribute_field( out, "inc", info.float_inc );
             }
+            else if( info.increment_mode == ic4::PropIncrementMode::ValueSet ) {
+                write_valid_value_set_field( out, info.float_valid_value_set );
+            }
+            write_attribute_field( out, "value", info.float_value );
         }
+        break;
     }
-}
-
-static void exec_prop_cmd( std::string id, bool force_interface, const std::vector<std::string>& lst )
-{
-    if( force_interface )
+    case ic4::PropType::Enumeration:
     {
-        auto dev = find_interface( id );
-        if( !dev ) {
-            print( "Failed to find interface for id '{}'", id );
-            return;
+        out.begin_array( "entries" );
+        for( auto&& entry : info.entries )
+        {
+            out.begin_object()
+                .field( "name", entry.name )
+                .field( "display_name", entry.display_name )
+                .field( "available", entry.is_available );
+            write_attribute_field( out, "int_value", entry.int_value );
+            out.end_object();
         }
-        auto map = dev->interfacePropertyMap();
-        print_or_set_PropertyMap_entries( map, lst );
+        out.end_array();
+
+        if( info.is_available )
+        {
+            write_attribute_field( out, "value", info.int_value );
+            write_attribute_field( out, "selected_entry", info.selected_entry );
+        }
+        break;
     }
-    else
+    case ic4::PropType::Boolean:
     {
-        auto dev = find_device( id );
-        if( !dev ) {
-            print( "Failed to find device for id '{}'", id );
-            return;
+        if( info.is_available ) {
+            write_attribute_field( out, "value", info.bool_value );
         }
-        ic4::Grabber g;
-        g.deviceOpen( *dev );
-
-        auto map = g.devicePropertyMap();
-        print_or_set_PropertyMap_entries( map, lst );
+        break;
     }
-}
-
-static void save_properties( std::string id, bool force_interface, std::string filename )
-{
-    if( force_interface )
+    case ic4::PropType::String:
     {
-        auto dev = find_interface( id );
-        if( !dev ) {
+        if( info.is_available )
+        {
+            write_attribute_field( out, "value", info.string_value );
+            write_attribute_field( out, "max_length", info.string_max_length );
+        }
+        break;
+    }
+    case ic4::PropType::Category:
+    {
+        out.begin_array( "features" );
+        for( auto&& feature : info.features ) {
+            out.value( feature );
+        }
+        out.end_array();
+        break;
+    }
+    case ic4::PropType::Register:
+    {
+        write_attribute_field( out, "size", info.register_size );
+        if( info.is_available )
+        {
+            if( !info.register_value.ok ) {
+                out.field_null( "value" );
+            }
+            else
+            {
+                std::string hex;
+                hex.reserve( info.register_value.value.size() * 2 );
+                for( auto b : info.register_value.value ) {
+                    hex += fmt::format( "{:02x}", b );
+                }
+                out.field( "value", hex );
+            }
+        }
+        break;
+    }
+    case ic4::PropType::EnumEntry:
+    {
+        if( info.is_available ) {
+            write_attribute_field( out, "int_value", info.int_value );
+        }
+        break;
+    }
+    case ic4::PropType::Command:
+    case ic4::PropType::Port:
+    default:
+        ;
+    };
+    out.end_record();
+}
+
+static auto split_prop_entry( const std::string& prop_string ) -> std::pair<std::string,std::string>
+{
+    auto f = prop_string.find( '=' );
+    if( f == std::string::npos ) {
+        return { prop_string, std::string{} };
+    }
+
+    return { prop_string.substr( 0, f ), prop_string.substr( f + 1 ) };
+}
+
+static void set_property_from_assign_entry( ic4::PropertyMap& property_map, const std::string& prop_name, const std::string& prop_value )
+{
+    print( "Setting property '{}' to '{}'\n", prop_name, prop_value );
+
+    ic4::Error err;
+    if (!property_map.setValue(prop_name, prop_value, err))
+    {
+        print("Failed to set value '{}' on property '{}'. Message: {}\n", prop_value, prop_name, err.message());
+    }
+}
+
+static void write_or_set_PropertyMap_records( ic4::PropertyMap& map, const std::vector<std::string>& lst )
+{
+    output::record_writer out{ output_format, write_output };
+    if( lst.empty() )
+    {
+        for( auto&& property : map.all() ) {
+            write_property_record( out, ic4_helper::gather_property_info( property ) );
+        }
+        return;
+    }
+
+    for( auto&& entry : lst )
+    {
+        auto parse_entry = split_prop_entry( entry );
+        if( !parse_entry.second.empty() )
+        {
+            ic4::Error err;
+            bool success = map.setValue( parse_entry.first, parse_entry.second, err );
+            out.begin_record()
+                .field( "name", parse_entry.first )
+                .field( "set_value", parse_entry.second )
+                .field( "success", success );
+            if( !success ) {
+                out.field( "error", err.message() );
+            }
+            out.end_record();
+        }
+        else
+        {
+            auto property = map.find( entry );
+            if( property.is_valid() ) {
+                write_property_record( out, ic4_helper::gather_property_info( property ) );
+            } else {
+                out.begin_record().field( "name", entry ).field( "error", "Failed to find property" );
+                out.end_record();
+            }
+        }
+    }
+}
+
+static void print_or_set_PropertyMap_entries( ic4::PropertyMap& map, const std::vector<std::string>& lst )
+{
+    if( output_is_json() )
+    {
+        write_or_set_PropertyMap_records( map, lst );
+        return;
+    }
+
+    if( lst.empty() )
+    {
+        for( auto&& property : map.all() )
+        {
+            print_property( 0, property );
+        }
+    }
+    else
+    {
+        for( auto&& entry : lst )
+        {
+            auto parse_entry = split_prop_entry( entry );
+            if( !parse_entry.second.empty() )
+            {
+                set_property_from_assign_entry( map, parse_entry.first, parse_entry.second );
+            }
+            else
+            {
+                auto property = map.find( entry );
+                if( property.is_valid() ) {
+                    print_property( 0, property );
+                } else {
+                    print( "Failed to find property for name: '{}'\n", entry );
+                }
+            }
+        }
+    }
+}
+
+// Reads a batch file for `prop --apply`, "-" reads stdin
+static auto read_prop_batch_file( const std::string& filename ) -> std::string
+{
+    std::stringstream ss;
+    if( filename == "-" ) {
+        ss << std::cin.rdbuf();
+    }
+    else
+    {
+        std::ifstream f( filename );
+        if( !f ) {
+            throw std::runtime_error( fmt::format( "Failed to open '{}'", filename ) );
+        }
+        ss << f.rdbuf();
+    }
+    return ss.str();
+}
+
+static void print_prop_batch_result( const ic4_helper::prop_batch_result& res, size_t total )
+{
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        out.begin_record()
+            .field( "total", total )
+            .field( "applied", res.applied )
+            .field( "stream_restarted", res.stream_restarted )
+            .field( "elapsed_ms", res.elapsed_ms )
+            .field( "success", !res.failed );
+        if( res.failed )
+        {
+            out.field( "failed_name", res.failed_assignment.name )
+                .field( "failed_value", res.failed_assignment.value )
+                .field( "failed_line", res.failed_assignment.line )
+                .field( "error", res.error )
+                .field( "rolled_back", res.rolled_back );
+            out.begin_array( "rollback_errors" );
+            for( auto&& e : res.rollback_errors ) {
+                out.value( e );
+            }
+            out.end_array();
+            out.begin_array( "not_restorable" );
+            for( auto&& name : res.not_restorable ) {
+                out.value( name );
+            }
+            out.end_array();
+        }
+        out.end_record();
+        return;
+    }
+
+    if( !res.failed )
+    {
+        print( "Applied {} properties in {:.1f} ms{}\n", res.applied, res.elapsed_ms, res.stream_restarted ? " (stream restarted once)" : "" );
+        return;
+    }
+
+    print( "Failed to set property '{}' to '{}' (line {}). Message: {}\n",
+        res.failed_assignment.name, res.failed_assignment.value, res.failed_assignment.line, res.error );
+    print( "Rolled back {} of {} applied properties in {:.1f} ms{}\n", res.rolled_back, res.applied, res.elapsed_ms, res.stream_restarted ? " (stream restarted once)" : "" );
+    for( auto&& e : res.rollback_errors ) {
+        print( 1, "Failed to roll back {}\n", e );
+    }
+    for( auto&& name : res.not_restorable ) {
+        print( 1, "Not rolled back {}: The previous value could not be read\n", name );
+    }
+}
+
+// `prop --apply`: Applies all assignments of the batch as one transaction, see ic4_helper::apply_prop_batch
+static void apply_prop_batch( ic4::PropertyMap& map, const std::string& batch, const ic4_helper::stream_control* stream )
+{
+    std::istringstream in( batch );
+    auto ordered = ic4_helper::order_prop_assignments( map, ic4_helper::parse_prop_assignments( in ) );
+
+    auto res = ic4_helper::apply_prop_batch( map, ordered, stream );
+    print_prop_batch_result( res, ordered.size() );
+    if( res.failed ) {
+        throw std::runtime_error( "Property batch was not applied" );
+    }
+}
+
+static void exec_prop_cmd( std::string id, bool force_interface, const std::vector<std::string>& lst, const std::string& apply_filename )
+{
+    std::string batch;
+    if( !apply_filename.empty() ) {
+        batch = read_prop_batch_file( apply_filename );
+    }
+
+    if( force_interface )
+    {
+        auto dev = find_interface( id );
+        if( !dev ) {
+            print( "Failed to find interface for id '{}'", id );
+            return;
+        }
+        auto map = dev->interfacePropertyMap();
+        if( !apply_filename.empty() ) {
+            apply_prop_batch( map, batch, nullptr );
+        } else {
+            print_or_set_PropertyMap_entries( map, lst );
+        }
+    }
+    else
+    {
+        auto dev = find_device( id );
+        if( !dev ) {
+            print( "Failed to find device for id '{}'", id );
+            return;
+        }
+        ic4::Grabber g;
+        g.deviceOpen( *dev );
+
+        // The device was just opened, so there is no stream to stop
+        auto map = g.devicePropertyMap();
+        if( !apply_filename.empty() ) {
+            apply_prop_batch( map, batch, nullptr );
+        } else {
+            print_or_set_PropertyMap_entries( map, lst );
+        }
+    }
+}
+
+static void save_properties( std::string id, bool force_interface, std::string filename )
+{
+    if( force_interface )
+    {
+        auto dev = find_interface( id );
+        if( !dev ) {
             print( "Failed to find interface for id '{}'", id );
             return;
         }
@@ -633,55 +1202,1533 @@ static void save_properties( std::string id, bool force_interface, std::string f
     }
 }
 
-static void save_image( std::string id, std::string filename, int count, int timeout_in_ms, std::string image_type )
+static void print_prop_diff_result( const ic4_helper::prop_diff_result& res, const std::string& filename )
 {
-    auto dev = find_device( id );
-    if( !dev ) {
-        print( "Failed to find device for id '{}'", id );
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        for( auto&& d : res.diffs )
+        {
+            out.begin_record()
+                .field( "name", d.name )
+                .field( "status", ic4_helper::to_string( d.status ) )
+                .field( "expected", d.expected );
+            if( d.status == ic4_helper::prop_diff_status::differs ) {
+                out.field( "actual", d.actual );
+            }
+            if( !d.selectors.empty() ) {
+                out.field( "selectors", d.selectors );
+            }
+            out.end_record();
+        }
+        out.begin_record()
+            .field( "file", filename )
+            .field( "compared", res.compared )
+            .field( "skipped", res.skipped )
+            .field( "differences", res.diffs.size() )
+            .field( "elapsed_ms", res.elapsed_ms )
+            .field( "match", res.diffs.empty() );
+        out.end_record();
+        return;
+    }
+
+    for( auto&& d : res.diffs )
+    {
+        auto name = d.selectors.empty() ? d.name : fmt::format( "{} [{}]", d.name, d.selectors );
+        switch( d.status )
+        {
+        case ic4_helper::prop_diff_status::differs:
+            print( "{}: expected '{}', actual '{}'\n", name, d.expected, d.actual );
+            break;
+        case ic4_helper::prop_diff_status::missing:
+            print( "{}: expected '{}', not found on the device\n", name, d.expected );
+            break;
+        case ic4_helper::prop_diff_status::unavailable:
+            print( "{}: expected '{}', not available\n", name, d.expected );
+            break;
+        case ic4_helper::prop_diff_status::unreadable:
+            print( "{}: expected '{}', failed to read the value\n", name, d.expected );
+            break;
+        }
+    }
+    print( "Compared {} properties against '{}' in {:.1f} ms, {} differ\n", res.compared, filename, res.elapsed_ms, res.diffs.size() );
+}
+
+// `diff-prop`: Compares the properties of the device with a file written by save-prop. Returns true if all values match.
+static bool diff_properties( std::string id, bool force_interface, std::string filename )
+{
+    auto snapshot = ic4_helper::parse_prop_snapshot( read_prop_batch_file( filename ) );
+    if( snapshot.empty() ) {
+        throw std::runtime_error( fmt::format( "No property values found in '{}'", filename ) );
+    }
+
+    ic4_helper::prop_diff_result res;
+    if( force_interface )
+    {
+        auto dev = find_interface( id );
+        if( !dev ) {
+            throw std::runtime_error( fmt::format( "Failed to find interface for id '{}'", id ) );
+        }
+        auto map = dev->interfacePropertyMap();
+        res = ic4_helper::diff_prop_snapshot( map, snapshot );
+    }
+    else
+    {
+        auto dev = find_device( id );
+        if( !dev ) {
+            throw std::runtime_error( fmt::format( "Failed to find device for id '{}'", id ) );
+        }
+        ic4::Grabber g;
+        g.deviceOpen( *dev );
+
+        auto map = g.devicePropertyMap();
+        res = ic4_helper::diff_prop_snapshot( map, snapshot );
+    }
+
+    print_prop_diff_result( res, filename );
+    return res.diffs.empty();
+}
+
+static auto make_image_filename( const std::string& filename, int idx ) -> std::string
+{
+    if( filename.find_first_of( '{' ) != std::string::npos
+        && filename.find_first_of( '}' ) != std::string::npos )
+    {
+        return fmt::vformat( filename, fmt::make_format_args( idx ) );
+    }
+    return filename;
+}
+
+// The files are named on the encoder threads, so an invalid pattern has to be reported before the first image is submitted
+static void check_image_filename( const std::string& filename )
+{
+    try
+    {
+        make_image_filename( filename, 0 );
+    }
+    catch( const fmt::format_error& ex )
+    {
+        throw std::runtime_error( fmt::format( "Invalid filename pattern '{}': {}", filename, ex.what() ) );
+    }
+}
+
+// Replaces {serial} and {model} in a filename pattern, the {} frame counter is left for make_image_filename.
+// With add_serial, a pattern without {serial} gets "_{serial}" inserted before the extension, so devices do not overwrite each other's files.
+static auto make_device_filename( std::string pattern, const std::string& serial, const std::string& model_name, bool add_serial ) -> std::string
+{
+    if( add_serial && pattern.find( "{serial}" ) == std::string::npos )
+    {
+        auto name_begin = pattern.find_last_of( "/\\" );
+        auto ext = pattern.find_last_of( '.' );
+        if( ext == std::string::npos || (name_begin != std::string::npos && ext < name_begin) ) {
+            ext = pattern.size();
+        }
+        pattern.insert( ext, "_{serial}" );
+    }
+
+    // The result is still a format string for make_image_filename, so braces in the values are escaped
+    auto replace_all = [&pattern]( const std::string& key, const std::string& raw_value )
+    {
+        std::string value;
+        for( char c : raw_value )
+        {
+            value += c;
+            if( c == '{' || c == '}' ) {
+                value += c;
+            }
+        }
+        for( auto pos = pattern.find( key ); pos != std::string::npos; pos = pattern.find( key, pos + value.size() ) ) {
+            pattern.replace( pos, key.size(), value );
+        }
+    };
+    replace_all( "{serial}", serial );
+    replace_all( "{model}", model_name );
+    return pattern;
+}
+
+static bool save_image_buffer( const ic4::ImageBuffer& image, const std::string& filename, const std::string& image_type, ic4::Error& err = ic4::Error::Default() )
+{
+    if( image_type == "bmp" ) {
+        return ic4::imageBufferSaveAsBitmap( image, filename, {}, err );
+    }
+    else if( image_type == "png" ) {
+        return ic4::imageBufferSaveAsPng( image, filename, {}, err );
+    }
+    else if( image_type == "tiff" ) {
+        return ic4::imageBufferSaveAsTiff( image, filename, {}, err );
+    }
+    else if( image_type == "jpeg" ) {
+        return ic4::imageBufferSaveAsJpeg( image, filename, {}, err );
+    }
+    return false;
+}
+
+struct SaveImageOptions
+{
+    std::string filename;
+    int count = 1;
+    int timeout_in_ms = 1000;
+    std::string image_type = "bmp";
+    bool stream = false;
+    int queue_depth = 16;
+    int jobs = 0;           // 0 = one encoder thread per CPU core
+    bool fsync = false;
+
+    unsigned num_jobs() const
+    {
+        if( jobs > 0 ) {
+            return static_cast<unsigned>( jobs );
+        }
+        return std::max( 1u, std::thread::hardware_concurrency() );
+    }
+};
+
+// Per-stage counters, updated concurrently by the encoder threads
+struct SaveImageStats
+{
+    std::atomic<int> frames_encoded{ 0 };
+    std::atomic<int> frames_failed{ 0 };
+    std::atomic<int64_t> encode_ns{ 0 };
+    std::atomic<int64_t> fsync_ns{ 0 };
+};
+
+static void encode_image_job( const ic4::ImageBuffer& image, int idx, const SaveImageOptions& opt, SaveImageStats& stats )
+{
+    using clock = std::chrono::steady_clock;
+
+    // Exceptions must not leave a thread_pool job, see check_image_filename
+    std::string actual_filename;
+    try
+    {
+        actual_filename = make_image_filename( opt.filename, idx );
+    }
+    catch( const std::exception& ex )
+    {
+        stats.frames_failed += 1;
+        fmt::print( stderr, "Invalid filename pattern '{}': {}\n", opt.filename, ex.what() );
+        return;
+    }
+
+    auto t0 = clock::now();
+    ic4::Error err;
+    bool ok = save_image_buffer( image, actual_filename, opt.image_type, err );
+    auto t1 = clock::now();
+    stats.encode_ns += std::chrono::duration_cast<std::chrono::nanoseconds>( t1 - t0 ).count();
+
+    if( !ok ) {
+        stats.frames_failed += 1;
+        fmt::print( stderr, "Failed to save '{}': {}\n", actual_filename, err.message() );
+        return;
+    }
+
+    if( opt.fsync )
+    {
+        if( !helper::sync_file( actual_filename ) ) {
+            fmt::print( stderr, "Failed to sync '{}' to disk\n", actual_filename );
+        }
+        stats.fsync_ns += std::chrono::duration_cast<std::chrono::nanoseconds>( clock::now() - t1 ).count();
+    }
+    stats.frames_encoded += 1;
+}
+
+// Counters of `image --stream` that are not part of SaveImageStats
+struct SaveImageDrops
+{
+    bool timed_out = false;
+    uint64_t encoder_queue_full = 0;
+    uint64_t sink_underrun = 0;
+    uint64_t transform_underrun = 0;
+    uint64_t device_underrun = 0;
+
+    uint64_t total() const { return encoder_queue_full + sink_underrun + transform_underrun + device_underrun; }
+};
+
+static void print_save_image_report( const SaveImageOptions& opt, const SaveImageStats& stats, const SaveImageDrops* drops, double snap_ms, double encode_wall_ms,
+    const std::string& device = {} )
+{
+    int frames = stats.frames_encoded + stats.frames_failed;
+    double encode_ms = stats.encode_ns / 1e6;
+    double fsync_ms = stats.fsync_ns / 1e6;
+
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        out.begin_record();
+        if( !device.empty() ) {
+            out.field( "device", device );
+        }
+        out.field( "frames_encoded", stats.frames_encoded.load() )
+            .field( "frames_failed", stats.frames_failed.load() );
+        if( drops )
+        {
+            out.field( "timed_out", drops->timed_out )
+                .field( "frames_dropped", drops->total() )
+                .field( "encoder_queue_full", drops->encoder_queue_full )
+                .field( "sink_underrun", drops->sink_underrun )
+                .field( "transform_underrun", drops->transform_underrun )
+                .field( "device_underrun", drops->device_underrun );
+        }
+        out.field( "encoder_threads", opt.num_jobs() )
+            .field( "snap_ms", snap_ms )
+            .field( "encode_wall_ms", encode_wall_ms )
+            .field( "encode_ms", encode_ms );
+        if( opt.fsync ) {
+            out.field( "fsync_ms", fsync_ms );
+        }
+        out.end_record();
+        return;
+    }
+
+    if( drops && drops->timed_out ) {
+        print( "Timeout elapsed.\n" );
+    }
+    print( "Frames encoded: {}\n", stats.frames_encoded.load() );
+    print( "Frames failed:  {}\n", stats.frames_failed.load() );
+    if( drops ) {
+        print( "Frames dropped: {} (encoder queue full: {}, sink underrun: {}, transform underrun: {}, device underrun: {})\n",
+            drops->total(), drops->encoder_queue_full, drops->sink_underrun, drops->transform_underrun, drops->device_underrun );
+    }
+
+    print( "Timing ({} encoder threads):\n", opt.num_jobs() );
+    print( 1, "Snap:   {:10.1f} ms\n", snap_ms );
+    print( 1, "Encode: {:10.1f} ms wall, {:10.1f} ms total, {:8.2f} ms/frame\n", encode_wall_ms, encode_ms, frames > 0 ? encode_ms / frames : 0.0 );
+    if( opt.fsync ) {
+        print( 1, "Fsync:  {:10.1f} ms total, {:8.2f} ms/frame\n", fsync_ms, frames > 0 ? fsync_ms / frames : 0.0 );
+    } else {
+        print( 1, "Fsync:  skipped (use --fsync)\n" );
+    }
+}
+
+// Encodes the images on opt.num_jobs() threads and prints the summary. Every image is released as soon as it was written.
+static void encode_images( std::vector<std::shared_ptr<ic4::ImageBuffer>>& images, const SaveImageOptions& opt, double snap_ms )
+{
+    using clock = std::chrono::steady_clock;
+
+    auto encode_begin = clock::now();
+
+    // The file index is bound when the job is queued, so file names follow the capture order
+    // no matter in which order the jobs complete.
+    SaveImageStats stats;
+    {
+        helper::thread_pool pool( opt.num_jobs(), images.size() );
+        for( size_t idx = 0; idx < images.size(); ++idx )
+        {
+            auto image = std::move( images[idx] );
+            pool.submit( [image, idx, &opt, &stats] { encode_image_job( *image, static_cast<int>( idx ), opt, stats ); } );
+        }
+        pool.wait_idle();
+    }
+    images.clear();
+
+    auto encode_end = clock::now();
+
+    print_save_image_report( opt, stats, nullptr, snap_ms, std::chrono::duration<double, std::milli>( encode_end - encode_begin ).count() );
+}
+
+static void save_image( std::string id, SaveImageOptions opt )
+{
+    using clock = std::chrono::steady_clock;
+
+    auto dev = find_device( id );
+    if( !dev ) {
+        print( "Failed to find device for id '{}'", id );
+        return;
+    }
+    opt.filename = make_device_filename( opt.filename, dev->serial(), dev->modelName(), false );
+    check_image_filename( opt.filename );
+    ic4::Grabber g;
+    g.deviceOpen( *dev );
+
+    auto snap_sink = ic4::SnapSink::create();
+    g.streamSetup( snap_sink, ic4::StreamSetupOption::AcquisitionStart );
+
+    auto snap_begin = clock::now();
+
+    ic4::Error err;
+    auto images = snap_sink->snapSequence( opt.count, opt.timeout_in_ms, err );
+    if( err ) {
+        if( err.code() == ic4::ErrorCode::Timeout ) {
+            print( "Timeout elapsed." );
+            // #TODO maybe dissect what to do here.
+            return;
+        }
+        throw err;
+    }
+
+    g.acquisitionStop();
+
+    encode_images( images, opt, std::chrono::duration<double, std::milli>( clock::now() - snap_begin ).count() );
+}
+
+// Resolves several device ids, 'all' stands for every device. Each device is returned once, in the order of the ids.
+static auto resolve_device_ids( const device_index::index& idx, const std::vector<std::string>& ids ) -> std::vector<const device_index::entry*>
+{
+    std::vector<const device_index::entry*> entries;
+    std::set<std::string> unique_names;
+    auto add = [&]( const device_index::entry* e )
+    {
+        if( unique_names.insert( e->unique_name ).second ) {
+            entries.push_back( e );
+        }
+    };
+
+    for( auto&& id : ids )
+    {
+        if( id == "all" )
+        {
+            for( auto&& e : idx.entries() ) {
+                add( &e );
+            }
+            continue;
+        }
+        auto e = idx.find( id );
+        if( !e ) {
+            throw std::runtime_error( fmt::format( "Failed to find device for id '{}'", id ) );
+        }
+        add( e );
+    }
+    return entries;
+}
+
+// State of one device in save_image_multi. The grabber is kept open until its images were encoded.
+struct DeviceCapture
+{
+    device_index::entry entry;
+    std::unique_ptr<ic4::DeviceInfo> info;
+    SaveImageOptions opt;
+
+    std::unique_ptr<ic4::Grabber> grabber;
+    std::vector<std::shared_ptr<ic4::ImageBuffer>> images;
+    double open_ms = 0;
+    double snap_ms = 0;
+    std::string error;
+
+    std::unique_ptr<SaveImageStats> stats = std::make_unique<SaveImageStats>();
+};
+
+// `image` with several device ids or `all`: Opens, sets up and captures all devices at the same time, one thread per device,
+// so the startup time is that of the slowest device instead of the sum. All frames are then encoded by one shared pool.
+static void save_image_multi( const std::vector<std::string>& ids, const SaveImageOptions& opt )
+{
+    using clock = std::chrono::steady_clock;
+
+    auto idx = load_device_index();
+    std::vector<std::unique_ptr<DeviceCapture>> captures;
+    for( auto e : resolve_device_ids( idx, ids ) )
+    {
+        auto cap = std::make_unique<DeviceCapture>();
+        cap->entry = *e;
+        cap->info = idx.device_info( *e );
+        if( !cap->info ) {
+            throw std::runtime_error( fmt::format( "Device '{}' is no longer available", e->serial ) );
+        }
+        cap->opt = opt;
+        cap->opt.filename = make_device_filename( opt.filename, e->serial, e->model_name, true );
+        check_image_filename( cap->opt.filename );
+        captures.push_back( std::move( cap ) );
+    }
+    if( captures.empty() ) {
+        throw std::runtime_error( "No devices are available" );
+    }
+
+    auto capture_begin = clock::now();
+    {
+        std::vector<std::thread> threads;
+        for( auto&& c : captures )
+        {
+            auto& cap = *c;
+            threads.emplace_back( [&cap]
+            {
+                try
+                {
+                    auto open_begin = clock::now();
+                    cap.grabber = std::make_unique<ic4::Grabber>();
+                    cap.grabber->deviceOpen( *cap.info );
+
+                    auto snap_sink = ic4::SnapSink::create();
+                    cap.grabber->streamSetup( snap_sink, ic4::StreamSetupOption::AcquisitionStart );
+                    cap.open_ms = ms_since( open_begin );
+
+                    auto snap_begin = clock::now();
+                    ic4::Error err;
+                    cap.images = snap_sink->snapSequence( cap.opt.count, cap.opt.timeout_in_ms, err );
+                    cap.snap_ms = ms_since( snap_begin );
+                    if( err ) {
+                        cap.error = err.code() == ic4::ErrorCode::Timeout ? "Timeout elapsed." : err.message();
+                    }
+
+                    cap.grabber->acquisitionStop();
+                }
+                catch( const std::exception& ex )
+                {
+                    cap.error = ex.what();
+                }
+            } );
+        }
+        for( auto&& t : threads ) {
+            t.join();
+        }
+    }
+    auto capture_ms = ms_since( capture_begin );
+
+    size_t num_images = 0;
+    for( auto&& cap : captures ) {
+        num_images += cap->images.size();
+    }
+
+    auto encode_begin = clock::now();
+    {
+        helper::thread_pool pool( opt.num_jobs(), std::max<size_t>( 1, num_images ) );
+        for( auto&& c : captures )
+        {
+            auto& cap = *c;
+            for( size_t i = 0; i < cap.images.size(); ++i )
+            {
+                auto image = std::move( cap.images[i] );
+                pool.submit( [image, i, &cap] { encode_image_job( *image, static_cast<int>( i ), cap.opt, *cap.stats ); } );
+            }
+            cap.images.clear();
+        }
+        pool.wait_idle();
+    }
+    auto encode_wall_ms = ms_since( encode_begin );
+
+    if( !output_is_json() ) {
+        print( "Captured {} devices concurrently in {:.1f} ms, encoded {} frames in {:.1f} ms\n", captures.size(), capture_ms, num_images, encode_wall_ms );
+    }
+    for( auto&& c : captures )
+    {
+        auto& cap = *c;
+        auto label = fmt::format( "{} {}", cap.entry.model_name, cap.entry.serial );
+        if( !cap.error.empty() )
+        {
+            if( output_is_json() ) {
+                output::record_writer out{ output_format, write_output };
+                out.begin_record().field( "device", label ).field( "error", cap.error );
+                out.end_record();
+            } else {
+                print( "\nDevice {}: {}\n", label, cap.error );
+            }
+            continue;
+        }
+        if( !output_is_json() ) {
+            print( "\nDevice {} (opened in {:.1f} ms):\n", label, cap.open_ms );
+        }
+        print_save_image_report( cap.opt, *cap.stats, nullptr, cap.snap_ms, encode_wall_ms, label );
+    }
+}
+
+// Hands every received buffer to the encoder pool as long as the pool has room, otherwise the frame is dropped.
+// The buffer is owned by the queued job and returns to the sink's free queue once it was written,
+// so memory use is bounded by the number of sink buffers regardless of the frame count.
+class StreamingSaveListener : public ic4::QueueSinkListener
+{
+    helper::thread_pool& pool_;
+    std::function<void( const ic4::ImageBuffer&, int )> save_func_;
+    int count_;
+    size_t num_buffers_;
+
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    uint64_t frames_received_ = 0;
+    int frames_accepted_ = 0;
+    int frames_dropped_ = 0;
+public:
+    StreamingSaveListener( helper::thread_pool& pool, std::function<void( const ic4::ImageBuffer&, int )> save_func, int count, size_t num_buffers )
+        : pool_( pool ), save_func_( std::move( save_func ) ), count_( count ), num_buffers_( num_buffers )
+    {
+    }
+
+    bool sinkConnected( ic4::QueueSink& sink, const ic4::ImageType& /*frameType*/, size_t min_buffers_required ) override
+    {
+        if( num_buffers_ > min_buffers_required ) {
+            sink.allocAndQueueBuffers( num_buffers_ );
+        }
+        return true;
+    }
+
+    void framesQueued( ic4::QueueSink& sink ) override
+    {
+        ic4::Error err;
+        while( true )
+        {
+            auto buffer = sink.popOutputBuffer( err );
+            if( buffer == nullptr ) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lck{ mtx_ };
+            frames_received_ += 1;
+            if( frames_accepted_ < count_ )
+            {
+                int idx = frames_accepted_;
+                auto save_func = save_func_;
+                if( pool_.try_submit( [buffer, idx, save_func] { save_func( *buffer, idx ); } ) ) {
+                    frames_accepted_ += 1;
+                } else {
+                    frames_dropped_ += 1;
+                }
+            }
+            cond_.notify_all();
+        }
+    }
+
+    // Waits until count frames were handed to the pool. Returns false if no frame arrived for timeout_in_ms.
+    bool wait_accepted( int timeout_in_ms )
+    {
+        std::unique_lock<std::mutex> lck{ mtx_ };
+        while( frames_accepted_ < count_ )
+        {
+            auto prev = frames_received_;
+            if( !cond_.wait_for( lck, std::chrono::milliseconds( timeout_in_ms ), [&] { return frames_received_ != prev; } ) ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int frames_dropped()
+    {
+        std::lock_guard<std::mutex> lck{ mtx_ };
+        return frames_dropped_;
+    }
+};
+
+static void save_image_streaming( std::string id, SaveImageOptions opt )
+{
+    using clock = std::chrono::steady_clock;
+
+    auto dev = find_device( id );
+    if( !dev ) {
+        print( "Failed to find device for id '{}'", id );
+        return;
+    }
+    opt.filename = make_device_filename( opt.filename, dev->serial(), dev->modelName(), false );
+    check_image_filename( opt.filename );
+
+    SaveImageStats stats;
+
+    unsigned num_threads = opt.num_jobs();
+    size_t max_pending = static_cast<size_t>( std::max( 1, opt.queue_depth ) );
+    helper::thread_pool pool( num_threads, max_pending );
+
+    // The listener has to outlive the stream, the grabber is declared last so it stops the stream first.
+    StreamingSaveListener listener( pool,
+        [&opt, &stats]( const ic4::ImageBuffer& image, int idx ) { encode_image_job( image, idx, opt, stats ); },
+        opt.count, max_pending + num_threads + 2 );
+
+    ic4::Grabber g;
+    g.deviceOpen( *dev );
+
+    auto sink = ic4::QueueSink::create( listener );
+    g.streamSetup( sink, ic4::StreamSetupOption::AcquisitionStart );
+
+    auto snap_begin = clock::now();
+    bool completed = listener.wait_accepted( opt.timeout_in_ms );
+    auto snap_end = clock::now();
+
+    g.acquisitionStop();
+    pool.wait_idle();
+    auto encode_end = clock::now();
+
+    auto stream_stats = g.streamStatistics();
+    g.streamStop();
+
+    SaveImageDrops drops;
+    drops.timed_out = !completed;
+    drops.encoder_queue_full = listener.frames_dropped();
+    drops.sink_underrun = stream_stats.sink_underrun;
+    drops.transform_underrun = stream_stats.transform_underrun;
+    drops.device_underrun = stream_stats.device_underrun;
+
+    // Encoding overlaps with capturing, the encode wall time is measured from the start of the stream.
+    print_save_image_report( opt, stats, &drops,
+        std::chrono::duration<double, std::milli>( snap_end - snap_begin ).count(),
+        std::chrono::duration<double, std::milli>( encode_end - snap_begin ).count() );
+}
+
+class BenchListener : public ic4::QueueSinkListener
+{
+    bench::frame_recorder& recorder_;
+    size_t num_buffers_;
+public:
+    BenchListener( bench::frame_recorder& recorder, size_t num_buffers )
+        : recorder_( recorder ), num_buffers_( num_buffers )
+    {
+    }
+
+    bool sinkConnected( ic4::QueueSink& sink, const ic4::ImageType& /*frameType*/, size_t min_buffers_required ) override
+    {
+        if( num_buffers_ > min_buffers_required ) {
+            sink.allocAndQueueBuffers( num_buffers_ );
+        }
+        return true;
+    }
+
+    void framesQueued( ic4::QueueSink& sink ) override
+    {
+        ic4::Error err;
+        while( true )
+        {
+            auto buffer = sink.popOutputBuffer( err );
+            if( buffer == nullptr ) {
+                return;
+            }
+            recorder_.on_frame( static_cast<size_t>( std::abs( buffer->pitch() ) ) * buffer->imageType().height() );
+        }
+    }
+};
+
+static auto to_bench_counters( const ic4::Grabber::StreamStatistics& stats ) -> bench::stream_counters
+{
+    bench::stream_counters c;
+    c.device_delivered = stats.device_delivered;
+    c.device_transmission_error = stats.device_transmission_error;
+    c.device_underrun = stats.device_underrun;
+    c.transform_delivered = stats.transform_delivered;
+    c.transform_underrun = stats.transform_underrun;
+    c.sink_delivered = stats.sink_delivered;
+    c.sink_underrun = stats.sink_underrun;
+    c.sink_ignored = stats.sink_ignored;
+    return c;
+}
+
+static void print_bench_result( const bench::result& res )
+{
+    const auto& iv = res.intervals;
+
+    print( "Benchmark: {}\n", res.source );
+    print( 1, "Duration:   {:.2f} s\n", res.duration_s );
+    print( 1, "Frames:     {}\n", res.frames );
+    print( 1, "Frame rate: {:.2f} fps\n", res.fps() );
+    print( 1, "Throughput: {:.2f} MB/s\n", res.mb_per_s() );
+    print( "\n" );
+    print( 1, "Frame interval [us] ({} intervals):\n", iv.count );
+    print( 2, "Mean: {:.1f}, StdDev: {:.1f}\n", iv.mean_us, iv.stddev_us );
+    print( 2, "Min: {:.1f}, P50: {:.1f}, P90: {:.1f}, P99: {:.1f}, P99.9: {:.1f}, Max: {:.1f}\n",
+        iv.min_us, iv.p50_us, iv.p90_us, iv.p99_us, iv.p999_us, iv.max_us );
+    print( "\n" );
+    print( 1, "Stream statistics (delta):\n" );
+    bench::for_each_counter( res.counters_delta, []( const char* name, uint64_t value ) {
+        print( 2, "{:26} {}\n", name, value );
+    } );
+    print( "\n" );
+
+    print( 1, "{:>8} {:>10} {:>10} {:>10} {:>8} {:>10} {:>10} {:>10} {:>10}\n",
+        "Time[s]", "fps", "MB/s", "Delivered", "TxError", "DevUnder", "TfUnder", "SinkUnder", "SinkIgn" );
+    for( size_t i = 1; i < res.samples.size(); ++i )
+    {
+        const auto& prev = res.samples[i - 1];
+        const auto& cur = res.samples[i];
+        auto dt = cur.time_s - prev.time_s;
+        auto d = cur.counters - prev.counters;
+        print( 1, "{:8.2f} {:10.2f} {:10.2f} {:10} {:8} {:10} {:10} {:10} {:10}\n",
+            cur.time_s,
+            dt > 0 ? (cur.frames - prev.frames) / dt : 0.0,
+            dt > 0 ? (cur.bytes - prev.bytes) / dt / 1e6 : 0.0,
+            d.device_delivered, d.device_transmission_error, d.device_underrun,
+            d.transform_underrun, d.sink_underrun, d.sink_ignored );
+    }
+}
+
+static void write_bench_counters( output::record_writer& out, const char* name, const bench::stream_counters& counters )
+{
+    out.begin_object( name );
+    bench::for_each_counter( counters, [&]( const char* counter_name, uint64_t value ) {
+        out.field( counter_name, value );
+    } );
+    out.end_object();
+}
+
+static void write_bench_record( output::record_writer& out, const bench::result& res )
+{
+    const auto& iv = res.intervals;
+
+    out.begin_record()
+        .field( "source", res.source )
+        .field( "duration_s", res.duration_s )
+        .field( "frames", res.frames )
+        .field( "bytes", res.bytes )
+        .field( "fps", res.fps() )
+        .field( "mb_per_s", res.mb_per_s() );
+    out.begin_object( "frame_interval_us" )
+        .field( "count", iv.count )
+        .field( "mean", iv.mean_us )
+        .field( "stddev", iv.stddev_us )
+        .field( "min", iv.min_us )
+        .field( "p50", iv.p50_us )
+        .field( "p90", iv.p90_us )
+        .field( "p99", iv.p99_us )
+        .field( "p99_9", iv.p999_us )
+        .field( "max", iv.max_us )
+        .end_object();
+    write_bench_counters( out, "stream_statistics_delta", res.counters_delta );
+    out.begin_array( "samples" );
+    for( auto&& smp : res.samples )
+    {
+        out.begin_object()
+            .field( "time_s", smp.time_s )
+            .field( "frames", smp.frames )
+            .field( "bytes", smp.bytes );
+        write_bench_counters( out, "stream_statistics", smp.counters );
+        out.end_object();
+    }
+    out.end_array();
+    out.end_record();
+}
+
+// Writes the result in the layout of --format json, to stdout for '-'
+static void write_bench_json( const bench::result& res, const std::string& filename )
+{
+    if( filename == "-" )
+    {
+        output::record_writer out{ output::format::json, write_output };
+        write_bench_record( out, res );
+        return;
+    }
+
+    // The record is rendered through print_capture, record_writer only takes a plain function as its sink
+    struct RestoreCapture
+    {
+        fmt::memory_buffer* prev = print_capture;
+        ~RestoreCapture() { print_capture = prev; }
+    } restore;
+
+    fmt::memory_buffer buf;
+    print_capture = &buf;
+    {
+        output::record_writer out{ output::format::json, write_output };
+        write_bench_record( out, res );
+    }
+    print_capture = restore.prev;
+
+    FILE* f = std::fopen( filename.c_str(), "wb" );
+    if( !f ) {
+        throw std::runtime_error( fmt::format( "Failed to open '{}' for writing", filename ) );
+    }
+    std::fwrite( buf.data(), 1, buf.size(), f );
+    std::fclose( f );
+}
+
+static void run_bench( std::string id, const bench::config& cfg )
+{
+    bench::frame_recorder recorder;
+    bench::result res;
+
+    if( cfg.synthetic )
+    {
+        if( !(cfg.synthetic_fps > 0) ) {
+            throw std::runtime_error( fmt::format( "Invalid synthetic frame rate {}", cfg.synthetic_fps ) );
+        }
+
+        size_t frame_size = static_cast<size_t>( cfg.synthetic_width ) * cfg.synthetic_height;
+        size_t num_buffers = cfg.num_buffers > 0 ? cfg.num_buffers : 8;
+        recorder.reserve( static_cast<size_t>( cfg.synthetic_fps * (cfg.duration_s + 1) ) );
+
+        bench::synthetic_source source( cfg.synthetic_fps, frame_size, num_buffers );
+        source.start( [&]( const std::vector<uint8_t>& frame ) { recorder.on_frame( frame.size() ); } );
+
+        res = bench::run_sampling( cfg, recorder, [&] { return source.statistics(); } );
+        source.stop();
+
+        res.source = fmt::format( "synthetic Mono8 {}x{} @ {} fps, {} buffers", cfg.synthetic_width, cfg.synthetic_height, cfg.synthetic_fps, num_buffers );
+    }
+    else
+    {
+        auto dev = find_device( id );
+        if( !dev ) {
+            print( "Failed to find device for id '{}'", id );
+            return;
+        }
+
+        // The listener has to outlive the stream, the grabber is declared last so it stops the stream first.
+        BenchListener listener( recorder, static_cast<size_t>( std::max( 0, cfg.num_buffers ) ) );
+
+        ic4::Grabber g;
+        g.deviceOpen( *dev );
+
+        ic4::Error err;
+        auto fps = g.devicePropertyMap().getValueDouble( ic4::PropId::AcquisitionFrameRate, err );
+        if( !err.isError() ) {
+            recorder.reserve( static_cast<size_t>( fps * (cfg.duration_s + 1) ) );
+        }
+
+        auto sink = ic4::QueueSink::create( listener );
+        g.streamSetup( sink, ic4::StreamSetupOption::AcquisitionStart );
+
+        res = bench::run_sampling( cfg, recorder, [&] { return to_bench_counters( g.streamStatistics() ); } );
+
+        g.streamStop();
+
+        res.source = fmt::format( "{} {}", dev->modelName(), dev->serial() );
+    }
+
+    res.intervals = bench::summarize_intervals( recorder.intervals_us() );
+
+    // With --format json/ndjson the result object is written to stdout, --json can still save a copy to a file
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        write_bench_record( out, res );
+    }
+    else if( cfg.json_filename != "-" ) {
+        print_bench_result( res );
+    }
+    if( !cfg.json_filename.empty() && !(output_is_json() && cfg.json_filename == "-") ) {
+        write_bench_json( res, cfg.json_filename );
+    }
+}
+
+// Requeues every frame right away, `watch` only streams to produce stream statistics
+class DiscardListener : public ic4::QueueSinkListener
+{
+public:
+    void framesQueued( ic4::QueueSink& sink ) override
+    {
+        ic4::Error err;
+        while( sink.popOutputBuffer( err ) != nullptr ) {
+        }
+    }
+};
+
+static volatile std::sig_atomic_t watch_stop_requested = 0;
+
+static void watch_signal_handler( int )
+{
+    watch_stop_requested = 1;
+}
+
+static void run_watch( std::string id, const watch::config& cfg )
+{
+    using clock = std::chrono::steady_clock;
+
+    auto dev = find_device( id );
+    if( !dev ) {
+        throw std::runtime_error( fmt::format( "Failed to find device for id '{}'", id ) );
+    }
+
+    // Declared before the grabber, so that it outlives the stream
+    DiscardListener listener;
+
+    ic4::Grabber g;
+    g.deviceOpen( *dev );
+    auto map = g.devicePropertyMap();
+
+    auto begin = clock::now();
+    auto elapsed_s = [begin] { return std::chrono::duration<double>( clock::now() - begin ).count(); };
+
+    watch::event_ring ring( cfg.ring_capacity );
+
+    // Notification callbacks only read the new value and push it into the ring, all output is done by the loop below
+    struct Registration
+    {
+        ic4::Property prop;
+        ic4::Property::NotificationToken token;
+    };
+    std::vector<Registration> registrations;
+    struct RemoveNotifications
+    {
+        std::vector<Registration>& registrations;
+        ~RemoveNotifications()
+        {
+            for( auto&& r : registrations ) {
+                r.prop.eventRemoveNotification( r.token, ic4::Error::Ignore() );
+            }
+        }
+    } remove_notifications{ registrations };
+
+    for( auto&& name : cfg.properties )
+    {
+        ic4::Error err;
+        auto prop = map.find( name, err );
+        if( err.isError() ) {
+            throw std::runtime_error( fmt::format( "Failed to find property '{}'", name ) );
+        }
+
+        ring.push( { elapsed_s(), name, map.getValueString( name, ic4::Error::Ignore() ) } );
+
+        auto token = prop.eventAddNotification( [&ring, &elapsed_s, map, name]( ic4::Property& ) mutable
+        {
+            ic4::Error err;
+            auto value = map.getValueString( name, err );
+            ring.push( { elapsed_s(), name, err.isError() ? std::string( "err" ) : value } );
+        } );
+        registrations.push_back( { prop, token } );
+    }
+
+    std::shared_ptr<ic4::QueueSink> sink;
+    bench::stream_counters prev_stats;
+    if( cfg.stream )
+    {
+        sink = ic4::QueueSink::create( listener );
+        g.streamSetup( sink, ic4::StreamSetupOption::AcquisitionStart );
+        prev_stats = to_bench_counters( g.streamStatistics() );
+    }
+
+    watch_stop_requested = 0;
+    struct RestoreSignalHandler
+    {
+        void ( *prev_handler )( int );
+        ~RestoreSignalHandler()
+        {
+            std::signal( SIGINT, prev_handler );
+        }
+    } restore_signal_handler{ std::signal( SIGINT, watch_signal_handler ) };
+
+    if( !output_is_json() ) {
+        print( "Watching {} properties{}, press Ctrl-C to stop\n", cfg.properties.size(), cfg.stream ? " and stream statistics" : "" );
+    }
+
+    output::record_writer out{ output_format, write_output };
+    auto emit_events = [&]( const std::vector<watch::coalesced_event>& events )
+    {
+        for( auto&& ev : events )
+        {
+            if( output_is_json() )
+            {
+                out.begin_record()
+                    .field( "time_s", ev.time_s )
+                    .field( "type", "property" )
+                    .field( "name", ev.name )
+                    .field( "value", ev.value )
+                    .field( "changes", ev.changes );
+                out.end_record();
+            }
+            else if( ev.changes > 1 ) {
+                print( "{:10.3f}  {:32} {} ({} changes)\n", ev.time_s, ev.name, ev.value, ev.changes );
+            } else {
+                print( "{:10.3f}  {:32} {}\n", ev.time_s, ev.name, ev.value );
+            }
+        }
+    };
+    auto emit_stats = [&]( double time_s, const bench::stream_counters& delta )
+    {
+        if( output_is_json() )
+        {
+            out.begin_record().field( "time_s", time_s ).field( "type", "stream_statistics" );
+            bench::for_each_counter( delta, [&out]( const char* name, uint64_t value ) {
+                out.field( name, value );
+            } );
+            out.end_record();
+            return;
+        }
+
+        std::string changed;
+        bench::for_each_counter( delta, [&changed]( const char* name, uint64_t value ) {
+            if( value != 0 ) {
+                changed += fmt::format( "{}{} +{}", changed.empty() ? "" : ", ", name, value );
+            }
+        } );
+        print( "{:10.3f}  {:32} {}\n", time_s, "StreamStatistics", changed.empty() ? "no change" : changed );
+    };
+
+    // At most max_rate_hz output batches per second, all changes in between are coalesced
+    auto tick = std::chrono::duration_cast<clock::duration>( std::chrono::duration<double>( 1.0 / std::max( 0.01, cfg.max_rate_hz ) ) );
+    auto stats_interval = std::chrono::milliseconds( std::max( 1, cfg.stats_interval_ms ) );
+    auto end = begin + std::chrono::duration_cast<clock::duration>( std::chrono::duration<double>( cfg.duration_s ) );
+
+    std::vector<watch::event> events;
+    uint64_t reported_lost = 0;
+    auto next_stats = begin + stats_interval;
+    auto next_tick = begin;
+    while( !watch_stop_requested )
+    {
+        bool last = cfg.duration_s > 0 && next_tick >= end;
+
+        events.clear();
+        ring.drain( events );
+        emit_events( watch::coalesce( events ) );
+
+        auto lost = ring.lost();
+        if( lost > reported_lost )
+        {
+            if( output_is_json() ) {
+                out.begin_record().field( "time_s", elapsed_s() ).field( "type", "lost_events" ).field( "count", lost - reported_lost );
+                out.end_record();
+            } else {
+                print( "{:10.3f}  {} property events were lost, increase --ring-size\n", elapsed_s(), lost - reported_lost );
+            }
+            reported_lost = lost;
+        }
+
+        if( cfg.stream && clock::now() >= next_stats )
+        {
+            auto stats = to_bench_counters( g.streamStatistics() );
+            emit_stats( elapsed_s(), stats - prev_stats );
+            prev_stats = stats;
+            next_stats += stats_interval;
+        }
+        std::fflush( stdout );
+
+        if( last ) {
+            break;
+        }
+        next_tick += tick;
+        if( cfg.duration_s > 0 ) {
+            next_tick = std::min( next_tick, end );
+        }
+        std::this_thread::sleep_until( next_tick );
+    }
+
+    if( cfg.stream ) {
+        g.streamStop();
+    }
+}
+
+// Records the host arrival times of the frame and the EventExposureEnd notification of the current latency cycle
+class LatencyListener : public ic4::QueueSinkListener
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    void framesQueued( ic4::QueueSink& sink ) override
+    {
+        auto now = clock::now();
+
+        ic4::Error err;
+        while( true )
+        {
+            auto buffer = sink.popOutputBuffer( err );
+            if( buffer == nullptr ) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lck{ mtx_ };
+            if( !frame_received_ )
+            {
+                frame_received_ = true;
+                frame_time_ = now;
+                cond_.notify_all();
+            }
+        }
+    }
+
+    void on_exposure_end()
+    {
+        auto now = clock::now();
+
+        std::lock_guard<std::mutex> lck{ mtx_ };
+        if( !event_received_ )
+        {
+            event_received_ = true;
+            event_time_ = now;
+            cond_.notify_all();
+        }
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lck{ mtx_ };
+        frame_received_ = false;
+        event_received_ = false;
+    }
+
+    bool wait_frame( std::chrono::milliseconds timeout, clock::time_point& time )
+    {
+        std::unique_lock<std::mutex> lck{ mtx_ };
+        if( !cond_.wait_for( lck, timeout, [this] { return frame_received_; } ) ) {
+            return false;
+        }
+        time = frame_time_;
+        return true;
+    }
+
+    bool wait_event( std::chrono::milliseconds timeout, clock::time_point& time )
+    {
+        std::unique_lock<std::mutex> lck{ mtx_ };
+        if( !cond_.wait_for( lck, timeout, [this] { return event_received_; } ) ) {
+            return false;
+        }
+        time = event_time_;
+        return true;
+    }
+
+private:
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    bool frame_received_ = false;
+    clock::time_point frame_time_;
+    bool event_received_ = false;
+    clock::time_point event_time_;
+};
+
+struct LatencyConfig
+{
+    int cycles = 1000;
+    int warmup = 10;
+    int timeout_ms = 1000;
+    int event_timeout_ms = 100;
+    bool use_event = true;
+};
+
+struct LatencyStage
+{
+    const char* name;
+    std::vector<double> samples_us;
+};
+
+static void print_latency_result( const std::string& source, const LatencyConfig& cfg, const std::vector<LatencyStage>& stages, int frame_timeouts, int missing_events, int late_frames )
+{
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        out.begin_record()
+            .field( "source", source )
+            .field( "cycles", cfg.cycles )
+            .field( "frame_timeouts", frame_timeouts )
+            .field( "missing_events", missing_events )
+            .field( "late_frames", late_frames );
+        out.begin_array( "stages" );
+        for( auto&& stage : stages )
+        {
+            auto s = bench::summarize_intervals( stage.samples_us );
+            out.begin_object()
+                .field( "name", stage.name )
+                .field( "count", s.count )
+                .field( "mean_us", s.mean_us )
+                .field( "min_us", s.min_us )
+                .field( "p50_us", s.p50_us )
+                .field( "p90_us", s.p90_us )
+                .field( "p99_us", s.p99_us )
+                .field( "p99_9_us", s.p999_us )
+                .field( "max_us", s.max_us )
+                .end_object();
+        }
+        out.end_array();
+        out.end_record();
+        return;
+    }
+
+    print( "Latency: {}, {} cycles ({} frame timeouts, {} late frames, {} missing events)\n", source, cfg.cycles, frame_timeouts, late_frames, missing_events );
+    print( 1, "{:34} {:>7} {:>9} {:>9} {:>9} {:>9} {:>9} {:>9} {:>9}\n", "Stage [us]", "Count", "Mean", "Min", "P50", "P90", "P99", "P99.9", "Max" );
+    for( auto&& stage : stages )
+    {
+        auto s = bench::summarize_intervals( stage.samples_us );
+        print( 1, "{:34} {:>7} {:9.1f} {:9.1f} {:9.1f} {:9.1f} {:9.1f} {:9.1f} {:9.1f}\n",
+            stage.name, s.count, s.mean_us, s.min_us, s.p50_us, s.p90_us, s.p99_us, s.p999_us, s.max_us );
+    }
+}
+
+// Fires TriggerSoftware once per cycle and measures when the trigger command returns, when the EventExposureEnd
+// notification arrives and when the frame is queued, the same mechanisms the event-exposure-end example uses.
+// The next trigger is only issued after the previous frame arrived, so cycles do not overlap. After a frame timeout,
+// a frame that still arrives within another timeout is counted as late and not attributed to the next cycle.
+static void run_latency( std::string id, const LatencyConfig& cfg )
+{
+    using clock = LatencyListener::clock;
+    auto us_between = []( clock::time_point a, clock::time_point b ) { return std::chrono::duration<double, std::micro>( b - a ).count(); };
+
+    auto dev = find_device( id );
+    if( !dev ) {
+        throw std::runtime_error( fmt::format( "Failed to find device for id '{}'", id ) );
+    }
+
+    // Declared before the grabber, so that it outlives the stream
+    LatencyListener listener;
+
+    ic4::Grabber g;
+    g.deviceOpen( *dev );
+    auto map = g.devicePropertyMap();
+
+    // Stops the stream and restores the trigger and event settings, also if a property access throws
+    struct RestoreSettings
+    {
+        ic4::Grabber& g;
+        ic4::PropertyMap& map;
+        std::string prev_trigger_mode;
+        ic4::Property event_exposure_end;
+        ic4::Property::NotificationToken token = {};
+        bool event_enabled = false;
+
+        RestoreSettings( ic4::Grabber& grabber, ic4::PropertyMap& prop_map, std::string trigger_mode )
+            : g( grabber ), map( prop_map ), prev_trigger_mode( std::move( trigger_mode ) )
+        {
+        }
+
+        ~RestoreSettings()
+        {
+            if( g.isStreaming() ) {
+                g.streamStop( ic4::Error::Ignore() );
+            }
+            if( event_enabled )
+            {
+                event_exposure_end.eventRemoveNotification( token, ic4::Error::Ignore() );
+                map.setValue( ic4::PropId::EventNotification, "Off", ic4::Error::Ignore() );
+            }
+            map.setValue( ic4::PropId::TriggerMode, prev_trigger_mode, ic4::Error::Ignore() );
+        }
+    } restore( g, map, map.getValueString( ic4::PropId::TriggerMode ) );
+
+    map.setValue( ic4::PropId::TriggerMode, "On" );
+
+    bool use_event = cfg.use_event;
+    if( use_event )
+    {
+        ic4::Error err;
+        restore.event_exposure_end = map.find( ic4::PropId::EventExposureEnd, err );
+        if( err.isError()
+            || !map.setValue( ic4::PropId::EventSelector, "ExposureEnd", err )
+            || !map.setValue( ic4::PropId::EventNotification, "On", err ) )
+        {
+            if( !output_is_json() ) {
+                print( "EventExposureEnd is not supported by the device, measuring without it\n" );
+            }
+            use_event = false;
+        }
+        else
+        {
+            restore.token = restore.event_exposure_end.eventAddNotification( [&listener]( ic4::Property& ) { listener.on_exposure_end(); } );
+            restore.event_enabled = true;
+        }
+    }
+
+    auto sink = ic4::QueueSink::create( listener );
+    g.streamSetup( sink, ic4::StreamSetupOption::AcquisitionStart );
+
+    std::vector<LatencyStage> stages = {
+        { "trigger command", {} },
+        { "trigger -> exposure end event", {} },
+        { "exposure end event -> frame", {} },
+        { "trigger -> frame", {} },
+    };
+    for( auto&& stage : stages ) {
+        stage.samples_us.reserve( cfg.cycles );
+    }
+
+    int frame_timeouts = 0;
+    int missing_events = 0;
+    int late_frames = 0;
+    for( int i = 0; i < cfg.warmup + cfg.cycles; ++i )
+    {
+        listener.reset();
+
+        auto trigger_begin = clock::now();
+        map.executeCommand( ic4::PropId::TriggerSoftware );
+        auto trigger_end = clock::now();
+
+        clock::time_point frame_time;
+        bool frame_ok = listener.wait_frame( std::chrono::milliseconds( cfg.timeout_ms ), frame_time );
+
+        // The event travels on a separate channel and can arrive after the frame
+        clock::time_point event_time;
+        bool event_ok = use_event && listener.wait_event( std::chrono::milliseconds( cfg.event_timeout_ms ), event_time );
+
+        if( !frame_ok )
+        {
+            // Wait for the frame of the timed out trigger once more, so that it is not taken for the frame of the next one
+            listener.reset();
+            clock::time_point late_time;
+            if( listener.wait_frame( std::chrono::milliseconds( cfg.timeout_ms ), late_time ) && i >= cfg.warmup ) {
+                late_frames += 1;
+            }
+        }
+
+        if( i < cfg.warmup ) {
+            continue;
+        }
+
+        stages[0].samples_us.push_back( us_between( trigger_begin, trigger_end ) );
+        if( !frame_ok ) {
+            frame_timeouts += 1;
+        } else {
+            stages[3].samples_us.push_back( us_between( trigger_begin, frame_time ) );
+        }
+        if( use_event )
+        {
+            if( !event_ok ) {
+                missing_events += 1;
+                continue;
+            }
+            stages[1].samples_us.push_back( us_between( trigger_begin, event_time ) );
+            if( frame_ok ) {
+                stages[2].samples_us.push_back( us_between( event_time, frame_time ) );
+            }
+        }
+    }
+
+    g.streamStop();
+
+    if( !use_event ) {
+        stages.erase( stages.begin() + 1, stages.begin() + 3 );
+    }
+
+    print_latency_result( fmt::format( "{} {}", dev->modelName(), dev->serial() ), cfg, stages, frame_timeouts, missing_events, late_frames );
+}
+
+// State of one device in run_clock_sync
+struct ClockSyncDevice
+{
+    std::string label;
+    std::unique_ptr<ic4::Grabber> grabber;
+    std::unique_ptr<ic4::PropertyMap> map;
+
+    // GigEVision devices without the SFNC timestamp features use GevTimestampControlLatch, counting in ticks
+    std::string latch_name;
+    std::string value_name;
+    double ns_per_tick = 1.0;
+
+    std::vector<clock_sync::sample> samples;
+    clock_sync::linear_fit fit;
+    std::string error;
+};
+
+static void print_clock_sync_result( const clock_sync::config& cfg, const std::vector<std::unique_ptr<ClockSyncDevice>>& devices )
+{
+    struct summary
+    {
+        double rms_us = 0;
+        double max_us = 0;
+        double latch_min_us = 0;
+        double latch_mean_us = 0;
+    };
+    auto summarize = []( const ClockSyncDevice& d )
+    {
+        summary s;
+        s.rms_us = d.fit.residual_rms_ns() / 1000.0;
+        s.latch_min_us = d.samples.empty() ? 0 : d.samples[0].latch_us;
+        for( auto&& smp : d.samples )
+        {
+            s.max_us = std::max( s.max_us, std::abs( d.fit.residual_ns( smp ) ) / 1000.0 );
+            s.latch_min_us = std::min( s.latch_min_us, smp.latch_us );
+            s.latch_mean_us += smp.latch_us / d.samples.size();
+        }
+        return s;
+    };
+
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        for( auto&& dev : devices )
+        {
+            out.begin_record().field( "device", dev->label );
+            if( !dev->error.empty() )
+            {
+                out.field( "error", dev->error );
+                out.end_record();
+                continue;
+            }
+            auto s = summarize( *dev );
+            out.field( "samples", dev->fit.count() )
+                .field( "interval_ms", cfg.interval_ms )
+                .field( "offset_ns", dev->fit.offset_ns() )
+                .field( "drift_ppm", dev->fit.drift_ppm() )
+                .field( "jitter_rms_us", s.rms_us )
+                .field( "jitter_max_us", s.max_us )
+                .field( "latch_min_us", s.latch_min_us )
+                .field( "latch_mean_us", s.latch_mean_us );
+            out.end_record();
+        }
         return;
     }
-    ic4::Grabber g;
-    g.deviceOpen( *dev );
-
-    auto snap_sink = ic4::SnapSink::create();
-    g.streamSetup( snap_sink, ic4::StreamSetupOption::AcquisitionStart );
 
-    ic4::Error err;
-    auto images = snap_sink->snapSequence( count, timeout_in_ms, err );
-    if( err ) {
-        if( err.code() == ic4::ErrorCode::Timeout ) {
-            print( "Timeout elapsed." );
-            // #TODO maybe dissect what to do here.
-            return;
+    print( "Clock sync: {} samples per device, {} ms apart\n", cfg.samples, cfg.interval_ms );
+    print( "device_timestamp_ns = offset_ns + (1 + drift_ppm / 1e6) * steady_clock_ns\n" );
+    print( 1, "{:32} {:>8} {:>22} {:>12} {:>12} {:>12} {:>12}\n", "Device", "Samples", "Offset [ns]", "Drift [ppm]", "Jitter [us]", "Max [us]", "Latch [us]" );
+    for( auto&& dev : devices )
+    {
+        if( !dev->error.empty() ) {
+            print( 1, "{:32} {}\n", dev->label, dev->error );
+            continue;
         }
-        throw err;
+        auto s = summarize( *dev );
+        print( 1, "{:32} {:>8} {:>22} {:12.3f} {:12.2f} {:12.2f} {:12.1f}\n",
+            dev->label, dev->fit.count(), dev->fit.offset_ns(), dev->fit.drift_ppm(), s.rms_us, s.max_us, s.latch_mean_us );
     }
+}
 
-    g.acquisitionStop();
+// Latches the timestamp of all devices cfg.samples times and fits offset and drift against steady_clock for each.
+// The host time of a sample is the middle of the latch command, its duration bounds the error and is reported as well.
+static void run_clock_sync( const std::vector<std::string>& ids, const clock_sync::config& cfg )
+{
+    using clock = std::chrono::steady_clock;
 
-    int idx = 0;
-    for( auto && image : images )
+    auto idx = load_device_index();
+    std::vector<std::unique_ptr<ClockSyncDevice>> devices;
+    for( auto e : resolve_device_ids( idx, ids ) )
     {
-        std::string actual_filename = filename;
-        if( filename.find_first_of( '{' ) != std::string::npos
-            && filename.find_first_of( '}' ) != std::string::npos )
+        auto dev = std::make_unique<ClockSyncDevice>();
+        dev->label = fmt::format( "{} {}", e->model_name, e->serial );
+        devices.push_back( std::move( dev ) );
+
+        auto& d = *devices.back();
+        auto info = idx.device_info( *e );
+        if( !info ) {
+            d.error = "Device is no longer available";
+            continue;
+        }
+        d.grabber = std::make_unique<ic4::Grabber>();
+        d.grabber->deviceOpen( *info );
+        d.map = std::make_unique<ic4::PropertyMap>( d.grabber->devicePropertyMap() );
+
+        ic4::Error err;
+        if( d.map->find( ic4::PropId::TimestampLatch, err ).is_valid() && !err.isError() )
         {
-            actual_filename = fmt::vformat( filename, fmt::make_format_args( idx ) );
-            idx++;
+            d.latch_name = ic4::PropId::TimestampLatch;
+            d.value_name = ic4::PropId::TimestampLatchValue;
         }
-        if( image_type == "bmp" ) {
-            ic4::imageBufferSaveAsBitmap( *image, actual_filename, {} );
+        else if( d.map->find( "GevTimestampControlLatch", err ).is_valid() && !err.isError() )
+        {
+            d.latch_name = "GevTimestampControlLatch";
+            d.value_name = "GevTimestampValue";
+            auto freq = d.map->getValueInt64( "GevTimestampTickFrequency", err );
+            if( !err.isError() && freq > 0 ) {
+                d.ns_per_tick = 1e9 / static_cast<double>( freq );
+            }
         }
-        else if( image_type == "png" ) {
-            ic4::imageBufferSaveAsPng( *image, actual_filename, {} );
+        else
+        {
+            d.error = "The device does not support TimestampLatch";
+            continue;
         }
-        else if( image_type == "tiff" ) {
-            ic4::imageBufferSaveAsTiff( *image, actual_filename, {} );
+        d.samples.reserve( cfg.samples );
+    }
+    if( devices.empty() ) {
+        throw std::runtime_error( "No devices are available" );
+    }
+
+    auto next = clock::now();
+    for( int i = 0; i < cfg.samples; ++i )
+    {
+        for( auto&& dev : devices )
+        {
+            auto& d = *dev;
+            if( !d.error.empty() ) {
+                continue;
+            }
+
+            ic4::Error err;
+            auto latch_begin = clock::now();
+            d.map->executeCommand( d.latch_name, err );
+            auto latch_end = clock::now();
+            if( err.isError() ) {
+                d.error = fmt::format( "Failed to latch the timestamp: {}", err.message() );
+                continue;
+            }
+            auto value = d.map->getValueInt64( d.value_name, err );
+            if( err.isError() ) {
+                d.error = fmt::format( "Failed to read the latched timestamp: {}", err.message() );
+                continue;
+            }
+
+            clock_sync::sample smp;
+            smp.host_ns = std::chrono::duration_cast<std::chrono::nanoseconds>( (latch_begin + (latch_end - latch_begin) / 2).time_since_epoch() ).count();
+            smp.device_ns = d.ns_per_tick == 1.0 ? value : static_cast<int64_t>( std::llround( value * d.ns_per_tick ) );
+            smp.latch_us = std::chrono::duration<double, std::micro>( latch_end - latch_begin ).count();
+            d.fit.add( smp.host_ns, smp.device_ns );
+            d.samples.push_back( smp );
         }
-        else if( image_type == "jpeg" ) {
-            ic4::imageBufferSaveAsJpeg( *image, actual_filename, {} );
+
+        next += std::chrono::milliseconds( cfg.interval_ms );
+        std::this_thread::sleep_until( next );
+    }
+
+    for( auto&& dev : devices )
+    {
+        if( dev->error.empty() && dev->fit.count() < 2 ) {
+            dev->error = "Not enough samples";
         }
     }
+    print_clock_sync_result( cfg, devices );
 }
 
 #ifdef WIN32
@@ -748,9 +2795,322 @@ static void show_prop_page(std::string id, bool id_is_interface, bool show_guru)
 
 #endif // WIN32
 
+#ifndef WIN32
+
+// Device kept open by `serve` across requests.
+// The stream is started on the first request that needs frames (or right away with `serve --stream`) and keeps running.
+class ServedDevice : public ic4::QueueSinkListener
+{
+    ic4::Grabber grabber_;
+    std::shared_ptr<ic4::QueueSink> sink_;
+
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    size_t capture_count_ = 0;
+    std::vector<std::shared_ptr<ic4::ImageBuffer>> captured_;
+
+    // Buffers allocated in addition to the sink's own. The sink keeps them for its lifetime, so they are reused by later requests.
+    size_t extra_buffers_ = 0;
+public:
+    // Largest number of frames one request can capture, it bounds the memory held by extra_buffers_
+    static const int max_capture_count = 64;
+
+    explicit ServedDevice( const ic4::DeviceInfo& dev )
+    {
+        grabber_.deviceOpen( dev );
+    }
+
+    ~ServedDevice()
+    {
+        // The grabber must not call into the listener after it was destroyed
+        grabber_.streamStop( ic4::Error::Ignore() );
+    }
+
+    ic4::Grabber& grabber() { return grabber_; }
+
+    void ensure_streaming()
+    {
+        if( sink_ ) {
+            return;
+        }
+        sink_ = ic4::QueueSink::create( *this );
+        grabber_.streamSetup( sink_, ic4::StreamSetupOption::AcquisitionStart );
+    }
+
+    // Stops and restarts the stream with the same sink, so that stream-locked properties can be changed
+    auto stream_control() -> ic4_helper::stream_control
+    {
+        ic4_helper::stream_control ctrl;
+        ctrl.is_streaming = [this] { return grabber_.isStreaming(); };
+        ctrl.stop = [this] { grabber_.streamStop(); };
+        ctrl.start = [this] { grabber_.streamSetup( sink_, ic4::StreamSetupOption::AcquisitionStart ); };
+        return ctrl;
+    }
+
+    void framesQueued( ic4::QueueSink& sink ) override
+    {
+        ic4::Error err;
+        while( true )
+        {
+            auto buffer = sink.popOutputBuffer( err );
+            if( buffer == nullptr ) {
+                return;
+            }
+
+            // Frames nobody asked for are requeued immediately
+            std::lock_guard<std::mutex> lck{ mtx_ };
+            if( captured_.size() < capture_count_ )
+            {
+                captured_.push_back( std::move( buffer ) );
+                cond_.notify_all();
+            }
+        }
+    }
+
+    // Collects the next count frames from the running stream. Throws if no frame arrived for timeout_in_ms.
+    auto capture( int count, int timeout_in_ms ) -> std::vector<std::shared_ptr<ic4::ImageBuffer>>
+    {
+        if( count > max_capture_count ) {
+            throw std::runtime_error( fmt::format( "Cannot capture more than {} images per request", max_capture_count ) );
+        }
+
+        ensure_streaming();
+
+        // All captured buffers are held until they are encoded, make sure the sink does not run dry meanwhile.
+        // Only the difference to the largest request so far is allocated, so the number of buffers stays bounded by max_capture_count.
+        size_t required = static_cast<size_t>( std::max( 0, count ) ) + 2;
+        if( required > extra_buffers_ )
+        {
+            sink_->allocAndQueueBuffers( required - extra_buffers_ );
+            extra_buffers_ = required;
+        }
+
+        std::unique_lock<std::mutex> lck{ mtx_ };
+        captured_.clear();
+        capture_count_ = static_cast<size_t>( std::max( 0, count ) );
+        while( captured_.size() < capture_count_ )
+        {
+            auto prev = captured_.size();
+            if( !cond_.wait_for( lck, std::chrono::milliseconds( timeout_in_ms ), [&] { return captured_.size() != prev; } ) )
+            {
+                capture_count_ = 0;
+                captured_.clear();
+                throw std::runtime_error( "Timeout elapsed." );
+            }
+        }
+        capture_count_ = 0;
+
+        std::vector<std::shared_ptr<ic4::ImageBuffer>> rval;
+        rval.swap( captured_ );
+        return rval;
+    }
+};
+
+class Server
+{
+    std::map<std::string, std::unique_ptr<ServedDevice>> devices_;
+    bool start_stream_;
+    bool shutdown_requested_ = false;
+public:
+    explicit Server( bool start_stream )
+        : start_stream_( start_stream )
+    {
+    }
+
+    bool shutdown_requested() const { return shutdown_requested_; }
+
+    // Devices are cached by the id the client used, so only the first request for an id pays for enumeration and open
+    auto open_device( const std::string& id ) -> ServedDevice&
+    {
+        auto it = devices_.find( id );
+        if( it != devices_.end() ) {
+            return *it->second;
+        }
+
+        auto dev = find_device( id );
+        if( !dev ) {
+            throw std::runtime_error( fmt::format( "Failed to find device for id '{}'", id ) );
+        }
+
+        auto served = std::make_unique<ServedDevice>( *dev );
+        if( start_stream_ ) {
+            served->ensure_streaming();
+        }
+        auto& rval = *served;
+        devices_[id] = std::move( served );
+        return rval;
+    }
+
+    // Executes a request forwarded by the client, see forward_to_server(). The output is written through print().
+    int handle( const std::vector<std::string>& fields )
+    {
+        const auto& cmd = fields.at( 0 );
+        if( cmd == "shutdown" )
+        {
+            shutdown_requested_ = true;
+            print( "Server is shutting down\n" );
+            return 0;
+        }
+
+        auto& dev = open_device( fields.at( 1 ) );
+        if( cmd == "prop" )
+        {
+            auto map = dev.grabber().devicePropertyMap();
+            print_or_set_PropertyMap_entries( map, std::vector<std::string>( fields.begin() + 2, fields.end() ) );
+        }
+        else if( cmd == "prop-apply" )
+        {
+            std::string batch;
+            for( auto it = fields.begin() + 2; it != fields.end(); ++it ) {
+                batch += *it + "\n";
+            }
+            auto map = dev.grabber().devicePropertyMap();
+            auto ctrl = dev.stream_control();
+            apply_prop_batch( map, batch, &ctrl );
+        }
+        else if( cmd == "save-prop" )
+        {
+            dev.grabber().devicePropertyMap().serialize( fields.at( 2 ) );
+        }
+        else if( cmd == "image" )
+        {
+            SaveImageOptions opt;
+            opt.filename = fields.at( 2 );
+            opt.count = std::stoi( fields.at( 3 ) );
+            opt.timeout_in_ms = std::stoi( fields.at( 4 ) );
+            opt.image_type = fields.at( 5 );
+            opt.jobs = std::stoi( fields.at( 6 ) );
+            opt.fsync = fields.at( 7 ) == "1";
+            check_image_filename( opt.filename );
+
+            auto snap_begin = std::chrono::steady_clock::now();
+            auto images = dev.capture( opt.count, opt.timeout_in_ms );
+            encode_images( images, opt, std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - snap_begin ).count() );
+        }
+        else if( cmd == "stats" )
+        {
+            dev.ensure_streaming();
+            auto stats = to_bench_counters( dev.grabber().streamStatistics() );
+            if( output_is_json() )
+            {
+                output::record_writer out{ output_format, write_output };
+                out.begin_record();
+                bench::for_each_counter( stats, [&out]( const char* name, uint64_t value ) {
+                    out.field( name, value );
+                } );
+                out.end_record();
+            }
+            else
+            {
+                bench::for_each_counter( stats, []( const char* name, uint64_t value ) {
+                    print( "{:26} {}\n", name, value );
+                } );
+            }
+        }
+        else
+        {
+            throw std::runtime_error( fmt::format( "Unknown request '{}'", cmd ) );
+        }
+        return 0;
+    }
+};
+
+static volatile sig_atomic_t serve_stop_requested = 0;
+
+static void serve_signal_handler( int )
+{
+    serve_stop_requested = 1;
+}
+
+static void run_server( const std::string& socket_path, const std::vector<std::string>& device_ids, bool start_stream )
+{
+    // No SA_RESTART, so that accept() returns when the server is interrupted
+    struct sigaction sa = {};
+    sa.sa_handler = serve_signal_handler;
+    ::sigaction( SIGINT, &sa, nullptr );
+    ::sigaction( SIGTERM, &sa, nullptr );
+
+    Server server( start_stream );
+    for( auto&& id : device_ids ) {
+        server.open_device( id );
+    }
+
+    auto listen_socket = ipc::listen_socket( socket_path );
+    print( "Serving {} device(s) on '{}'\n", device_ids.size(), socket_path );
+    std::fflush( stdout );
+
+    while( !serve_stop_requested && !server.shutdown_requested() )
+    {
+        ipc::socket_handle conn{ ::accept( listen_socket.fd(), nullptr, nullptr ) };
+        if( !conn.valid() )
+        {
+            if( errno == EINTR ) {
+                continue;
+            }
+            throw std::runtime_error( fmt::format( "Failed to accept connection: {}", std::strerror( errno ) ) );
+        }
+
+        // Requests are served one at a time, a client that does not send its request must not block the others
+        ipc::set_timeout( conn.fd(), 5000 );
+
+        std::string request;
+        if( !ipc::read_line( conn.fd(), request ) ) {
+            continue;
+        }
+
+        fmt::memory_buffer output;
+        int exit_code = 0;
+        print_capture = &output;
+        try
+        {
+            // The first field is the client's --format, so the output looks as if the command ran in the client
+            auto fields = ipc::split_fields( request );
+            if( !output::parse_format( fields.at( 0 ), output_format ) ) {
+                throw std::runtime_error( fmt::format( "Unknown output format '{}'", fields.at( 0 ) ) );
+            }
+            fields.erase( fields.begin() );
+            exit_code = server.handle( fields );
+        }
+        catch( const std::exception& ex )
+        {
+            print( "Error: {}\n", ex.what() );
+            exit_code = 1;
+        }
+        print_capture = nullptr;
+
+        ipc::write_response( conn.fd(), exit_code, output.data(), output.size() );
+    }
+
+    ::unlink( socket_path.c_str() );
+}
+
+static int forward_to_server( const std::string& socket_path, const std::vector<std::string>& request )
+{
+    try
+    {
+        std::string output;
+        int exit_code = ipc::call( socket_path, request, output );
+        std::fwrite( output.data(), 1, output.size(), stdout );
+        return exit_code;
+    }
+    catch( const std::exception& ex )
+    {
+        fmt::print( stderr, "Error: {}\n", ex.what() );
+        return 1;
+    }
+}
+
+#endif // WIN32
+
 static void show_version()
 {
     auto str = ic4::getVersionInfo();
+    if( str.empty() && !library_initialized )
+    {
+        // Some versions only report after initialization
+        ensure_library_initialized();
+        str = ic4::getVersionInfo();
+    }
 
     if (str.empty())
     {
@@ -758,6 +3118,14 @@ static void show_version()
         return;
     }
 
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        out.begin_record().field( "version_info", str );
+        out.end_record();
+        return;
+    }
+
     print("{}", str);
 
 }
@@ -766,6 +3134,13 @@ static void show_version()
 static void show_system_info()
 {
     auto env_var = helper::get_env_var( "GENICAM_GENTL64_PATH" );
+    if( output_is_json() )
+    {
+        output::record_writer out{ output_format, write_output };
+        out.begin_record().begin_object( "environment" ).field( "GENICAM_GENTL64_PATH", env_var ).end_object();
+        out.end_record();
+        return;
+    }
     print( 0, "Environment:\n" );
     print( 1, "GENICAM_GENTL64_PATH: {}\n", env_var );
 }
@@ -779,12 +3154,39 @@ int main( int argc, char** argv )
     std::string gentl_path = helper::get_env_var( "GENICAM_GENTL64_PATH" );
     app.add_option( "--gentl-path", gentl_path, "GenTL path environment variable to set." )->default_val( gentl_path );
 
+    std::string server_socket = helper::get_env_var( "IC4_CTRL_SERVER" );
+#ifndef WIN32
+    app.add_option( "--server", server_socket,
+        "Forward prop, save-prop, image and stats to an 'ic4-ctrl serve' instance listening on this socket. Defaults to the IC4_CTRL_SERVER environment variable." );
+#endif
+
+    std::string format_name = "text";
+    app.add_option( "--format", format_name,
+        "Output format of the reporting commands. 'json' writes all records of a command as one array, 'ndjson' writes one object per line. "
+        "bench writes its result object in both modes." )
+        ->check( CLI::IsMember( { "text", "json", "ndjson" } ) )->default_val( format_name );
+
+    int64_t cache_ttl = 0;
+    helper::from_chars_helper( helper::get_env_var( "IC4_CTRL_CACHE_TTL" ), cache_ttl );
+    app.add_option( "--cache-ttl", cache_ttl,
+        "Keep the device list in a discovery cache file for this many seconds, so consecutive calls skip device discovery. "
+        "0 disables the cache. Defaults to the IC4_CTRL_CACHE_TTL environment variable." )->default_val( cache_ttl );
+    std::string cache_file = device_index::default_cache_filename();
+    app.add_option( "--cache-file", cache_file, "Discovery cache file used with --cache-ttl." )->default_val( cache_file );
+
+    bool print_timing = false;
+    app.add_flag( "--timing", print_timing,
+        "Print a breakdown of the run time (command line parsing, library initialization, discovery cache, device enumeration) to stderr." );
+
     std::string arg_device_id;
     bool force_interface = false;
 
     auto list_cmd = app.add_subcommand( "list",
         "List available devices and interfaces by connection."
     );
+    int list_timeout_ms = 10000;
+    list_cmd->add_option( "--timeout", list_timeout_ms,
+        "Timeout in ms for the device enumeration of each interface. The interfaces are enumerated concurrently." )->default_val( list_timeout_ms );
 
     auto list_serial = app.add_subcommand( "list-serial",
         "List only serials of available devices."
@@ -817,6 +3219,10 @@ int main( int argc, char** argv )
         "If set the <device-id> is interpreted as an interface-id." );
     props_cmd->add_option( "device-id", arg_device_id,
         "Specifies the device to open. You can specify an index e.g. '0'." )->required();
+    std::string prop_apply_filename;
+    props_cmd->add_option( "--apply", prop_apply_filename,
+        "Apply all 'Name=Value' lines of this file ('-' for stdin) as one batch. Format properties are applied first, "
+        "a running stream is stopped at most once and everything is rolled back if an assignment fails." );
 
     auto save_props_cmd = app.add_subcommand( "save-prop", 
         "Save properties for the specified device 'ic4-ctrl save-prop -f <filename> <device-id>'." );
@@ -825,17 +3231,94 @@ int main( int argc, char** argv )
     save_props_cmd->add_option( "device-id", arg_device_id,
         "Specifies the device to open. You can specify an index e.g. '0'." )->required();
 
+    auto diff_props_cmd = app.add_subcommand( "diff-prop",
+        "Compare the properties of the specified device with a file written by save-prop 'ic4-ctrl diff-prop -f <filename> <device-id>'.\n"
+        "\tOnly differing values are listed, the exit code is 1 if any value differs and 2 if the comparison failed." );
+    std::string diff_filename;
+    diff_props_cmd->add_option( "-f,--filename", diff_filename, "File written by save-prop." )->required();
+    diff_props_cmd->add_flag( "--interface", force_interface,
+        "If set the <device-id> is interpreted as an interface-id." );
+    diff_props_cmd->add_option( "device-id", arg_device_id,
+        "Specifies the device to open. You can specify an index e.g. '0'." )->required();
+
     auto image_cmd = app.add_subcommand( "image", 
-        "Save one or more images from the specified device 'ic4-ctrl image -f <filename> --count 3 --timeout 2000 --type bmp <device-id>'."
+        "Save one or more images from the specified device 'ic4-ctrl image -f <filename> --count 3 --timeout 2000 --type bmp <device-id>'.\n"
+        "\tTo capture from several devices at once 'ic4-ctrl image -f cam-{serial}-{}.bmp --count 3 all'."
     );
-    int count = 1;
-    int timeout = 1000;
-    std::string image_type = "bmp";
-    image_cmd->add_option( "-f,--filename", arg_filename, "Filename. Use '{}' to specify where a counter should be placed (e.g. 'test-{}.bmp'." )->required();
-    image_cmd->add_option( "--count", count, "Count of frames to capture." )->default_val( count );
-    image_cmd->add_option( "--timeout", timeout, "Timeout in milliseconds." )->default_val( timeout );
-    image_cmd->add_option( "--type", image_type, "Image file type to save. [bmp,png,jpeg,tiff]" )->default_val( image_type );
-    image_cmd->add_option( "device-id", arg_device_id,
+    SaveImageOptions image_opt;
+    image_cmd->add_option( "-f,--filename", image_opt.filename, "Filename. Use '{}' to specify where a counter should be placed (e.g. 'test-{}.bmp'." )->required();
+    image_cmd->add_option( "--count", image_opt.count, "Count of frames to capture." )->default_val( image_opt.count );
+    image_cmd->add_option( "--timeout", image_opt.timeout_in_ms, "Timeout in milliseconds." )->default_val( image_opt.timeout_in_ms );
+    image_cmd->add_option( "--type", image_opt.image_type, "Image file type to save. [bmp,png,jpeg,tiff]" )->default_val( image_opt.image_type );
+    image_cmd->add_option( "--jobs", image_opt.jobs,
+        "Number of encoder threads. 0 uses one thread per CPU core." )->default_val( image_opt.jobs );
+    image_cmd->add_flag( "--fsync", image_opt.fsync,
+        "Flush every written file to disk before it is counted as encoded." );
+    image_cmd->add_flag( "--stream", image_opt.stream,
+        "Encode frames while they arrive instead of capturing the whole sequence into memory first. Memory use does not grow with --count." );
+    image_cmd->add_option( "--queue-depth", image_opt.queue_depth,
+        "Maximum number of frames waiting for an encoder in --stream mode. Frames arriving while the queue is full are dropped." )->default_val( image_opt.queue_depth );
+    std::vector<std::string> image_device_ids;
+    image_cmd->add_option( "device-id", image_device_ids,
+        "Specifies the devices to open. You can specify an index e.g. '0', several ids or 'all'. "
+        "Several devices are opened and captured concurrently, use '{serial}' or '{model}' in the filename to name the files per device, "
+        "otherwise '_{serial}' is added before the extension." )->required();
+
+    auto bench_cmd = app.add_subcommand( "bench",
+        "Stream into a QueueSink for a duration and report frame rate, throughput, frame interval jitter and stream statistics.\n"
+        "\tTo benchmark a device 'ic4-ctrl bench --duration 10 <device-id>'.\n"
+        "\tTo benchmark without a device 'ic4-ctrl bench --synthetic --fps 500 --width 1920 --height 1080 --json result.json'."
+    );
+    bench::config bench_cfg;
+    bench_cmd->add_option( "--duration", bench_cfg.duration_s, "Benchmark duration in seconds." )->default_val( bench_cfg.duration_s );
+    bench_cmd->add_option( "--interval", bench_cfg.sample_interval_ms, "Stream statistics sample interval in milliseconds." )->default_val( bench_cfg.sample_interval_ms );
+    bench_cmd->add_option( "--buffers", bench_cfg.num_buffers, "Number of sink buffers to allocate. 0 uses the sink default (8 for --synthetic)." )->default_val( bench_cfg.num_buffers );
+    bench_cmd->add_option( "--json", bench_cfg.json_filename, "Write the results as JSON into this file. Use '-' to only write JSON to stdout." );
+    bench_cmd->add_flag( "--synthetic", bench_cfg.synthetic, "Use an in-process synthetic Mono8 frame source instead of a device." );
+    bench_cmd->add_option( "--fps", bench_cfg.synthetic_fps, "Frame rate of the synthetic source." )->check( CLI::PositiveNumber )->default_val( bench_cfg.synthetic_fps );
+    bench_cmd->add_option( "--width", bench_cfg.synthetic_width, "Frame width of the synthetic source." )->default_val( bench_cfg.synthetic_width );
+    bench_cmd->add_option( "--height", bench_cfg.synthetic_height, "Frame height of the synthetic source." )->default_val( bench_cfg.synthetic_height );
+    bench_cmd->add_option( "device-id", arg_device_id,
+        "Specifies the device to open. You can specify an index e.g. '0'. Not required with --synthetic." );
+
+    auto watch_cmd = app.add_subcommand( "watch",
+        "Print property changes as they are notified by the device, and optionally stream statistics, until Ctrl-C.\n"
+        "\tTo watch properties 'ic4-ctrl watch <device-id> DeviceTemperature ExposureTime'.\n"
+        "\tTo also stream and watch the stream statistics 'ic4-ctrl watch --stream <device-id> DeviceTemperature'."
+    );
+    watch::config watch_cfg;
+    watch_cmd->add_flag( "--stream", watch_cfg.stream, "Start a stream and print the stream statistics deltas." );
+    watch_cmd->add_option( "--duration", watch_cfg.duration_s, "Stop after this many seconds, 0 runs until Ctrl-C." )->default_val( watch_cfg.duration_s );
+    watch_cmd->add_option( "--max-rate", watch_cfg.max_rate_hz, "Maximum number of output batches per second. Changes in between are coalesced." )->default_val( watch_cfg.max_rate_hz );
+    watch_cmd->add_option( "--stats-interval", watch_cfg.stats_interval_ms, "Stream statistics interval in milliseconds." )->default_val( watch_cfg.stats_interval_ms );
+    watch_cmd->add_option( "--ring-size", watch_cfg.ring_capacity, "Number of property events buffered between two output batches." )->default_val( watch_cfg.ring_capacity );
+    watch_cmd->add_option( "device-id", arg_device_id,
+        "Specifies the device to open. You can specify an index e.g. '0'." )->required();
+    watch_cmd->add_option( "properties", watch_cfg.properties, "Properties to watch." );
+
+    auto clock_sync_cmd = app.add_subcommand( "clock-sync",
+        "Estimate offset and drift of the device clocks against the host steady_clock 'ic4-ctrl clock-sync --samples 100 <device-id>...'.\n"
+        "\tUses TimestampLatch, the result maps ImageBuffer device timestamps to host time." );
+    clock_sync::config clock_sync_cfg;
+    std::vector<std::string> clock_sync_device_ids;
+    clock_sync_cmd->add_option( "--samples", clock_sync_cfg.samples, "Number of timestamp latches per device." )->default_val( clock_sync_cfg.samples )->check( CLI::Range( 2, 1000000 ) );
+    clock_sync_cmd->add_option( "--interval", clock_sync_cfg.interval_ms, "Time in ms between two latches." )->default_val( clock_sync_cfg.interval_ms )->check( CLI::PositiveNumber );
+    clock_sync_cmd->add_option( "device-id", clock_sync_device_ids,
+        "Specifies the devices to open. You can specify an index e.g. '0', several ids or 'all'." )->required();
+
+    auto latency_cmd = app.add_subcommand( "latency",
+        "Measure trigger-to-frame latency with software triggers, broken down by the EventExposureEnd notification.\n"
+        "\t'ic4-ctrl latency --cycles 5000 <device-id>'.\n"
+        "\tTriggerMode is set to On for the duration of the measurement."
+    );
+    LatencyConfig latency_cfg;
+    latency_cmd->add_option( "--cycles", latency_cfg.cycles, "Number of measured trigger cycles." )->check( CLI::NonNegativeNumber )->default_val( latency_cfg.cycles );
+    latency_cmd->add_option( "--warmup", latency_cfg.warmup, "Number of cycles to run before measuring." )->check( CLI::NonNegativeNumber )->default_val( latency_cfg.warmup );
+    latency_cmd->add_option( "--timeout", latency_cfg.timeout_ms, "Time in ms to wait for each frame." )->default_val( latency_cfg.timeout_ms );
+    latency_cmd->add_option( "--event-timeout", latency_cfg.event_timeout_ms, "Time in ms to wait for the EventExposureEnd notification after the frame." )->default_val( latency_cfg.event_timeout_ms );
+    bool latency_no_event = false;
+    latency_cmd->add_flag( "--no-event", latency_no_event, "Do not enable EventExposureEnd, only measure trigger to frame." );
+    latency_cmd->add_option( "device-id", arg_device_id,
         "Specifies the device to open. You can specify an index e.g. '0'." )->required();
 #ifdef WIN32
 
@@ -852,6 +3335,34 @@ int main( int argc, char** argv )
 	show_prop_page_cmd->add_flag("-g,--guru", show_default_guru,
 		"Start the dialog with Visibility set to ic4::PropVisibility::Guru.");
 
+#endif // WIN32
+
+#ifndef WIN32
+
+    auto serve_cmd = app.add_subcommand( "serve",
+        "Keep devices open and answer requests forwarded by 'ic4-ctrl --server <socket> ...' over a Unix domain socket.\n"
+        "\tTo start the server: 'ic4-ctrl serve --socket /tmp/ic4-ctrl.sock 0'.\n"
+        "\tTo forward a command: 'ic4-ctrl --server /tmp/ic4-ctrl.sock prop 0 ExposureTime=1000'.\n"
+        "\tTo stop the server: 'ic4-ctrl --server /tmp/ic4-ctrl.sock shutdown'."
+    );
+    std::string serve_socket = "/tmp/ic4-ctrl.sock";
+    bool serve_stream = false;
+    std::vector<std::string> serve_device_ids;
+    serve_cmd->add_option( "--socket", serve_socket, "Path of the Unix domain socket to listen on." )->default_val( serve_socket );
+    serve_cmd->add_flag( "--stream", serve_stream, "Start streaming as soon as a device is opened instead of on the first image or stats request." );
+    serve_cmd->add_option( "device-id", serve_device_ids,
+        "Devices to open at startup. Further devices are opened on their first request and stay open." );
+
+    auto stats_cmd = app.add_subcommand( "stats",
+        "Print the stream statistics of a device kept open by 'ic4-ctrl serve'. Requires --server."
+    );
+    stats_cmd->add_option( "device-id", arg_device_id,
+        "Specifies the device. You can specify an index e.g. '0'." )->required();
+
+    auto shutdown_cmd = app.add_subcommand( "shutdown",
+        "Stop the 'ic4-ctrl serve' instance given by --server."
+    );
+
 #endif // WIN32
 
     auto system_cmd = app.add_subcommand( "system",
@@ -864,29 +3375,93 @@ int main( int argc, char** argv )
 
     try
     {
+        auto parse_begin = std::chrono::steady_clock::now();
         app.parse( argc, argv );
+        startup_timing.parse_ms = ms_since( parse_begin );
+
+        // The batch replaces the Name=Value arguments, silently ignoring them would apply only part of what was asked for
+        if( props_cmd->parsed() && !prop_apply_filename.empty() && !props_cmd->remaining().empty() ) {
+            throw CLI::ValidationError( "--apply", "Cannot be combined with property names or Name=Value arguments" );
+        }
     }
     catch( const CLI::ParseError& e )
     {
         return app.exit( e );
     }
 
+    output::parse_format( format_name, output_format );
+
+#ifndef WIN32
+    // Forwarded commands are executed by the server, the client does not need to initialize the library at all
+    if( !server_socket.empty() )
+    {
+        std::vector<std::string> request;
+        if( props_cmd->parsed() && !force_interface && !prop_apply_filename.empty() )
+        {
+            // The batch is read by the client, so '-' still means the client's stdin
+            request = { "prop-apply", arg_device_id };
+            std::istringstream batch( read_prop_batch_file( prop_apply_filename ) );
+            std::string line;
+            while( std::getline( batch, line ) ) {
+                request.push_back( line );
+            }
+        }
+        else if( props_cmd->parsed() && !force_interface )
+        {
+            request = { "prop", arg_device_id };
+            for( auto&& entry : props_cmd->remaining() ) {
+                request.push_back( entry );
+            }
+        }
+        else if( save_props_cmd->parsed() && !force_interface )
+        {
+            request = { "save-prop", arg_device_id, helper::absolute_path( arg_filename ) };
+        }
+        else if( image_cmd->parsed() )
+        {
+            if( image_device_ids.size() != 1 || image_device_ids[0] == "all" ) {
+                fmt::print( stderr, "Error: --server only supports a single device-id for image\n" );
+                return 1;
+            }
+            request = { "image", image_device_ids[0], helper::absolute_path( image_opt.filename ), std::to_string( image_opt.count ),
+                std::to_string( image_opt.timeout_in_ms ), image_opt.image_type, std::to_string( image_opt.jobs ), image_opt.fsync ? "1" : "0" };
+        }
+        else if( stats_cmd->parsed() )
+        {
+            request = { "stats", arg_device_id };
+        }
+        else if( shutdown_cmd->parsed() )
+        {
+            request = { "shutdown" };
+        }
+
+        if( !request.empty() ) {
+            request.insert( request.begin(), output::to_string( output_format ) );
+            return forward_to_server( server_socket, request );
+        }
+    }
+#endif // WIN32
+
     if( !gentl_path.empty() ) {
         helper::set_env_var( "GENICAM_GENTL64_PATH", gentl_path );
     }
 
-    ic4::InitLibraryConfig config =
-    {
-        ic4::ErrorHandlerBehavior::Throw,
-        ic4::LogLevel::Off
-    };
-    ic4::initLibrary(config);
+    device_cache_ttl_s = static_cast<int>( cache_ttl );
+    device_cache_filename = cache_file;
 
+    int exit_code = 0;
+    auto command_begin = std::chrono::steady_clock::now();
     try
     {
+        // These commands initialize the library on demand, if at all
+        bool lazy_init = list_serial->parsed() || system_cmd->parsed() || version_cmd->parsed();
+        if( !lazy_init ) {
+            ensure_library_initialized();
+        }
+
         if( list_cmd->parsed() )
         {
-			list_all_by_connection();
+			list_all_by_connection( std::chrono::milliseconds( list_timeout_ms ) );
         }
         else if ( list_serial->parsed() )
         {
@@ -910,14 +3485,53 @@ int main( int argc, char** argv )
         }
         else if( props_cmd->parsed() )
         {
-            exec_prop_cmd( arg_device_id, force_interface, props_cmd->remaining() );
+            exec_prop_cmd( arg_device_id, force_interface, props_cmd->remaining(), prop_apply_filename );
         }
         else if( save_props_cmd->parsed() )
         {
             save_properties( arg_device_id, force_interface, arg_filename );
         }
+        else if( diff_props_cmd->parsed() )
+        {
+            if( !diff_properties( arg_device_id, force_interface, diff_filename ) ) {
+                exit_code = 1;
+            }
+        }
         else if( image_cmd->parsed() ) {
-            save_image( arg_device_id, arg_filename, count, timeout, image_type );
+            bool multi_device = image_device_ids.size() > 1 || image_device_ids[0] == "all";
+            if( multi_device && image_opt.stream ) {
+                throw std::runtime_error( "--stream supports a single device-id" );
+            }
+            if( multi_device ) {
+                save_image_multi( image_device_ids, image_opt );
+            } else if( image_opt.stream ) {
+                save_image_streaming( image_device_ids[0], image_opt );
+            } else {
+                save_image( image_device_ids[0], image_opt );
+            }
+        }
+        else if( bench_cmd->parsed() )
+        {
+            if( !bench_cfg.synthetic && arg_device_id.empty() ) {
+                throw std::runtime_error( "bench requires a <device-id> or --synthetic" );
+            }
+            run_bench( arg_device_id, bench_cfg );
+        }
+        else if( watch_cmd->parsed() )
+        {
+            if( watch_cfg.properties.empty() && !watch_cfg.stream ) {
+                throw std::runtime_error( "watch requires at least one property or --stream" );
+            }
+            run_watch( arg_device_id, watch_cfg );
+        }
+        else if( clock_sync_cmd->parsed() )
+        {
+            run_clock_sync( clock_sync_device_ids, clock_sync_cfg );
+        }
+        else if( latency_cmd->parsed() )
+        {
+            latency_cfg.use_event = !latency_no_event;
+            run_latency( arg_device_id, latency_cfg );
         }
 #ifdef WIN32
         else if( live_cmd->parsed() )
@@ -928,6 +3542,16 @@ int main( int argc, char** argv )
         {
             show_prop_page(arg_device_id, force_interface, show_default_guru);
         }
+#endif // WIN32
+#ifndef WIN32
+        else if( serve_cmd->parsed() )
+        {
+            run_server( serve_socket, serve_device_ids, serve_stream );
+        }
+        else if( stats_cmd->parsed() || shutdown_cmd->parsed() )
+        {
+            throw std::runtime_error( "This command requires --server <socket>" );
+        }
 #endif // WIN32
         else if( system_cmd->parsed() )
         {
@@ -946,9 +3570,43 @@ int main( int argc, char** argv )
     catch( const std::exception& ex )
     {
         fmt::print( stderr, "Error: {}\n", ex.what() );
+        if( diff_props_cmd->parsed() ) {
+            exit_code = 2;
+        }
+    }
+
+    auto command_ms = ms_since( command_begin );
+
+    double exit_library_ms = 0;
+    if( library_initialized && !enumeration_abandoned )
+    {
+        auto exit_begin = std::chrono::steady_clock::now();
+        ic4::exitLibrary();
+        exit_library_ms = ms_since( exit_begin );
+    }
+
+    if( print_timing )
+    {
+        auto& t = startup_timing;
+        auto lib = [&]( double ms ) { return library_initialized ? fmt::format( "{:.1f} ms", ms ) : std::string( "skipped" ); };
+        auto exit_lib = enumeration_abandoned ? std::string( "skipped (device enumeration still running)" ) : lib( exit_library_ms );
+        fmt::print( stderr, "Timing:\n" );
+        fmt::print( stderr, "    Command line parsing: {:.1f} ms\n", t.parse_ms );
+        fmt::print( stderr, "    initLibrary:          {}\n", lib( t.init_library_ms ) );
+        fmt::print( stderr, "    Cache load:           {:.1f} ms\n", t.cache_load_ms );
+        fmt::print( stderr, "    Device enumeration:   {:.1f} ms\n", t.enumerate_ms );
+        fmt::print( stderr, "    Command:              {:.1f} ms\n", command_ms - t.init_library_ms - t.cache_load_ms - t.enumerate_ms );
+        fmt::print( stderr, "    exitLibrary:          {}\n", exit_lib );
+        fmt::print( stderr, "    Total:                {:.1f} ms\n", ms_since( t.begin ) );
     }
 
-	ic4::exitLibrary();
+    if( enumeration_abandoned )
+    {
+        // Do not run static destructors below the detached enumeration threads either
+        std::fflush( stdout );
+        std::fflush( stderr );
+        std::quick_exit( exit_code );
+    }
 
-	return 0;
+	return exit_code;
 }
@@ -2,32 +2,619 @@
 #include <ic4/ic4.h>
 
 #include <console-helper.h>
+#include <spsc-queue.h>
+
+#include "timestamp-sidecar.h"
 
 #include <iostream>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Passes image buffers to a VideoWriter (or a SegmentedRecorder, see below) on a dedicated writer thread.
+// The sink callback only pushes the buffer into a bounded queue, so an encoder stall never delays the return of buffers
+// to the sink. A buffer goes back to the sink's free queue when the writer thread releases it after addFrame.
+// Each buffer is queued together with its host arrival time (see timestamp_sidecar::host_time_ns).
+class FrameWriter
+{
+public:
+	using AddFrameFunction = std::function<bool(const std::shared_ptr<ic4::ImageBuffer>& buffer, int64_t host_arrival_ns, ic4::Error& err)>;
+
+	struct Statistics
+	{
+		uint64_t frames_written;
+		uint64_t queue_full_drops;
+		size_t queue_high_water_mark;
+		double encode_ms_mean;
+		double encode_ms_max;
+	};
+
+private:
+	struct QueuedFrame
+	{
+		std::shared_ptr<ic4::ImageBuffer> buffer;
+		int64_t host_arrival_ns;
+	};
+
+	AddFrameFunction add_frame_;
+	ic4_examples::spsc_queue<QueuedFrame> queue_;
+
+	std::atomic<bool> stop_requested_;
+	std::atomic<int> pending_;
+	std::thread thread_;
+
+	std::atomic<uint64_t> frames_written_;
+	std::atomic<uint64_t> queue_full_drops_;
+	std::atomic<uint64_t> encode_ns_total_;
+	std::atomic<uint64_t> encode_ns_max_;
+
+	void thread_proc()
+	{
+		while (!stop_requested_)
+		{
+			QueuedFrame frame = {};
+			if (!queue_.pop_wait(frame, std::chrono::milliseconds(10)))
+			{
+				continue;
+			}
+
+			auto begin = std::chrono::steady_clock::now();
+
+			ic4::Error err;
+			if (!add_frame_(frame.buffer, frame.host_arrival_ns, err))
+			{
+				std::cerr << "Failed to add frame to video file: " << err.message() << std::endl;
+			}
+			else
+			{
+				frames_written_ += 1;
+			}
+
+			// Return the buffer to the sink before doing anything else
+			frame.buffer.reset();
+
+			auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+			encode_ns_total_ += ns;
+			if (ns > encode_ns_max_)
+			{
+				encode_ns_max_ = ns;
+			}
+
+			pending_ -= 1;
+		}
+	}
+
+public:
+	FrameWriter(ic4::VideoWriter& writer, size_t queue_depth)
+		: FrameWriter([&writer](const std::shared_ptr<ic4::ImageBuffer>& buffer, int64_t, ic4::Error& err) { return writer.addFrame(buffer, err); }, queue_depth)
+	{
+	}
+
+	FrameWriter(AddFrameFunction add_frame, size_t queue_depth)
+		: add_frame_(std::move(add_frame))
+		, queue_(queue_depth)
+		, stop_requested_(false)
+		, pending_(0)
+		, frames_written_(0)
+		, queue_full_drops_(0)
+		, encode_ns_total_(0)
+		, encode_ns_max_(0)
+	{
+		thread_ = std::thread([this] { thread_proc(); });
+	}
+
+	~FrameWriter()
+	{
+		stop_requested_ = true;
+		thread_.join();
+	}
+
+	size_t queue_depth() const
+	{
+		return queue_.capacity();
+	}
+
+	// Called from the sink callback. If the queue is full, the frame is dropped and counted.
+	bool push(std::shared_ptr<ic4::ImageBuffer> buffer, int64_t host_arrival_ns)
+	{
+		pending_ += 1;
+		if (!queue_.try_push({ std::move(buffer), host_arrival_ns }))
+		{
+			pending_ -= 1;
+			queue_full_drops_ += 1;
+			return false;
+		}
+		return true;
+	}
+
+	// Like push, but a frame that does not fit is neither moved nor counted as dropped
+	bool try_push(std::shared_ptr<ic4::ImageBuffer>& buffer, int64_t host_arrival_ns)
+	{
+		pending_ += 1;
+		QueuedFrame frame = { buffer, host_arrival_ns };
+		if (!queue_.try_push(std::move(frame)))
+		{
+			pending_ -= 1;
+			return false;
+		}
+		buffer.reset();
+		return true;
+	}
+
+	void count_drop()
+	{
+		queue_full_drops_ += 1;
+	}
+
+	// Waits until all queued frames were passed to the video writer. Call before VideoWriter::finishFile.
+	void flush()
+	{
+		while (pending_ > 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	void reset_statistics()
+	{
+		frames_written_ = 0;
+		queue_full_drops_ = 0;
+		encode_ns_total_ = 0;
+		encode_ns_max_ = 0;
+		queue_.reset_high_water_mark();
+	}
 
-// Define QueueSinkListener-derived class that can add the received frames into a video writer
+	Statistics statistics() const
+	{
+		Statistics stats = {};
+		stats.frames_written = frames_written_;
+		stats.queue_full_drops = queue_full_drops_;
+		stats.queue_high_water_mark = queue_.high_water_mark();
+		stats.encode_ms_mean = stats.frames_written ? encode_ns_total_ / 1e6 / stats.frames_written : 0.0;
+		stats.encode_ms_max = encode_ns_max_ / 1e6;
+		return stats;
+	}
+};
+
+// Adds the frame to a single video file, and its timing to the file's timestamp sidecar
+static FrameWriter::AddFrameFunction add_frame_with_timestamps(ic4::VideoWriter& writer, timestamp_sidecar::writer& sidecar)
+{
+	return [&writer, &sidecar](const std::shared_ptr<ic4::ImageBuffer>& buffer, int64_t host_arrival_ns, ic4::Error& err)
+	{
+		if (!writer.addFrame(buffer, err))
+		{
+			return false;
+		}
+		auto md = buffer->metaData();
+		sidecar.append(md.device_frame_number, md.device_timestamp_ns, host_arrival_ns);
+		return true;
+	};
+}
+
+static void print_statistics(const FrameWriter& frame_writer)
+{
+	auto stats = frame_writer.statistics();
+	std::cout << "Wrote " << stats.frames_written << " frames." << std::endl;
+	std::cout << "Queue: depth " << frame_writer.queue_depth() << ", high-water mark " << stats.queue_high_water_mark
+		<< ", " << stats.queue_full_drops << " frames dropped because the queue was full" << std::endl;
+	std::cout << "Encode time per frame: mean " << stats.encode_ms_mean << " ms, max " << stats.encode_ms_max << " ms" << std::endl;
+}
+
+struct SegmentConfig
+{
+	std::string prefix = "segment";
+	double max_duration_s = 0;	// Playback duration of a segment, 0 = unlimited
+	uint64_t max_bytes = 0;		// Approximate file size of a segment, 0 = unlimited
+};
+
+// Records a gapless sequence of video files <prefix>0000.mp4, <prefix>0001.mp4, ...
+//
+// Two VideoWriter instances are used in ping-pong: when a segment is full, the next file is begun on the idle writer
+// and the frame that triggered the switch already goes into the new file. The previous file is finalized by finishFile
+// on a background thread meanwhile, so the writer thread never waits for it and no frame is lost at the boundary.
+// Every segment gets its own timestamp sidecar file.
+class SegmentedRecorder
+{
+private:
+	struct Segment
+	{
+		std::string file_name;
+		uint64_t frames;
+		double finalize_ms;
+	};
+
+	SegmentConfig config_;
+	ic4::ImageType image_type_;
+	double frame_rate_;
+	uint64_t max_frames_;
+
+	std::unique_ptr<ic4::VideoWriter> writers_[2];
+	std::unique_ptr<timestamp_sidecar::writer> sidecars_[2];
+	std::future<void> finalizing_[2];
+	int active_;
+	bool file_open_;
+
+	int segment_index_;
+	std::string file_name_;
+	uint64_t frames_in_segment_;
+
+	std::mutex segments_mtx_;
+	std::vector<Segment> segments_;
+
+	// The file size is only checked every few frames, the encoder writes in chunks anyway
+	static uint64_t file_size(const std::string& file_name)
+	{
+		std::ifstream f(file_name, std::ios::binary | std::ios::ate);
+		auto pos = f.tellg();
+		return pos > 0 ? static_cast<uint64_t>(pos) : 0;
+	}
+
+	bool segment_full()
+	{
+		if (frames_in_segment_ == 0)
+		{
+			return false;
+		}
+		if (max_frames_ > 0 && frames_in_segment_ >= max_frames_)
+		{
+			return true;
+		}
+		return config_.max_bytes > 0 && frames_in_segment_ % 16 == 0 && file_size(file_name_) >= config_.max_bytes;
+	}
+
+	bool begin_segment(int writer_index, ic4::Error& err)
+	{
+		// The idle writer may still be finalizing the segment before last
+		if (finalizing_[writer_index].valid())
+		{
+			finalizing_[writer_index].wait();
+		}
+
+		std::ostringstream name;
+		name << config_.prefix << std::setw(4) << std::setfill('0') << segment_index_ << ".mp4";
+
+		if (!writers_[writer_index]->beginFile(name.str(), image_type_, frame_rate_, err))
+		{
+			return false;
+		}
+		if (!sidecars_[writer_index]->open(timestamp_sidecar::file_name_for(name.str())))
+		{
+			std::cerr << "Failed to create timestamp file for " << name.str() << std::endl;
+		}
+		active_ = writer_index;
+		file_open_ = true;
+		file_name_ = name.str();
+		frames_in_segment_ = 0;
+		segment_index_ += 1;
+		return true;
+	}
+
+	void finalize_in_background(int writer_index, Segment segment)
+	{
+		auto& writer = *writers_[writer_index];
+		auto& sidecar = *sidecars_[writer_index];
+
+		finalizing_[writer_index] = std::async(std::launch::async, [this, &writer, &sidecar, segment]() mutable
+		{
+			auto begin = std::chrono::steady_clock::now();
+			ic4::Error err;
+			if (!writer.finishFile(err))
+			{
+				std::cerr << "Failed to finish " << segment.file_name << ": " << err.message() << std::endl;
+			}
+			sidecar.close();
+			segment.finalize_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+			std::lock_guard<std::mutex> lck(segments_mtx_);
+			std::cout << "Saved segment " << segment.file_name << ": " << segment.frames << " frames, finalized in " << segment.finalize_ms << " ms" << std::endl;
+			segments_.push_back(segment);
+		});
+	}
+
+public:
+	SegmentedRecorder(const SegmentConfig& config)
+		: config_(config)
+		, frame_rate_(0)
+		, max_frames_(0)
+		, active_(0)
+		, file_open_(false)
+		, segment_index_(0)
+		, frames_in_segment_(0)
+	{
+		writers_[0] = std::make_unique<ic4::VideoWriter>(ic4::VideoWriterType::MP4_H264);
+		writers_[1] = std::make_unique<ic4::VideoWriter>(ic4::VideoWriterType::MP4_H264);
+		sidecars_[0] = std::make_unique<timestamp_sidecar::writer>();
+		sidecars_[1] = std::make_unique<timestamp_sidecar::writer>();
+	}
+
+	~SegmentedRecorder()
+	{
+		finish();
+	}
+
+	bool begin(const ic4::ImageType& image_type, double frame_rate, ic4::Error& err)
+	{
+		image_type_ = image_type;
+		frame_rate_ = frame_rate;
+		max_frames_ = static_cast<uint64_t>(config_.max_duration_s * frame_rate);
+		return begin_segment(0, err);
+	}
+
+	// Called on the writer thread
+	bool addFrame(const std::shared_ptr<ic4::ImageBuffer>& buffer, int64_t host_arrival_ns, ic4::Error& err)
+	{
+		if (!file_open_)
+		{
+			return false;
+		}
+
+		if (segment_full())
+		{
+			int finished = active_;
+			Segment segment = { file_name_, frames_in_segment_, 0.0 };
+
+			// If the next file cannot be created, keep writing into the current one instead of losing frames
+			ic4::Error begin_err;
+			if (begin_segment(1 - finished, begin_err))
+			{
+				finalize_in_background(finished, segment);
+			}
+			else
+			{
+				std::cerr << "Failed to begin next segment: " << begin_err.message() << std::endl;
+			}
+		}
+
+		if (!writers_[active_]->addFrame(buffer, err))
+		{
+			return false;
+		}
+		auto md = buffer->metaData();
+		sidecars_[active_]->append(md.device_frame_number, md.device_timestamp_ns, host_arrival_ns);
+		frames_in_segment_ += 1;
+		return true;
+	}
+
+	// Finalizes the current segment and waits until all segments are finalized. Call after FrameWriter::flush.
+	void finish()
+	{
+		if (file_open_)
+		{
+			file_open_ = false;
+			finalize_in_background(active_, { file_name_, frames_in_segment_, 0.0 });
+		}
+		for (auto&& f : finalizing_)
+		{
+			if (f.valid())
+			{
+				f.wait();
+			}
+		}
+	}
+
+	void print_summary()
+	{
+		std::lock_guard<std::mutex> lck(segments_mtx_);
+
+		uint64_t frames = 0;
+		double finalize_ms_max = 0;
+		for (auto&& s : segments_)
+		{
+			frames += s.frames;
+			finalize_ms_max = std::max(finalize_ms_max, s.finalize_ms);
+		}
+		std::cout << "Recorded " << frames << " frames into " << segments_.size() << " segments, longest finalize " << finalize_ms_max << " ms" << std::endl;
+	}
+};
+
+struct PreTriggerConfig
+{
+	double seconds = 0;		// Keep the frames of the last N seconds, 0 = no time limit
+	uint64_t max_bytes = 0;	// Keep at most this many bytes of frames, 0 = no size limit
+	double frame_rate = 0;
+};
+
+// Fixed-capacity FIFO of image buffers and their host arrival times that is only accessed from the sink callback thread.
+// The slots are allocated once, pushing into a full ring releases the oldest buffer, which returns it to the sink.
+class PreTriggerRing
+{
+private:
+	std::vector<std::shared_ptr<ic4::ImageBuffer>> slots_;
+	std::vector<int64_t> arrival_ns_;
+	size_t first_;
+	size_t size_;
+
+public:
+	explicit PreTriggerRing(size_t capacity)
+		: slots_(capacity)
+		, arrival_ns_(capacity)
+		, first_(0)
+		, size_(0)
+	{
+	}
+
+	size_t capacity() const { return slots_.size(); }
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	bool full() const { return size_ == slots_.size(); }
+
+	// Overwrites the oldest buffer if the ring is full
+	void push_overwrite(std::shared_ptr<ic4::ImageBuffer>&& buffer, int64_t host_arrival_ns)
+	{
+		if (full())
+		{
+			pop_front();
+		}
+		auto index = (first_ + size_) % slots_.size();
+		slots_[index] = std::move(buffer);
+		arrival_ns_[index] = host_arrival_ns;
+		size_ += 1;
+	}
+
+	std::shared_ptr<ic4::ImageBuffer>& front()
+	{
+		return slots_[first_];
+	}
+
+	int64_t front_arrival_ns() const
+	{
+		return arrival_ns_[first_];
+	}
+
+	void pop_front()
+	{
+		slots_[first_].reset();
+		first_ = (first_ + 1) % slots_.size();
+		size_ -= 1;
+	}
+
+	void clear()
+	{
+		while (!empty())
+		{
+			pop_front();
+		}
+	}
+};
+
+// Conservative estimate of the buffer size of a frame, used to size the pre-trigger ring by bytes
+static size_t estimate_frame_size(const ic4::ImageType& image_type)
+{
+	size_t bytes_per_pixel = 4;
+	switch (image_type.pixel_format())
+	{
+	case ic4::PixelFormat::Mono8:
+	case ic4::PixelFormat::BayerBG8:
+	case ic4::PixelFormat::BayerGB8:
+	case ic4::PixelFormat::BayerGR8:
+	case ic4::PixelFormat::BayerRG8:
+		bytes_per_pixel = 1;
+		break;
+	case ic4::PixelFormat::Mono10p:
+	case ic4::PixelFormat::Mono12p:
+	case ic4::PixelFormat::Mono16:
+	case ic4::PixelFormat::BayerRG16:
+	case ic4::PixelFormat::YUV422_8:
+	case ic4::PixelFormat::YCbCr422_8:
+		bytes_per_pixel = 2;
+		break;
+	case ic4::PixelFormat::BGR8:
+		bytes_per_pixel = 3;
+		break;
+	case ic4::PixelFormat::BGRa16:
+		bytes_per_pixel = 8;
+		break;
+	default:
+		break;
+	}
+	return bytes_per_pixel * image_type.width() * image_type.height();
+}
+
+// Define QueueSinkListener-derived class that hands the received frames to the frame writer
+//
+// With a pre-trigger configuration, the frames received while not recording are kept in a PreTriggerRing.
+// When recording is enabled, the ring is flushed into the frame writer ahead of the live frames, so the video file
+// starts with the frames from before the trigger.
 class AddFrameListener : public ic4::QueueSinkListener
 {
 private:
-	ic4::VideoWriter& writer_;
+	FrameWriter& frame_writer_;
+	PreTriggerConfig pre_trigger_;
 	std::atomic<bool> do_write_frames_;
-	std::atomic<int> num_frames_written_;
+
+	std::unique_ptr<PreTriggerRing> ring_;
+	std::atomic<size_t> ring_pending_;
+
+	// Number of framesQueued calls currently running, see enable_recording
+	std::atomic<int> callbacks_active_;
+
+	// Set by discard_ring, the ring is only touched by the sink callback
+	std::atomic<bool> discard_ring_requested_;
+
+	// Moves as many frames from the ring into the writer queue as fit, oldest first
+	void drain_ring()
+	{
+		while (!ring_->empty() && frame_writer_.try_push(ring_->front(), ring_->front_arrival_ns()))
+		{
+			ring_->pop_front();
+		}
+		ring_pending_ = ring_->size();
+	}
 
 public:
-	AddFrameListener(ic4::VideoWriter& writer)
-		: writer_(writer)
+	AddFrameListener(FrameWriter& frame_writer, const PreTriggerConfig& pre_trigger = {})
+		: frame_writer_(frame_writer)
+		, pre_trigger_(pre_trigger)
 		, do_write_frames_(false)
-		, num_frames_written_(0)
+		, ring_pending_(0)
+		, callbacks_active_(0)
+		, discard_ring_requested_(false)
 	{
 	}
 
+	// Inherited via QueueSinkListener, called when the sink is connected to the stream
+	bool sinkConnected(ic4::QueueSink& sink, const ic4::ImageType& frameType, size_t min_buffers_required) override
+	{
+		size_t ring_frames = 0;
+		if (pre_trigger_.seconds > 0)
+		{
+			ring_frames = static_cast<size_t>(std::ceil(pre_trigger_.seconds * pre_trigger_.frame_rate));
+		}
+		if (pre_trigger_.max_bytes > 0)
+		{
+			auto by_bytes = static_cast<size_t>(pre_trigger_.max_bytes / estimate_frame_size(frameType));
+			ring_frames = ring_frames > 0 ? std::min(ring_frames, by_bytes) : by_bytes;
+		}
+		if (ring_frames > 0)
+		{
+			ring_ = std::make_unique<PreTriggerRing>(ring_frames);
+			std::cout << "Pre-trigger ring: " << ring_frames << " frames" << std::endl;
+		}
+
+		// Every buffer waiting in the writer queue or the pre-trigger ring is missing from the sink's free queue.
+		// Allocate enough buffers up front so that the device does not run out while they are held.
+		ic4::Error err;
+		if (!sink.allocAndQueueBuffers(min_buffers_required + frame_writer_.queue_depth() + ring_frames, err))
+		{
+			std::cerr << "Failed to allocate buffers: " << err.message() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
 	// Inherited via QueueSinkListener, called when there are frames available in the sink's output queue
 	void framesQueued(ic4::QueueSink& sink) override
 	{
+		callbacks_active_ += 1;
+		handle_frame(sink);
+		callbacks_active_ -= 1;
+	}
+
+private:
+	void handle_frame(ic4::QueueSink& sink)
+	{
+		auto host_arrival_ns = timestamp_sidecar::host_time_ns();
 		ic4::Error err;
 
+		if (ring_ && discard_ring_requested_.exchange(false))
+		{
+			ring_->clear();
+			ring_pending_ = 0;
+		}
+
 		// Remove a buffer from the sink's output queue
 		// We have to remove buffers from the queue even if not recording; otherwise the device will not have
 		// buffers to write new video data into
@@ -38,38 +625,281 @@ public:
 			return;
 		}
 
-		if (do_write_frames_)
+		if (!do_write_frames_)
 		{
-			// Pass the image buffer to the video writer
-			if (!writer_.addFrame(buffer, err))
+			// Keep the most recent frames, the oldest one goes back to the sink
+			if (ring_)
 			{
-				std::cerr << "Failed to add frame to video file: " << err.message() << std::endl;
+				ring_->push_overwrite(std::move(buffer), host_arrival_ns);
 			}
+			return;
+		}
 
-			num_frames_written_ += 1;
+		if (ring_ && !ring_->empty())
+		{
+			// Still flushing the pre-trigger frames: the live frame has to wait behind them
+			drain_ring();
+			if (!ring_->empty())
+			{
+				if (ring_->full())
+				{
+					frame_writer_.count_drop();
+					return;
+				}
+				ring_->push_overwrite(std::move(buffer), host_arrival_ns);
+				ring_pending_ = ring_->size();
+				return;
+			}
 		}
+
+		// Only queue the buffer, the frame writer thread passes it to the video writer
+		frame_writer_.push(std::move(buffer), host_arrival_ns);
 	}
 
+public:
+	// When disabling, also waits for a sink callback that is still running, so that no frame is pushed into the
+	// frame writer after this returns. A callback that starts later sees the flag and keeps its frame out of the writer.
 	void enable_recording(bool enable)
 	{
-		if (enable)
+		do_write_frames_ = enable;
+		if (!enable)
 		{
-			num_frames_written_ = 0;
+			while (callbacks_active_ > 0)
+			{
+				std::this_thread::yield();
+			}
 		}
-		do_write_frames_ = enable;
 	}
 
-	int num_frames_written()
+	// Waits until the pre-trigger frames were handed to the frame writer. Call before enable_recording(false).
+	// The ring is drained by the sink callback, so this waits for at most timeout if no frames arrive.
+	// Returns false if frames are still left in the ring, see discard_ring.
+	bool wait_ring_flushed(std::chrono::milliseconds timeout)
 	{
-		return num_frames_written_;
+		auto end = std::chrono::steady_clock::now() + timeout;
+		while (ring_pending_ > 0 && std::chrono::steady_clock::now() < end)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return ring_pending_ == 0;
+	}
+
+	size_t ring_pending() const
+	{
+		return ring_pending_;
+	}
+
+	// Drops the frames left in the ring after wait_ring_flushed timed out, so they do not start the next recording.
+	// The ring is cleared by the next sink callback, before the frame is stored.
+	void discard_ring()
+	{
+		discard_ring_requested_ = true;
 	}
 };
 
-int main()
+// Feeds synthetic BGR8 frames at a fixed rate through a FrameWriter, without a device.
+// Like a QueueSink, the source has a fixed set of buffers: if all of them are still held by the queue or the encoder
+// when the next frame is due, the frame is counted as an underrun.
+// If segment_config is set, the frames are recorded by a SegmentedRecorder instead of into a single file.
+static int run_benchmark(double fps, double duration_s, int width, int height, size_t queue_depth, const SegmentConfig* segment_config)
+{
+	ic4::Error err;
+	ic4::VideoWriter writer(ic4::VideoWriterType::MP4_H264, err);
+	if (err.isError())
+	{
+		std::cerr << "Failed to create video writer: " << err.message() << std::endl;
+		return -1;
+	}
+
+	ic4::ImageType image_type(ic4::PixelFormat::BGR8, width, height);
+
+	std::unique_ptr<SegmentedRecorder> recorder;
+	if (segment_config)
+	{
+		recorder = std::make_unique<SegmentedRecorder>(*segment_config);
+		if (!recorder->begin(image_type, fps, err))
+		{
+			std::cerr << "Failed to begin recording: " << err.message() << std::endl;
+			return -2;
+		}
+	}
+	else if (!writer.beginFile("benchmark.mp4", image_type, fps, err))
+	{
+		std::cerr << "Failed to begin recording: " << err.message() << std::endl;
+		return -2;
+	}
+
+	timestamp_sidecar::writer sidecar;
+	if (!recorder)
+	{
+		sidecar.open(timestamp_sidecar::file_name_for("benchmark.mp4"));
+	}
+
+	// The same number of buffers the listener above allocates, assuming the sink requires 4
+	ic4::BufferPool pool;
+	std::vector<std::shared_ptr<ic4::ImageBuffer>> buffers;
+	for (size_t i = 0; i < 4 + queue_depth; ++i)
+	{
+		auto buffer = pool.getBuffer(image_type, {}, err);
+		if (buffer == nullptr)
+		{
+			std::cerr << "Failed to allocate buffer: " << err.message() << std::endl;
+			return -3;
+		}
+		buffers.push_back(buffer);
+	}
+
+	std::cout << "Benchmark: " << width << "x" << height << " BGR8 at " << fps << " fps for " << duration_s << " s, queue depth " << queue_depth << std::endl;
+
+	uint64_t frames_produced = 0;
+	uint64_t underruns = 0;
+	{
+		FrameWriter::AddFrameFunction add_frame = add_frame_with_timestamps(writer, sidecar);
+		if (recorder)
+		{
+			add_frame = [&recorder](const std::shared_ptr<ic4::ImageBuffer>& buffer, int64_t host_arrival_ns, ic4::Error& err) { return recorder->addFrame(buffer, host_arrival_ns, err); };
+		}
+		FrameWriter frame_writer(add_frame, queue_depth);
+
+		auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+		auto begin = std::chrono::steady_clock::now();
+		auto end = begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(duration_s));
+		for (auto next = begin; next < end; next += period)
+		{
+			std::this_thread::sleep_until(next);
+
+			// A buffer is free if nobody but the source holds a reference
+			std::shared_ptr<ic4::ImageBuffer> free_buffer;
+			for (auto&& buffer : buffers)
+			{
+				if (buffer.use_count() == 1)
+				{
+					free_buffer = buffer;
+					break;
+				}
+			}
+			frames_produced += 1;
+			if (free_buffer == nullptr)
+			{
+				underruns += 1;
+				continue;
+			}
+
+			auto ptr = static_cast<uint8_t*>(free_buffer->ptr());
+			for (int y = 0; y < height; ++y)
+			{
+				std::memset(ptr + y * free_buffer->pitch(), static_cast<int>((y + frames_produced) & 0xFF), width * 3);
+			}
+			frame_writer.push(std::move(free_buffer), timestamp_sidecar::host_time_ns());
+		}
+		frame_writer.flush();
+
+		auto elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		std::cout << "Produced " << frames_produced << " frames, " << underruns << " underruns" << std::endl;
+		print_statistics(frame_writer);
+		std::cout << "Sustained " << frame_writer.statistics().frames_written / elapsed_s << " fps" << std::endl;
+	}
+
+	if (recorder)
+	{
+		recorder->finish();
+		recorder->print_summary();
+	}
+	else if (!writer.finishFile(err))
+	{
+		std::cerr << "Failed to finish recording: " << err.message() << std::endl;
+		return -4;
+	}
+	sidecar.close();
+	return underruns == 0 ? 0 : 1;
+}
+
+static void print_usage()
+{
+	std::cout << "Usage: record-mp4-h264 [--queue-depth <n>] [--segment-duration <seconds>] [--segment-size <MB>] [--pre-trigger <seconds>] [--pre-trigger-size <MB>] [--benchmark <fps> <seconds> [<width> <height>]]" << std::endl;
+}
+
+int main(int argc, char** argv)
 {
+	size_t queue_depth = 16;
+	bool benchmark = false;
+	double benchmark_fps = 0;
+	double benchmark_duration_s = 0;
+	int benchmark_width = 1920;
+	int benchmark_height = 1080;
+	SegmentConfig segment_config;
+	PreTriggerConfig pre_trigger;
+
+	try
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "--queue-depth" && i + 1 < argc)
+			{
+				queue_depth = std::stoul(argv[++i]);
+			}
+			else if (arg == "--segment-duration" && i + 1 < argc)
+			{
+				segment_config.max_duration_s = std::stod(argv[++i]);
+			}
+			else if (arg == "--segment-size" && i + 1 < argc)
+			{
+				segment_config.max_bytes = static_cast<uint64_t>(std::stod(argv[++i]) * 1024 * 1024);
+			}
+			else if (arg == "--pre-trigger" && i + 1 < argc)
+			{
+				pre_trigger.seconds = std::stod(argv[++i]);
+			}
+			else if (arg == "--pre-trigger-size" && i + 1 < argc)
+			{
+				pre_trigger.max_bytes = static_cast<uint64_t>(std::stod(argv[++i]) * 1024 * 1024);
+			}
+			else if (arg == "--benchmark" && i + 2 < argc)
+			{
+				benchmark = true;
+				benchmark_fps = std::stod(argv[++i]);
+				benchmark_duration_s = std::stod(argv[++i]);
+				if (i + 2 < argc)
+				{
+					benchmark_width = std::stoi(argv[++i]);
+					benchmark_height = std::stoi(argv[++i]);
+				}
+			}
+			else
+			{
+				print_usage();
+				return -1;
+			}
+		}
+	}
+	catch (const std::exception&)
+	{
+		print_usage();
+		return -1;
+	}
+
+	if (queue_depth < 1)
+	{
+		std::cerr << "--queue-depth must be at least 1" << std::endl;
+		return -1;
+	}
+	if (benchmark && !(benchmark_fps > 0 && benchmark_duration_s > 0 && benchmark_width > 0 && benchmark_height > 0))
+	{
+		std::cerr << "--benchmark requires a positive frame rate, duration, width and height" << std::endl;
+		return -1;
+	}
+
+	bool segmented = segment_config.max_duration_s > 0 || segment_config.max_bytes > 0;
+
 	ic4::initLibrary();
 	std::atexit(ic4::exitLibrary);
 
+	if (benchmark)
+	{
+		return run_benchmark(benchmark_fps, benchmark_duration_s, benchmark_width, benchmark_height, queue_depth, segmented ? &segment_config : nullptr);
+	}
+
 	// Let the user select a device
 	auto device_list = ic4::DeviceEnum::enumDevices();
 	auto it = ic4_examples::console::select_from_list(device_list);
@@ -89,11 +919,37 @@ int main()
 
 	// #TODO: Insert format configuration
 
+	// Query the device's configured frame rate.
+	// The frame rate is later set as the video file's playback rate, and sizes the pre-trigger ring.
+	auto frame_rate = grabber.devicePropertyMap().find(ic4::PropId::AcquisitionFrameRate).getValue(err);
+	if (err.isError())
+	{
+		std::cerr << "Failed to query acquisition frame rate: " << err.message() << std::endl;
+		return -6;
+	}
+
 	// Create a video writer for H264-compressed MP4 files
 	ic4::VideoWriter writer(ic4::VideoWriterType::MP4_H264);
 
+	// For continuous recording, the segmented recorder creates its own video writers
+	std::unique_ptr<SegmentedRecorder> recorder;
+	if (segmented)
+	{
+		recorder = std::make_unique<SegmentedRecorder>(segment_config);
+	}
+
+	// Create the writer thread that feeds frames into the video writer
+	timestamp_sidecar::writer sidecar;
+	FrameWriter::AddFrameFunction add_frame = add_frame_with_timestamps(writer, sidecar);
+	if (recorder)
+	{
+		add_frame = [&recorder](const std::shared_ptr<ic4::ImageBuffer>& buffer, int64_t host_arrival_ns, ic4::Error& err) { return recorder->addFrame(buffer, host_arrival_ns, err); };
+	}
+	FrameWriter frame_writer(add_frame, queue_depth);
+
 	// Create an instance of the listener type defined above
-	AddFrameListener listener(writer);
+	pre_trigger.frame_rate = frame_rate;
+	AddFrameListener listener(frame_writer, pre_trigger);
 
 	// Create a QueueSink to capture all images arriving from the video capture device
 	auto sink = ic4::QueueSink::create(listener, err);
@@ -119,23 +975,50 @@ int main()
 		return -5;
 	}
 
-	// Query the device's configured frame rate.
-	// The frame rate is later set as the video file's playback rate.
-	auto frame_rate = grabber.devicePropertyMap().find(ic4::PropId::AcquisitionFrameRate).getValue(err);
-	if (err.isError())
-	{
-		std::cerr << "Failed to query acquisition frame rate: " << err.message() << std::endl;
-		return -6;
-	}
-
 	std::cout << "Stream started." << std::endl;
 	std::cout << "ImageType: " << ic4::to_string(image_type) << std::endl;
 	std::cout << "AcquisitionFrameRate: " << frame_rate << std::endl;
 	std::cout << std::endl;
 
-	for (int i = 0; i < 3; ++i)
+	if (recorder)
+	{
+		if (!recorder->begin(image_type, frame_rate, err))
+		{
+			std::cerr << "Failed to begin recording: " << err.message() << std::endl;
+			return -7;
+		}
+
+		frame_writer.reset_statistics();
+		listener.enable_recording(true);
+
+		std::cout << "Recording segments. Press any key to stop" << std::endl;
+		(void)std::getchar();
+
+		// Wait for the queued frames, then finalize the last segment
+		bool ring_flushed = listener.wait_ring_flushed(std::chrono::seconds(5));
+		listener.enable_recording(false);
+		if (!ring_flushed)
+		{
+			std::cerr << "Timeout while writing the pre-trigger frames, discarded " << listener.ring_pending() << " frames" << std::endl;
+			listener.discard_ring();
+		}
+		frame_writer.flush();
+		recorder->finish();
+
+		recorder->print_summary();
+		print_statistics(frame_writer);
+	}
+
+	for (int i = 0; i < 3 && !recorder; ++i)
 	{
-		std::cout << "Press any key to begin recording a video file" << std::endl;
+		if (pre_trigger.seconds > 0 || pre_trigger.max_bytes > 0)
+		{
+			std::cout << "Press any key to trigger recording a video file, it starts with the frames from before the trigger" << std::endl;
+		}
+		else
+		{
+			std::cout << "Press any key to begin recording a video file" << std::endl;
+		}
 		(void)std::getchar();
 
 		std::string file_name = "video" + std::to_string(i) + ".mp4";
@@ -147,24 +1030,41 @@ int main()
 			continue;
 		}
 
+		// Write the actual timing of the frames next to the video file
+		std::string timestamps_file_name = timestamp_sidecar::file_name_for(file_name);
+		if (!sidecar.open(timestamps_file_name))
+		{
+			std::cerr << "Failed to create " << timestamps_file_name << std::endl;
+		}
+
 		// Instruct our QueueSinkListener to write frames into the video writer
+		frame_writer.reset_statistics();
 		listener.enable_recording(true);
 
 		std::cout << "Recording started. Press any key to stop" << std::endl;
 		(void)std::getchar();
 
-		// Stop writing frames into the video writer
+		// Stop writing frames into the video writer, and wait for the writer thread to process the queued frames
+		bool ring_flushed = listener.wait_ring_flushed(std::chrono::seconds(5));
 		listener.enable_recording(false);
+		if (!ring_flushed)
+		{
+			std::cerr << "Timeout while writing the pre-trigger frames, discarded " << listener.ring_pending() << " frames" << std::endl;
+			listener.discard_ring();
+		}
+		frame_writer.flush();
 
 		// Finalize the currently opened video file
 		if (!writer.finishFile(err))
 		{
 			std::cerr << "Failed to finish recording: " << err.message() << std::endl;
+			sidecar.close();
 			continue;
 		}
+		sidecar.close();
 
-		std::cout << "Saved video file " << file_name << std::endl;
-		std::cout << "Wrote " << listener.num_frames_written() << " frames." << std::endl;
+		std::cout << "Saved video file " << file_name << " and " << timestamps_file_name << std::endl;
+		print_statistics(frame_writer);
 		std::cout << std::endl;
 	}
 
@@ -173,4 +1073,4 @@ int main()
 	grabber.deviceClose();
 
 	return 0;
-}
\ No newline at end of file
+}
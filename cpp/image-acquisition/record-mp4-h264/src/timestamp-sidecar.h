@@ -0,0 +1,145 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Binary file with the capture timing of the frames of a video file, written next to it as <video file>.timestamps
+//
+//	file_header		magic, version, record size, and a host clock reference
+//	record[]		one per frame, in the order the frames were added to the video file
+//
+// VideoWriter::beginFile only takes a nominal frame rate. The sidecar keeps the actual device timestamps and host arrival
+// times, and for each frame the number of device frames that are missing before it (dropped by the device, the driver
+// or the writer queue).
+namespace timestamp_sidecar
+{
+	static const char magic[8] = { 'I', 'C', '4', 'T', 'S', '\0', '\0', '\0' };
+	static const uint32_t version = 1;
+
+	struct file_header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t record_size;
+
+		// Host arrival times are steady_clock times. host_system_ns is the system_clock time at steady_clock time host_steady_ns,
+		// which converts them into wall clock time.
+		int64_t host_steady_ns;
+		int64_t host_system_ns;
+	};
+
+	struct record
+	{
+		uint64_t frame_index;			// Index of the frame in the video file
+		uint64_t device_frame_number;
+		uint64_t device_timestamp_ns;
+		int64_t host_arrival_ns;		// steady_clock time at which the sink callback received the frame
+		uint32_t gap;					// Number of device frames missing between the previous record and this one
+		uint32_t reserved;
+	};
+
+	inline int64_t host_time_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Collects the records in memory and writes them in large blocks, so that appending a record does not make a system call.
+	class writer
+	{
+	public:
+		explicit writer(size_t records_per_block = 4096)
+			: records_per_block_(records_per_block)
+		{
+			records_.reserve(records_per_block_);
+		}
+
+		writer(const writer&) = delete;
+		writer& operator=(const writer&) = delete;
+
+		~writer()
+		{
+			close();
+		}
+
+		bool open(const std::string& file_name)
+		{
+			close();
+
+			file_ = std::fopen(file_name.c_str(), "wb");
+			if (!file_)
+			{
+				return false;
+			}
+			// The records are buffered in records_ already
+			std::setvbuf(file_, nullptr, _IONBF, 0);
+
+			file_header hdr = {};
+			std::memcpy(hdr.magic, timestamp_sidecar::magic, sizeof(hdr.magic));
+			hdr.version = timestamp_sidecar::version;
+			hdr.record_size = sizeof(record);
+			hdr.host_steady_ns = host_time_ns();
+			hdr.host_system_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+			frame_index_ = 0;
+			last_frame_number_ = 0;
+			return std::fwrite(&hdr, sizeof(hdr), 1, file_) == 1;
+		}
+
+		void append(uint64_t device_frame_number, uint64_t device_timestamp_ns, int64_t host_arrival_ns)
+		{
+			if (!file_)
+			{
+				return;
+			}
+
+			uint32_t gap = 0;
+			if (frame_index_ > 0 && device_frame_number > last_frame_number_ + 1)
+			{
+				gap = static_cast<uint32_t>(device_frame_number - last_frame_number_ - 1);
+			}
+			records_.push_back({ frame_index_, device_frame_number, device_timestamp_ns, host_arrival_ns, gap, 0 });
+			frame_index_ += 1;
+			last_frame_number_ = device_frame_number;
+
+			if (records_.size() >= records_per_block_)
+			{
+				flush();
+			}
+		}
+
+		void flush()
+		{
+			if (file_ && !records_.empty())
+			{
+				std::fwrite(records_.data(), sizeof(record), records_.size(), file_);
+			}
+			records_.clear();
+		}
+
+		void close()
+		{
+			if (file_)
+			{
+				flush();
+				std::fclose(file_);
+				file_ = nullptr;
+			}
+		}
+
+	private:
+		std::FILE* file_ = nullptr;
+		size_t records_per_block_;
+		std::vector<record> records_;
+		uint64_t frame_index_ = 0;
+		uint64_t last_frame_number_ = 0;
+	};
+
+	inline std::string file_name_for(const std::string& video_file_name)
+	{
+		return video_file_name + ".timestamps";
+	}
+}
@@ -0,0 +1,486 @@
+#pragma once
+
+#include <ic4/ic4.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Container file for uncompressed frames
+//
+//	file_header								at offset 0, padded to 4096 bytes
+//	index_entry[capacity]					at file_header::index_offset
+//	frame data, capacity * frame_stride		at file_header::data_offset, every frame starts at a multiple of 4096
+//
+// All frames of a file have the same ImageType, their rows are stored without padding (pitch == row_bytes).
+// Since the frames have a fixed stride, frame i is found in O(1), the index adds the metadata of each frame.
+namespace raw_container
+{
+	static const char magic[8] = { 'I', 'C', '4', 'R', 'A', 'W', '\0', '\0' };
+	static const uint32_t version = 1;
+	static const uint64_t alignment = 4096;
+
+	struct file_header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t header_size;
+
+		// ic4::ImageType of all frames
+		uint32_t pixel_format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t reserved;
+
+		uint64_t row_bytes;
+		uint64_t frame_bytes;		// row_bytes * height
+		uint64_t frame_stride;		// frame_bytes rounded up to alignment
+
+		uint64_t capacity;			// Number of frames the file was preallocated for
+		uint64_t frame_count;		// Number of valid frames, written when the file is closed. 0 if the writer did not close the file, see reader::open
+		uint64_t index_offset;
+		uint64_t data_offset;
+	};
+
+	struct index_entry
+	{
+		uint64_t offset;
+		uint64_t device_frame_number;
+		uint64_t device_timestamp_ns;
+		uint64_t reserved;
+	};
+
+	inline uint64_t align_up(uint64_t v)
+	{
+		return (v + alignment - 1) / alignment * alignment;
+	}
+
+	// Bits per pixel of the pixel formats the container can store, 0 for others
+	inline uint32_t bits_per_pixel(ic4::PixelFormat fmt)
+	{
+		switch (fmt)
+		{
+		case ic4::PixelFormat::Mono8:
+		case ic4::PixelFormat::BayerBG8:
+		case ic4::PixelFormat::BayerGB8:
+		case ic4::PixelFormat::BayerGR8:
+		case ic4::PixelFormat::BayerRG8:
+			return 8;
+		case ic4::PixelFormat::Mono10p:
+			return 10;
+		case ic4::PixelFormat::Mono12p:
+			return 12;
+		case ic4::PixelFormat::Mono16:
+		case ic4::PixelFormat::BayerRG16:
+		case ic4::PixelFormat::YUV422_8:
+		case ic4::PixelFormat::YCbCr422_8:
+			return 16;
+		case ic4::PixelFormat::BGR8:
+			return 24;
+		case ic4::PixelFormat::BGRa8:
+			return 32;
+		case ic4::PixelFormat::BGRa16:
+			return 64;
+		default:
+			return 0;
+		}
+	}
+
+	// Read-write or read-only mapping of a whole file
+	class mapped_file
+	{
+	public:
+		mapped_file() = default;
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		~mapped_file()
+		{
+			close();
+		}
+
+		// Creates or truncates the file, preallocates size bytes on disk and maps them
+		bool create(const std::string& file_name, uint64_t size)
+		{
+#if defined(_WIN32)
+			file_ = ::CreateFileA(file_name.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file_ == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+			// Creating a mapping larger than the file extends the file
+			mapping_ = ::CreateFileMappingA(file_, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+			if (mapping_ == nullptr)
+			{
+				return false;
+			}
+			data_ = static_cast<uint8_t*>(::MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, 0));
+#else
+			fd_ = ::open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if (fd_ < 0)
+			{
+				return false;
+			}
+			// Reserve the blocks now, so that writing a frame never waits for the file system to allocate space
+#if defined(__linux__)
+			if (::posix_fallocate(fd_, 0, static_cast<off_t>(size)) != 0)
+#else
+			if (::ftruncate(fd_, static_cast<off_t>(size)) != 0)
+#endif
+			{
+				return false;
+			}
+			void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+			if (p == MAP_FAILED)
+			{
+				return false;
+			}
+			data_ = static_cast<uint8_t*>(p);
+			::madvise(p, size, MADV_SEQUENTIAL);
+#endif
+			size_ = size;
+			return data_ != nullptr;
+		}
+
+		bool open_read(const std::string& file_name)
+		{
+#if defined(_WIN32)
+			file_ = ::CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file_ == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+			LARGE_INTEGER file_size = {};
+			::GetFileSizeEx(file_, &file_size);
+			mapping_ = ::CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping_ == nullptr)
+			{
+				return false;
+			}
+			data_ = static_cast<uint8_t*>(::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+			size_ = static_cast<uint64_t>(file_size.QuadPart);
+#else
+			fd_ = ::open(file_name.c_str(), O_RDONLY);
+			if (fd_ < 0)
+			{
+				return false;
+			}
+			struct stat st = {};
+			if (::fstat(fd_, &st) != 0 || st.st_size == 0)
+			{
+				return false;
+			}
+			void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd_, 0);
+			if (p == MAP_FAILED)
+			{
+				return false;
+			}
+			data_ = static_cast<uint8_t*>(p);
+			size_ = static_cast<uint64_t>(st.st_size);
+#endif
+			return data_ != nullptr;
+		}
+
+		// Starts writing back [offset, offset + length) without waiting for it
+		void flush_async(uint64_t offset, uint64_t length)
+		{
+#if defined(_WIN32)
+			::FlushViewOfFile(data_ + offset, static_cast<SIZE_T>(length));
+#else
+			auto page = offset / alignment * alignment;
+			::msync(data_ + page, static_cast<size_t>(length + offset - page), MS_ASYNC);
+#endif
+		}
+
+		// Unmaps the file and truncates it to new_size, if not 0
+		void close(uint64_t new_size = 0)
+		{
+#if defined(_WIN32)
+			if (data_)
+			{
+				::FlushViewOfFile(data_, 0);
+				::UnmapViewOfFile(data_);
+			}
+			if (mapping_)
+			{
+				::CloseHandle(mapping_);
+			}
+			if (file_ != INVALID_HANDLE_VALUE)
+			{
+				if (new_size > 0)
+				{
+					LARGE_INTEGER pos;
+					pos.QuadPart = static_cast<LONGLONG>(new_size);
+					::SetFilePointerEx(file_, pos, nullptr, FILE_BEGIN);
+					::SetEndOfFile(file_);
+				}
+				::CloseHandle(file_);
+			}
+			mapping_ = nullptr;
+			file_ = INVALID_HANDLE_VALUE;
+#else
+			if (data_)
+			{
+				::munmap(data_, static_cast<size_t>(size_));
+			}
+			if (fd_ >= 0)
+			{
+				if (new_size > 0 && ::ftruncate(fd_, static_cast<off_t>(new_size)) != 0)
+				{
+					// The file keeps its preallocated size, the header still tells the number of valid frames
+				}
+				::close(fd_);
+			}
+			fd_ = -1;
+#endif
+			data_ = nullptr;
+			size_ = 0;
+		}
+
+		uint8_t* data() const { return data_; }
+		uint64_t size() const { return size_; }
+
+	private:
+#if defined(_WIN32)
+		HANDLE file_ = INVALID_HANDLE_VALUE;
+		HANDLE mapping_ = nullptr;
+#else
+		int fd_ = -1;
+#endif
+		uint8_t* data_ = nullptr;
+		uint64_t size_ = 0;
+	};
+
+	// Appends frames to a preallocated, memory-mapped container file.
+	// add_frame copies the rows of the ImageBuffer straight into the mapping, there is no intermediate buffer.
+	// Not thread-safe, meant to be used by a single writer thread.
+	class writer
+	{
+	public:
+		bool create(const std::string& file_name, const ic4::ImageType& image_type, uint64_t capacity)
+		{
+			auto bpp = bits_per_pixel(image_type.pixel_format());
+			if (bpp == 0 || capacity == 0)
+			{
+				return false;
+			}
+
+			file_header hdr = {};
+			std::memcpy(hdr.magic, raw_container::magic, sizeof(hdr.magic));
+			hdr.version = raw_container::version;
+			hdr.header_size = sizeof(file_header);
+			hdr.pixel_format = static_cast<uint32_t>(image_type.pixel_format());
+			hdr.width = static_cast<uint32_t>(image_type.width());
+			hdr.height = static_cast<uint32_t>(image_type.height());
+			hdr.row_bytes = (static_cast<uint64_t>(hdr.width) * bpp + 7) / 8;
+			hdr.frame_bytes = hdr.row_bytes * hdr.height;
+			hdr.frame_stride = align_up(hdr.frame_bytes);
+			hdr.capacity = capacity;
+			hdr.frame_count = 0;
+			hdr.index_offset = align_up(sizeof(file_header));
+			hdr.data_offset = align_up(hdr.index_offset + capacity * sizeof(index_entry));
+
+			if (!file_.create(file_name, hdr.data_offset + capacity * hdr.frame_stride))
+			{
+				return false;
+			}
+			header_ = reinterpret_cast<file_header*>(file_.data());
+			*header_ = hdr;
+			index_ = reinterpret_cast<index_entry*>(file_.data() + hdr.index_offset);
+			flushed_offset_ = hdr.data_offset;
+			frame_bytes_ = hdr.frame_bytes;
+			return true;
+		}
+
+		// Returns false if the container is not open, full, or the buffer does not match the container's image type
+		bool add_frame(const ic4::ImageBuffer& buffer)
+		{
+			if (!header_)
+			{
+				return false;
+			}
+			auto& hdr = *header_;
+			auto type = buffer.imageType();
+			if (frame_count_ >= hdr.capacity || static_cast<uint32_t>(type.pixel_format()) != hdr.pixel_format
+				|| static_cast<uint32_t>(type.width()) != hdr.width || static_cast<uint32_t>(type.height()) != hdr.height)
+			{
+				return false;
+			}
+
+			uint64_t offset = hdr.data_offset + frame_count_ * hdr.frame_stride;
+			auto dst = file_.data() + offset;
+			auto src = static_cast<const uint8_t*>(buffer.ptr());
+			auto pitch = static_cast<uint64_t>(buffer.pitch());
+			if (pitch == hdr.row_bytes)
+			{
+				std::memcpy(dst, src, static_cast<size_t>(hdr.frame_bytes));
+			}
+			else
+			{
+				for (uint32_t y = 0; y < hdr.height; ++y)
+				{
+					std::memcpy(dst + y * hdr.row_bytes, src + y * pitch, static_cast<size_t>(hdr.row_bytes));
+				}
+			}
+
+			auto md = buffer.metaData();
+			index_[frame_count_] = { offset, md.device_frame_number, md.device_timestamp_ns, 0 };
+			frame_count_ += 1;
+
+			// Hand the written data to the kernel in large chunks, so that dirty pages do not pile up until close
+			uint64_t written_end = offset + hdr.frame_stride;
+			if (written_end - flushed_offset_ >= 64 * 1024 * 1024)
+			{
+				file_.flush_async(flushed_offset_, written_end - flushed_offset_);
+				flushed_offset_ = written_end;
+			}
+			return true;
+		}
+
+		// Writes the frame count and truncates the file to the frames actually written
+		void close()
+		{
+			if (!header_)
+			{
+				return;
+			}
+			header_->frame_count = frame_count_;
+			auto used = header_->data_offset + frame_count_ * header_->frame_stride;
+			header_ = nullptr;
+			index_ = nullptr;
+			file_.close(used);
+		}
+
+		~writer()
+		{
+			close();
+		}
+
+		ic4::ImageType image_type() const
+		{
+			return ic4::ImageType(static_cast<ic4::PixelFormat>(header_->pixel_format), static_cast<int>(header_->width), static_cast<int>(header_->height));
+		}
+
+		uint64_t frame_count() const { return frame_count_; }
+		uint64_t capacity() const { return header_ ? header_->capacity : 0; }
+		uint64_t frame_bytes() const { return frame_bytes_; }
+
+	private:
+		mapped_file file_;
+		file_header* header_ = nullptr;
+		index_entry* index_ = nullptr;
+		uint64_t frame_count_ = 0;
+		uint64_t flushed_offset_ = 0;
+		uint64_t frame_bytes_ = 0;
+	};
+
+	struct frame_view
+	{
+		const uint8_t* data;
+		uint64_t pitch;
+		uint64_t size;
+		uint64_t device_frame_number;
+		uint64_t device_timestamp_ns;
+	};
+
+	// Maps a container file read-only and gives random access to its frames
+	class reader
+	{
+	public:
+		// Checks the header and every index entry against the file size, so that frame never points outside the mapping.
+		// If the writer did not close the file (frame_count 0), the frames are recovered from the index: the file was
+		// preallocated with zeros, and add_frame writes an entry only after its frame data, so the first entry with offset 0 ends the recording.
+		bool open(const std::string& file_name)
+		{
+			if (!file_.open_read(file_name) || file_.size() < sizeof(file_header))
+			{
+				return false;
+			}
+			header_ = reinterpret_cast<const file_header*>(file_.data());
+			auto& hdr = *header_;
+			if (std::memcmp(hdr.magic, raw_container::magic, sizeof(hdr.magic)) != 0 || hdr.version != raw_container::version)
+			{
+				return false;
+			}
+
+			auto size = file_.size();
+			auto bpp = bits_per_pixel(static_cast<ic4::PixelFormat>(hdr.pixel_format));
+			if (bpp == 0 || hdr.row_bytes != (static_cast<uint64_t>(hdr.width) * bpp + 7) / 8 || hdr.frame_bytes != hdr.row_bytes * hdr.height
+				|| hdr.index_offset < sizeof(file_header) || hdr.index_offset > size || hdr.data_offset > size)
+			{
+				return false;
+			}
+
+			// Number of index entries that are inside the file
+			uint64_t max_entries = std::min<uint64_t>(hdr.capacity, (size - hdr.index_offset) / sizeof(index_entry));
+			index_ = reinterpret_cast<const index_entry*>(file_.data() + hdr.index_offset);
+
+			recovered_ = hdr.frame_count == 0;
+			frame_count_ = recovered_ ? max_entries : hdr.frame_count;
+			if (frame_count_ > max_entries)
+			{
+				return false;
+			}
+			for (uint64_t i = 0; i < frame_count_; ++i)
+			{
+				auto offset = index_[i].offset;
+				bool valid = offset >= hdr.data_offset && offset <= size && hdr.frame_bytes <= size - offset;
+				if (!valid && recovered_)
+				{
+					// First entry that was never written, or whose frame is not in the file
+					frame_count_ = i;
+					break;
+				}
+				if (!valid)
+				{
+					return false;
+				}
+			}
+			// A closed file without frames also has frame_count 0
+			recovered_ = recovered_ && frame_count_ > 0;
+			return true;
+		}
+
+		ic4::ImageType image_type() const
+		{
+			return ic4::ImageType(static_cast<ic4::PixelFormat>(header_->pixel_format), static_cast<int>(header_->width), static_cast<int>(header_->height));
+		}
+
+		uint64_t frame_count() const { return frame_count_; }
+
+		// True if the file was not closed by the writer and frame_count was determined from the index
+		bool recovered() const { return recovered_; }
+
+		// Returns false if i is not less than frame_count
+		bool frame(uint64_t i, frame_view& view) const
+		{
+			if (i >= frame_count_)
+			{
+				return false;
+			}
+			auto& e = index_[i];
+			view = { file_.data() + e.offset, header_->row_bytes, header_->frame_bytes, e.device_frame_number, e.device_timestamp_ns };
+			return true;
+		}
+
+	private:
+		mapped_file file_;
+		const file_header* header_ = nullptr;
+		const index_entry* index_ = nullptr;
+		uint64_t frame_count_ = 0;
+		bool recovered_ = false;
+	};
+}
\ No newline at end of file
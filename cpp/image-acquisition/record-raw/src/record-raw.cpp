@@ -0,0 +1,521 @@
+
+#include <ic4/ic4.h>
+
+#include <console-helper.h>
+#include <spsc-queue.h>
+
+#include "raw-container.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes the frames received by a QueueSink into a raw container file on a single writer thread.
+// The sink callback only pushes the buffer into a bounded queue; the writer thread copies it into the memory-mapped
+// file and releases it, which returns the buffer to the sink's free queue.
+class RawRecordListener : public ic4::QueueSinkListener
+{
+public:
+	struct Statistics
+	{
+		uint64_t frames_written;
+		uint64_t queue_full_drops;
+		uint64_t container_full_drops;
+		size_t queue_high_water_mark;
+		double write_ms_mean;
+		double write_ms_max;
+	};
+
+private:
+	raw_container::writer& container_;
+	ic4_examples::spsc_queue<std::shared_ptr<ic4::ImageBuffer>> queue_;
+	std::atomic<bool> do_write_frames_;
+
+	// Number of framesQueued calls currently running, see enable_recording
+	std::atomic<int> callbacks_active_;
+
+	std::atomic<bool> stop_requested_;
+	std::atomic<int> pending_;
+	std::thread thread_;
+
+	std::atomic<uint64_t> frames_written_;
+	std::atomic<uint64_t> queue_full_drops_;
+	std::atomic<uint64_t> container_full_drops_;
+	std::atomic<uint64_t> write_ns_total_;
+	std::atomic<uint64_t> write_ns_max_;
+
+	void thread_proc()
+	{
+		while (!stop_requested_)
+		{
+			std::shared_ptr<ic4::ImageBuffer> buffer;
+			if (!queue_.pop_wait(buffer, std::chrono::milliseconds(10)))
+			{
+				continue;
+			}
+
+			auto begin = std::chrono::steady_clock::now();
+
+			if (container_.add_frame(*buffer))
+			{
+				frames_written_ += 1;
+			}
+			else
+			{
+				container_full_drops_ += 1;
+			}
+
+			// Return the buffer to the sink before doing anything else
+			buffer.reset();
+
+			auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+			write_ns_total_ += ns;
+			if (ns > write_ns_max_)
+			{
+				write_ns_max_ = ns;
+			}
+
+			pending_ -= 1;
+		}
+	}
+
+public:
+	RawRecordListener(raw_container::writer& container, size_t queue_depth)
+		: container_(container)
+		, queue_(queue_depth)
+		, do_write_frames_(false)
+		, callbacks_active_(0)
+		, stop_requested_(false)
+		, pending_(0)
+		, frames_written_(0)
+		, queue_full_drops_(0)
+		, container_full_drops_(0)
+		, write_ns_total_(0)
+		, write_ns_max_(0)
+	{
+		thread_ = std::thread([this] { thread_proc(); });
+	}
+
+	~RawRecordListener()
+	{
+		stop_requested_ = true;
+		thread_.join();
+	}
+
+	// Inherited via QueueSinkListener, called when the sink is connected to the stream
+	bool sinkConnected(ic4::QueueSink& sink, const ic4::ImageType& frameType, size_t min_buffers_required) override
+	{
+		// Every buffer waiting in the writer queue is missing from the sink's free queue
+		ic4::Error err;
+		if (!sink.allocAndQueueBuffers(min_buffers_required + queue_.capacity(), err))
+		{
+			std::cerr << "Failed to allocate buffers: " << err.message() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Inherited via QueueSinkListener, called when there are frames available in the sink's output queue
+	void framesQueued(ic4::QueueSink& sink) override
+	{
+		callbacks_active_ += 1;
+		handle_frame(sink);
+		callbacks_active_ -= 1;
+	}
+
+private:
+	void handle_frame(ic4::QueueSink& sink)
+	{
+		ic4::Error err;
+
+		// Remove a buffer from the sink's output queue even if not recording; otherwise the device runs out of buffers
+		auto buffer = sink.popOutputBuffer(err);
+		if (buffer == nullptr)
+		{
+			std::cerr << "Failed to get frame from sink: " << err.message() << std::endl;
+			return;
+		}
+
+		if (!do_write_frames_)
+		{
+			return;
+		}
+
+		// Only queue the buffer, the writer thread copies it into the container file
+		push(std::move(buffer));
+	}
+
+public:
+	// Called from the sink callback or the benchmark source. If the queue is full, the frame is dropped and counted.
+	bool push(std::shared_ptr<ic4::ImageBuffer> buffer)
+	{
+		pending_ += 1;
+		if (!queue_.try_push(std::move(buffer)))
+		{
+			pending_ -= 1;
+			queue_full_drops_ += 1;
+			return false;
+		}
+		return true;
+	}
+
+	// When disabling, also waits for a sink callback that is still running, so that no frame is pushed after this returns
+	// and flush sees every frame that is going to be written
+	void enable_recording(bool enable)
+	{
+		do_write_frames_ = enable;
+		if (!enable)
+		{
+			while (callbacks_active_ > 0)
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// Waits until all queued frames were written into the container. Call before raw_container::writer::close.
+	void flush()
+	{
+		while (pending_ > 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	size_t queue_depth() const
+	{
+		return queue_.capacity();
+	}
+
+	Statistics statistics() const
+	{
+		Statistics stats = {};
+		stats.frames_written = frames_written_;
+		stats.queue_full_drops = queue_full_drops_;
+		stats.container_full_drops = container_full_drops_;
+		stats.queue_high_water_mark = queue_.high_water_mark();
+		stats.write_ms_mean = stats.frames_written ? write_ns_total_ / 1e6 / stats.frames_written : 0.0;
+		stats.write_ms_max = write_ns_max_ / 1e6;
+		return stats;
+	}
+};
+
+static void print_statistics(const RawRecordListener& listener, uint64_t frame_bytes, double elapsed_s)
+{
+	auto stats = listener.statistics();
+	std::cout << "Wrote " << stats.frames_written << " frames, " << stats.container_full_drops << " frames dropped because the file was full" << std::endl;
+	std::cout << "Queue: depth " << listener.queue_depth() << ", high-water mark " << stats.queue_high_water_mark
+		<< ", " << stats.queue_full_drops << " frames dropped because the queue was full" << std::endl;
+	std::cout << "Write time per frame: mean " << stats.write_ms_mean << " ms, max " << stats.write_ms_max << " ms" << std::endl;
+	if (elapsed_s > 0)
+	{
+		std::cout << "Throughput: " << stats.frames_written * frame_bytes / elapsed_s / (1024 * 1024) << " MB/s" << std::endl;
+	}
+}
+
+// Writes synthetic Mono8 frames through the writer thread as fast as the source buffers are returned, without a device.
+// This measures the sustained write bandwidth of the file system the container is written to.
+static int run_benchmark(const std::string& file_name, uint64_t frames, int width, int height, size_t queue_depth)
+{
+	ic4::Error err;
+	ic4::ImageType image_type(ic4::PixelFormat::Mono8, width, height);
+
+	raw_container::writer container;
+	if (!container.create(file_name, image_type, frames))
+	{
+		std::cerr << "Failed to create " << file_name << std::endl;
+		return -2;
+	}
+
+	// The same number of buffers the listener allocates, assuming the sink requires 4
+	ic4::BufferPool pool;
+	std::vector<std::shared_ptr<ic4::ImageBuffer>> buffers;
+	for (size_t i = 0; i < 4 + queue_depth; ++i)
+	{
+		auto buffer = pool.getBuffer(image_type, {}, err);
+		if (buffer == nullptr)
+		{
+			std::cerr << "Failed to allocate buffer: " << err.message() << std::endl;
+			return -3;
+		}
+		std::memset(buffer->ptr(), static_cast<int>(i), buffer->bufferSize());
+		buffers.push_back(buffer);
+	}
+
+	std::cout << "Benchmark: " << frames << " frames " << width << "x" << height << " Mono8, queue depth " << queue_depth << std::endl;
+
+	RawRecordListener listener(container, queue_depth);
+
+	auto begin = std::chrono::steady_clock::now();
+	for (uint64_t produced = 0; produced < frames; )
+	{
+		// A buffer is free if nobody but the source holds a reference
+		for (auto&& buffer : buffers)
+		{
+			if (produced < frames && buffer.use_count() == 1)
+			{
+				listener.push(buffer);
+				produced += 1;
+			}
+		}
+		std::this_thread::yield();
+	}
+	listener.flush();
+	container.close();
+	auto elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	print_statistics(listener, container.frame_bytes(), elapsed_s);
+	return 0;
+}
+
+// Prints the contents of a container file, and optionally saves one frame as a bitmap file
+static int run_read(const std::string& file_name, int64_t frame_index, const std::string& bitmap_file_name)
+{
+	raw_container::reader reader;
+	if (!reader.open(file_name))
+	{
+		std::cerr << "Failed to open " << file_name << " as raw container file" << std::endl;
+		return -2;
+	}
+
+	auto image_type = reader.image_type();
+	std::cout << "ImageType: " << ic4::to_string(image_type) << std::endl;
+	std::cout << "Frames: " << reader.frame_count() << std::endl;
+	if (reader.recovered())
+	{
+		std::cout << "The file was not closed by the writer, the frames were recovered from the index" << std::endl;
+	}
+
+	raw_container::frame_view frame = {};
+	if (frame_index < 0)
+	{
+		// Check the device frame numbers for gaps
+		uint64_t gaps = 0;
+		raw_container::frame_view first = {};
+		if (reader.frame(0, first))
+		{
+			auto prev = first;
+			for (uint64_t i = 1; reader.frame(i, frame); ++i)
+			{
+				if (frame.device_frame_number != prev.device_frame_number + 1)
+				{
+					gaps += 1;
+				}
+				prev = frame;
+			}
+			std::cout << "Device frame numbers " << first.device_frame_number << " to " << prev.device_frame_number << ", " << gaps << " gaps" << std::endl;
+			std::cout << "Duration: " << (prev.device_timestamp_ns - first.device_timestamp_ns) / 1e9 << " s" << std::endl;
+		}
+		return 0;
+	}
+
+	if (!reader.frame(static_cast<uint64_t>(frame_index), frame))
+	{
+		std::cerr << "Frame index " << frame_index << " out of range" << std::endl;
+		return -3;
+	}
+
+	std::cout << "Frame " << frame_index << ": device frame number " << frame.device_frame_number << ", device timestamp " << frame.device_timestamp_ns << " ns" << std::endl;
+
+	if (!bitmap_file_name.empty())
+	{
+		ic4::Error err;
+		ic4::BufferPool pool;
+		auto buffer = pool.getBuffer(image_type, {}, err);
+		if (buffer == nullptr)
+		{
+			std::cerr << "Failed to allocate buffer: " << err.message() << std::endl;
+			return -4;
+		}
+		auto dst = static_cast<uint8_t*>(buffer->ptr());
+		for (int y = 0; y < image_type.height(); ++y)
+		{
+			std::memcpy(dst + y * buffer->pitch(), frame.data + y * frame.pitch, static_cast<size_t>(frame.pitch));
+		}
+		if (!ic4::imageBufferSaveAsBitmap(*buffer, bitmap_file_name, {}, err))
+		{
+			std::cerr << "Failed to save " << bitmap_file_name << ": " << err.message() << std::endl;
+			return -5;
+		}
+		std::cout << "Saved " << bitmap_file_name << std::endl;
+	}
+	return 0;
+}
+
+static void print_usage()
+{
+	std::cout << "Usage: record-raw [--frames <n>] [--queue-depth <n>] [--benchmark <frames> [<width> <height>]] [<file>]" << std::endl;
+	std::cout << "       record-raw --read <file> [<frame-index> [<bitmap-file>]]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	std::string file_name = "recording.ic4raw";
+	uint64_t max_frames = 1000;
+	size_t queue_depth = 16;
+	bool benchmark = false;
+	uint64_t benchmark_frames = 0;
+	int benchmark_width = 1920;
+	int benchmark_height = 1080;
+	bool read = false;
+	int64_t read_index = -1;
+	std::string read_bitmap;
+
+	try
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "--frames" && i + 1 < argc)
+			{
+				max_frames = std::stoull(argv[++i]);
+			}
+			else if (arg == "--queue-depth" && i + 1 < argc)
+			{
+				queue_depth = std::stoul(argv[++i]);
+			}
+			else if (arg == "--benchmark" && i + 1 < argc)
+			{
+				benchmark = true;
+				benchmark_frames = std::stoull(argv[++i]);
+				if (i + 2 < argc && argv[i + 1][0] != '-')
+				{
+					benchmark_width = std::stoi(argv[++i]);
+					benchmark_height = std::stoi(argv[++i]);
+				}
+			}
+			else if (arg == "--read" && i + 1 < argc)
+			{
+				read = true;
+				file_name = argv[++i];
+				if (i + 1 < argc)
+				{
+					read_index = std::stoll(argv[++i]);
+				}
+				if (i + 1 < argc)
+				{
+					read_bitmap = argv[++i];
+				}
+			}
+			else if (arg[0] != '-')
+			{
+				file_name = arg;
+			}
+			else
+			{
+				print_usage();
+				return -1;
+			}
+		}
+	}
+	catch (const std::exception&)
+	{
+		print_usage();
+		return -1;
+	}
+
+	ic4::initLibrary();
+	std::atexit(ic4::exitLibrary);
+
+	if (read)
+	{
+		return run_read(file_name, read_index, read_bitmap);
+	}
+	if (benchmark)
+	{
+		return run_benchmark(file_name, benchmark_frames, benchmark_width, benchmark_height, queue_depth);
+	}
+
+	// Let the user select a device
+	auto device_list = ic4::DeviceEnum::enumDevices();
+	auto it = ic4_examples::console::select_from_list(device_list);
+	if (it == device_list.end())
+	{
+		return -1;
+	}
+
+	// The container and the listener are declared before the grabber, so that they outlive the stream
+	raw_container::writer container;
+	RawRecordListener listener(container, queue_depth);
+
+	// Open the selected device
+	ic4::Error err;
+	ic4::Grabber grabber;
+	if (!grabber.deviceOpen(*it, err))
+	{
+		std::cerr << "Failed to open device: " << err.message() << std::endl;
+		return -2;
+	}
+
+	// #TODO: Insert format configuration
+
+	// Create a QueueSink to capture all images arriving from the video capture device
+	auto sink = ic4::QueueSink::create(listener, err);
+	if (!sink)
+	{
+		std::cerr << "Failed to create sink: " << err.message() << std::endl;
+		return -3;
+	}
+
+	// Set up the stream without starting the acquisition, the container file has to exist before the first frame arrives
+	if (!grabber.streamSetup(sink, ic4::StreamSetupOption::DeferAcquisitionStart, err))
+	{
+		std::cerr << "Failed to setup stream: " << err.message() << std::endl;
+		return -4;
+	}
+
+	// The container file stores frames of the sink's output image type
+	auto image_type = sink->outputImageType(err);
+	if (err.isError())
+	{
+		std::cerr << "Failed to query sink output frame type: " << err.message() << std::endl;
+		grabber.streamStop();
+		return -5;
+	}
+
+	// Preallocate the file for max_frames frames before recording, so that writing a frame never extends the file
+	if (!container.create(file_name, image_type, max_frames))
+	{
+		std::cerr << "Failed to create " << file_name << " (is the pixel format supported?)" << std::endl;
+		grabber.streamStop();
+		return -6;
+	}
+
+	if (!grabber.acquisitionStart(err))
+	{
+		std::cerr << "Failed to start acquisition: " << err.message() << std::endl;
+		grabber.streamStop();
+		return -7;
+	}
+
+	std::cout << "Stream started." << std::endl;
+	std::cout << "ImageType: " << ic4::to_string(image_type) << std::endl;
+	std::cout << std::endl;
+
+	std::cout << "Recording up to " << max_frames << " frames into " << file_name << ". Press any key to stop" << std::endl;
+
+	auto begin = std::chrono::steady_clock::now();
+	listener.enable_recording(true);
+	(void)std::getchar();
+	listener.enable_recording(false);
+
+	// Wait for the writer thread to process the queued frames, then write the index and truncate the file
+	listener.flush();
+	container.close();
+	auto elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	std::cout << "Saved " << file_name << std::endl;
+	print_statistics(listener, container.frame_bytes(), elapsed_s);
+
+	// We have to call streamStop before exiting the function, because we have the listener defined as a stack variable.
+	grabber.streamStop();
+	grabber.deviceClose();
+
+	return 0;
+}
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <ic4/ic4.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// File writers that take the pixel data straight from ImageBuffer::ptr(), without copying the frame into another buffer first.
+//
+// save_bitmap writes Mono8 and BGR8 frames as bitmap files: the file header and the rows of the image buffer, bottom row first,
+// are passed to a single writev call. Other pixel formats, and all formats on Windows, are saved by ic4::imageBufferSaveAsBitmap.
+//
+// save_raw writes the image buffer's memory as-is. With direct_io, the file is opened with O_DIRECT and preallocated,
+// so the data goes from the image buffer to the disk without passing through the page cache.
+namespace direct_file_writer
+{
+	// Number of file system calls made by the writers, to compare them in a benchmark
+	inline std::atomic<uint64_t>& syscall_counter()
+	{
+		static std::atomic<uint64_t> counter(0);
+		return counter;
+	}
+
+	inline void count_syscall(uint64_t n = 1)
+	{
+		syscall_counter().fetch_add(n, std::memory_order_relaxed);
+	}
+
+	inline void put_u16(uint8_t* p, uint16_t v)
+	{
+		p[0] = static_cast<uint8_t>(v);
+		p[1] = static_cast<uint8_t>(v >> 8);
+	}
+
+	inline void put_u32(uint8_t* p, uint32_t v)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			p[i] = static_cast<uint8_t>(v >> (8 * i));
+		}
+	}
+
+	static const size_t bitmap_header_size = 14 + 40;
+	static const size_t bitmap_palette_size = 256 * 4;
+
+	// BITMAPFILEHEADER + BITMAPINFOHEADER, followed by a grayscale palette for 8-bit images
+	inline std::vector<uint8_t> make_bitmap_header(int width, int height, int bits_per_pixel)
+	{
+		uint32_t stride = ((static_cast<uint32_t>(width) * bits_per_pixel / 8) + 3) & ~3u;
+		uint32_t palette_size = bits_per_pixel == 8 ? static_cast<uint32_t>(bitmap_palette_size) : 0;
+		uint32_t data_offset = static_cast<uint32_t>(bitmap_header_size) + palette_size;
+
+		std::vector<uint8_t> hdr(data_offset, 0);
+		auto p = hdr.data();
+		p[0] = 'B';
+		p[1] = 'M';
+		put_u32(p + 2, data_offset + stride * static_cast<uint32_t>(height));
+		put_u32(p + 10, data_offset);
+
+		put_u32(p + 14, 40);
+		put_u32(p + 18, static_cast<uint32_t>(width));
+		put_u32(p + 22, static_cast<uint32_t>(height));		// Positive height: bottom-up
+		put_u16(p + 26, 1);
+		put_u16(p + 28, static_cast<uint16_t>(bits_per_pixel));
+		put_u32(p + 34, stride * static_cast<uint32_t>(height));
+		put_u32(p + 38, 2835);									// 72 dpi
+		put_u32(p + 42, 2835);
+		put_u32(p + 46, bits_per_pixel == 8 ? 256 : 0);
+
+		for (uint32_t i = 0; i < palette_size / 4; ++i)
+		{
+			auto e = p + bitmap_header_size + i * 4;
+			e[0] = e[1] = e[2] = static_cast<uint8_t>(i);
+		}
+		return hdr;
+	}
+
+#if !defined(_WIN32)
+	// Writes all iovecs, continuing after partial writes, and at most IOV_MAX of them per call
+	inline bool writev_all(int fd, std::vector<iovec>& iov, std::string& error_message)
+	{
+		size_t first = 0;
+		while (first < iov.size())
+		{
+			int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+			ssize_t n = ::writev(fd, iov.data() + first, count);
+			count_syscall();
+			if (n < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				error_message = std::strerror(errno);
+				return false;
+			}
+
+			auto written = static_cast<size_t>(n);
+			while (first < iov.size() && written >= iov[first].iov_len)
+			{
+				written -= iov[first].iov_len;
+				first += 1;
+			}
+			if (written > 0)
+			{
+				iov[first].iov_base = static_cast<uint8_t*>(iov[first].iov_base) + written;
+				iov[first].iov_len -= written;
+			}
+		}
+		return true;
+	}
+
+	// Fills iov with the bitmap file of a Mono8 or BGR8 image buffer: header, followed by the rows of the image buffer, bottom row first.
+	// header receives the header bytes and has to live as long as iov. Returns false for other pixel formats.
+	inline bool make_bitmap_iovecs(const ic4::ImageBuffer& buffer, std::vector<uint8_t>& header, std::vector<iovec>& iov)
+	{
+		auto image_type = buffer.imageType();
+
+		int bits_per_pixel = 0;
+		switch (image_type.pixel_format())
+		{
+		case ic4::PixelFormat::Mono8:
+			bits_per_pixel = 8;
+			break;
+		case ic4::PixelFormat::BGR8:
+			bits_per_pixel = 24;
+			break;
+		default:
+			return false;
+		}
+
+		int width = image_type.width();
+		int height = image_type.height();
+		size_t row_bytes = static_cast<size_t>(width) * bits_per_pixel / 8;
+		size_t stride = (row_bytes + 3) & ~size_t(3);
+		auto pitch = static_cast<size_t>(buffer.pitch());
+		auto ptr = static_cast<const uint8_t*>(buffer.ptr());
+
+		static const uint8_t padding[4] = {};
+		header = make_bitmap_header(width, height, bits_per_pixel);
+
+		iov.clear();
+		iov.reserve(1 + 2 * static_cast<size_t>(height));
+		iov.push_back({ header.data(), header.size() });
+		for (int y = height - 1; y >= 0; --y)
+		{
+			auto row = const_cast<uint8_t*>(ptr + y * pitch);
+			if (pitch >= stride)
+			{
+				// The row padding of the image buffer covers the padding of the bitmap row
+				iov.push_back({ row, stride });
+			}
+			else
+			{
+				iov.push_back({ row, row_bytes });
+				iov.push_back({ const_cast<uint8_t*>(padding), stride - row_bytes });
+			}
+		}
+		return true;
+	}
+#endif
+
+	inline bool save_bitmap(const ic4::ImageBuffer& buffer, const std::string& file_name, std::string& error_message)
+	{
+#if !defined(_WIN32)
+		std::vector<uint8_t> header;
+		std::vector<iovec> iov;
+		if (make_bitmap_iovecs(buffer, header, iov))
+		{
+			int fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			count_syscall();
+			if (fd < 0)
+			{
+				error_message = std::strerror(errno);
+				return false;
+			}
+			bool ok = writev_all(fd, iov, error_message);
+			count_syscall();
+			if (::close(fd) != 0 && ok)
+			{
+				error_message = std::strerror(errno);
+				ok = false;
+			}
+			return ok;
+		}
+#endif
+
+		ic4::Error err;
+		if (!ic4::imageBufferSaveAsBitmap(buffer, file_name, {}, err))
+		{
+			error_message = err.message();
+			return false;
+		}
+		return true;
+	}
+
+	inline bool save_raw(const ic4::ImageBuffer& buffer, const std::string& file_name, bool direct_io, std::string& error_message)
+	{
+		auto ptr = static_cast<const uint8_t*>(buffer.ptr());
+		auto size = buffer.bufferSize();
+
+#if defined(__linux__)
+		// O_DIRECT requires the memory address, file offset and length to be multiples of the logical block size.
+		// The aligned part is written directly, the remainder after clearing O_DIRECT.
+		const size_t block_size = 4096;
+		bool aligned = direct_io && reinterpret_cast<uintptr_t>(ptr) % block_size == 0;
+
+		int fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | (aligned ? O_DIRECT : 0), 0644);
+		count_syscall();
+		if (fd < 0 && aligned && errno == EINVAL)
+		{
+			// The file system does not support O_DIRECT
+			aligned = false;
+			fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			count_syscall();
+		}
+		if (fd < 0)
+		{
+			error_message = std::strerror(errno);
+			return false;
+		}
+
+		// Allocate all blocks of the file before writing, so the write does not extend the file piece by piece
+		if (direct_io)
+		{
+			::posix_fallocate(fd, 0, static_cast<off_t>(size));
+			count_syscall();
+		}
+
+		size_t offset = 0;
+		size_t direct_size = aligned ? size / block_size * block_size : 0;
+		while (offset < size)
+		{
+			if (offset == direct_size && aligned)
+			{
+				::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_DIRECT);
+				count_syscall(2);
+				aligned = false;
+			}
+			size_t end = offset < direct_size ? direct_size : size;
+			ssize_t n = ::pwrite(fd, ptr + offset, end - offset, static_cast<off_t>(offset));
+			count_syscall();
+			if (n < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				error_message = std::strerror(errno);
+				::close(fd);
+				return false;
+			}
+			offset += static_cast<size_t>(n);
+		}
+
+		count_syscall();
+		if (::close(fd) != 0)
+		{
+			error_message = std::strerror(errno);
+			return false;
+		}
+		return true;
+#else
+		(void)direct_io;
+
+		std::ofstream f(file_name, std::ios::binary | std::ios::trunc);
+		f.write(reinterpret_cast<const char*>(ptr), static_cast<std::streamsize>(size));
+		if (!f)
+		{
+			error_message = "Failed to write file";
+			return false;
+		}
+		return true;
+#endif
+	}
+}
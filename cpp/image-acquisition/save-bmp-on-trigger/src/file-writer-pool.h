@@ -0,0 +1,262 @@
+#pragma once
+
+#include <ic4/ic4.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes image buffers into files on a set of worker threads.
+//
+// submit never blocks: it appends the buffer to a bounded queue, or drops it if the queue is full. The pool keeps the
+// buffer until its file is written and then releases it, which returns it to the sink's free queue.
+// For every file, the time from submit to the end of the write is measured, so a slow target shows up as latency
+// and queue depth instead of as sink underruns.
+//
+// A worker thread either writes one file at a time with a WriteFunction, or takes up to max_batch queued files at once
+// and passes them to a BatchWriteFunction (see UringFileWriter).
+class FileWriterPool
+{
+public:
+	using WriteFunction = std::function<bool(const ic4::ImageBuffer& buffer, const std::string& file_name, std::string& error_message)>;
+
+	struct WriteRequest
+	{
+		const ic4::ImageBuffer* buffer;
+		const std::string* file_name;
+		bool ok;
+		std::string error_message;
+	};
+	using BatchWriteFunction = std::function<void(std::vector<WriteRequest>& batch)>;
+
+	struct Statistics
+	{
+		uint64_t files_written;
+		uint64_t write_errors;
+		uint64_t queue_full_drops;
+		size_t queue_high_water_mark;
+		double latency_ms_mean;
+		double latency_ms_max;
+		double write_ms_mean;
+		double write_ms_max;
+	};
+
+private:
+	struct Job
+	{
+		std::shared_ptr<ic4::ImageBuffer> buffer;
+		std::string file_name;
+		std::chrono::steady_clock::time_point submitted;
+	};
+
+	BatchWriteFunction write_batch_;
+	size_t capacity_;
+	size_t max_batch_;
+	bool print_files_;
+
+	std::mutex mtx_;
+	std::condition_variable cond_;
+	std::deque<Job> queue_;
+	size_t in_progress_;
+	bool stop_requested_;
+	std::vector<std::thread> threads_;
+
+	// Protected by mtx_
+	uint64_t files_written_;
+	uint64_t write_errors_;
+	uint64_t queue_full_drops_;
+	size_t queue_high_water_mark_;
+	double latency_ms_total_;
+	double latency_ms_max_;
+	double write_ms_total_;
+	double write_ms_max_;
+
+	void thread_proc()
+	{
+		std::vector<Job> jobs;
+		std::vector<WriteRequest> batch;
+
+		std::unique_lock<std::mutex> lck(mtx_);
+
+		while (true)
+		{
+			cond_.wait(lck, [this] { return stop_requested_ || !queue_.empty(); });
+			if (queue_.empty())
+			{
+				return;
+			}
+
+			jobs.clear();
+			while (!queue_.empty() && jobs.size() < max_batch_)
+			{
+				jobs.push_back(std::move(queue_.front()));
+				queue_.pop_front();
+			}
+			auto queue_depth = queue_.size();
+			auto print_files = print_files_;
+			in_progress_ += jobs.size();
+			lck.unlock();
+
+			batch.clear();
+			for (auto&& job : jobs)
+			{
+				batch.push_back({ job.buffer.get(), &job.file_name, false, {} });
+			}
+
+			auto begin = std::chrono::steady_clock::now();
+			write_batch_(batch);
+			auto end = std::chrono::steady_clock::now();
+
+			// Return the buffers to the sink before doing anything else
+			for (auto&& job : jobs)
+			{
+				job.buffer.reset();
+			}
+
+			// The write time of a file in a batch is its share of the batch
+			double write_ms = std::chrono::duration<double, std::milli>(end - begin).count() / jobs.size();
+
+			for (size_t i = 0; i < jobs.size(); ++i)
+			{
+				double latency_ms = std::chrono::duration<double, std::milli>(end - jobs[i].submitted).count();
+
+				if (!batch[i].ok)
+				{
+					std::cerr << "Failed to save " << jobs[i].file_name << ": " << batch[i].error_message << std::endl;
+				}
+				else if (print_files)
+				{
+					std::cout << "Saved image " << jobs[i].file_name << " (write " << write_ms << " ms, latency " << latency_ms << " ms, queue depth " << queue_depth << ")" << std::endl;
+				}
+
+				lck.lock();
+				if (batch[i].ok)
+				{
+					files_written_ += 1;
+					latency_ms_total_ += latency_ms;
+					latency_ms_max_ = std::max(latency_ms_max_, latency_ms);
+					write_ms_total_ += write_ms;
+					write_ms_max_ = std::max(write_ms_max_, write_ms);
+				}
+				else
+				{
+					write_errors_ += 1;
+				}
+				lck.unlock();
+			}
+
+			lck.lock();
+			in_progress_ -= jobs.size();
+			cond_.notify_all();
+		}
+	}
+
+public:
+	FileWriterPool(WriteFunction write, size_t num_threads, size_t capacity)
+		: FileWriterPool([write](std::vector<WriteRequest>& batch)
+			{
+				for (auto&& req : batch)
+				{
+					req.ok = write(*req.buffer, *req.file_name, req.error_message);
+				}
+			}, num_threads, capacity, 1)
+	{
+	}
+
+	FileWriterPool(BatchWriteFunction write_batch, size_t num_threads, size_t capacity, size_t max_batch)
+		: write_batch_(std::move(write_batch))
+		, capacity_(capacity)
+		, max_batch_(std::max<size_t>(max_batch, 1))
+		, print_files_(true)
+		, in_progress_(0)
+		, stop_requested_(false)
+		, files_written_(0)
+		, write_errors_(0)
+		, queue_full_drops_(0)
+		, queue_high_water_mark_(0)
+		, latency_ms_total_(0)
+		, latency_ms_max_(0)
+		, write_ms_total_(0)
+		, write_ms_max_(0)
+	{
+		for (size_t i = 0; i < std::max<size_t>(num_threads, 1); ++i)
+		{
+			threads_.emplace_back([this] { thread_proc(); });
+		}
+	}
+
+	// Writes the queued files, then stops the worker threads
+	~FileWriterPool()
+	{
+		{
+			std::lock_guard<std::mutex> lck(mtx_);
+			stop_requested_ = true;
+		}
+		cond_.notify_all();
+		for (auto&& t : threads_)
+		{
+			t.join();
+		}
+	}
+
+	// Number of buffers the pool can hold at the same time: the queued ones and one batch per worker thread
+	size_t max_buffers_held() const
+	{
+		return capacity_ + threads_.size() * max_batch_;
+	}
+
+	// Print a line for every saved file, enabled by default
+	void print_files(bool enable)
+	{
+		std::lock_guard<std::mutex> lck(mtx_);
+		print_files_ = enable;
+	}
+
+	// Called from the sink callback. If the queue is full, the buffer is released immediately and counted as dropped.
+	bool submit(std::shared_ptr<ic4::ImageBuffer> buffer, std::string file_name)
+	{
+		{
+			std::lock_guard<std::mutex> lck(mtx_);
+			if (queue_.size() >= capacity_)
+			{
+				queue_full_drops_ += 1;
+				return false;
+			}
+			queue_.push_back({ std::move(buffer), std::move(file_name), std::chrono::steady_clock::now() });
+			queue_high_water_mark_ = std::max(queue_high_water_mark_, queue_.size());
+		}
+		cond_.notify_one();
+		return true;
+	}
+
+	// Waits until all submitted files are written
+	void flush()
+	{
+		std::unique_lock<std::mutex> lck(mtx_);
+		cond_.wait(lck, [this] { return queue_.empty() && in_progress_ == 0; });
+	}
+
+	Statistics statistics()
+	{
+		std::lock_guard<std::mutex> lck(mtx_);
+
+		Statistics stats = {};
+		stats.files_written = files_written_;
+		stats.write_errors = write_errors_;
+		stats.queue_full_drops = queue_full_drops_;
+		stats.queue_high_water_mark = queue_high_water_mark_;
+		stats.latency_ms_mean = files_written_ ? latency_ms_total_ / files_written_ : 0.0;
+		stats.latency_ms_max = latency_ms_max_;
+		stats.write_ms_mean = files_written_ ? write_ms_total_ / files_written_ : 0.0;
+		stats.write_ms_max = write_ms_max_;
+		return stats;
+	}
+};
@@ -2,21 +2,50 @@
 
 #include <console-helper.h>
 
+#include "direct-file-writer.h"
+#include "file-writer-pool.h"
+#include "uring-file-writer.h"
+
 #include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 // Define QueueSinkListener-derived class that saves all received frames in bitmap files
+// The files are written by a FileWriterPool, so that the sink callback never waits for the disk
 class SaveAsBmpListener : public ic4::QueueSinkListener
 {
 private:
 	std::string path_base_;
+	std::string extension_;
 	int counter_;
+	FileWriterPool& writer_pool_;
 
 public:
-	SaveAsBmpListener(std::string path_base)
+	SaveAsBmpListener(std::string path_base, std::string extension, FileWriterPool& writer_pool)
 		: path_base_(std::move(path_base))
+		, extension_(std::move(extension))
 		, counter_(0)
+		, writer_pool_(writer_pool)
+	{
+	}
+
+	// Inherited via QueueSinkListener, called when the sink is connected to the stream
+	bool sinkConnected(ic4::QueueSink& sink, const ic4::ImageType& frameType, size_t min_buffers_required) override
 	{
+		// Every buffer held by the writer pool is missing from the sink's free queue.
+		// Allocate enough buffers up front so that a trigger burst does not run out of buffers while files are written.
+		ic4::Error err;
+		if (!sink.allocAndQueueBuffers(min_buffers_required + writer_pool_.max_buffers_held(), err))
+		{
+			std::cerr << "Failed to allocate buffers: " << err.message() << std::endl;
+			return false;
+		}
+		return true;
 	}
 
 	// Inherited via QueueSinkListener, called when there are frames available in the sink's output queue
@@ -35,28 +64,232 @@ public:
 			}
 
 			// Generate a file name for the bitmap file
-			auto file_name = path_base_ + std::to_string(counter_) + ".bmp";
+			auto file_name = path_base_ + std::to_string(counter_) + extension_;
 
-			// Save the image buffer in the bitmap file
-			if (!ic4::imageBufferSaveAsBitmap(*buffer, file_name, {}, err))
+			// Pass the buffer to the writer pool, which releases it after saving the bitmap file.
+			// If the writer queue is full, the pool drops the image and counts it in its statistics.
+			if (writer_pool_.submit(std::move(buffer), file_name))
 			{
-				std::cerr << "Failed save buffer: " << err.message() << std::endl;
+				counter_ += 1;
 			}
-			else
+		}
+	}
+};
+
+// Selects the function that writes a file:
+// - bitmap writes Mono8 and BGR8 bitmap files straight from the image buffer (see direct-file-writer.h)
+// - ic4 uses imageBufferSaveAsBitmap for all pixel formats
+// - raw and raw-direct write the image buffer's memory as-is, raw-direct bypasses the page cache
+static FileWriterPool::WriteFunction make_write_function(const std::string& writer)
+{
+	if (writer == "ic4")
+	{
+		return [](const ic4::ImageBuffer& buffer, const std::string& file_name, std::string& error_message)
+		{
+			ic4::Error err;
+			if (!ic4::imageBufferSaveAsBitmap(buffer, file_name, {}, err))
 			{
-				std::cout << "Saved image " << file_name << std::endl;
+				error_message = err.message();
+				return false;
+			}
+			return true;
+		};
+	}
+	if (writer == "raw" || writer == "raw-direct")
+	{
+		bool direct_io = writer == "raw-direct";
+		return [direct_io](const ic4::ImageBuffer& buffer, const std::string& file_name, std::string& error_message)
+		{
+			return direct_file_writer::save_raw(buffer, file_name, direct_io, error_message);
+		};
+	}
+	return direct_file_writer::save_bitmap;
+}
 
-				counter_ += 1;
+// Creates the writer pool for the --writer and --backend options.
+// The uring backend writes batches of files on a single worker thread. If io_uring is not available, or the writer is ic4,
+// the files are written by a pool of num_writers threads instead. uring receives the UringFileWriter and has to outlive the pool.
+static std::unique_ptr<FileWriterPool> create_writer_pool(const std::string& writer, const std::string& backend, size_t num_writers, size_t queue_depth, std::unique_ptr<UringFileWriter>& uring)
+{
+	if (backend == "uring" && writer != "ic4")
+	{
+		auto format = UringFileWriter::Format::Bitmap;
+		if (writer == "raw")
+		{
+			format = UringFileWriter::Format::Raw;
+		}
+		else if (writer == "raw-direct")
+		{
+			format = UringFileWriter::Format::RawDirect;
+		}
+
+		uring = std::make_unique<UringFileWriter>(format);
+		std::string error_message;
+		if (uring->init(error_message))
+		{
+			auto writer_ptr = uring.get();
+			return std::make_unique<FileWriterPool>([writer_ptr](std::vector<FileWriterPool::WriteRequest>& batch) { writer_ptr->write_batch(batch); },
+				1, queue_depth, UringFileWriter::max_batch);
+		}
+
+		std::cout << "io_uring is not available (" << error_message << "), using a thread pool" << std::endl;
+		uring.reset();
+	}
+	return std::make_unique<FileWriterPool>(make_write_function(writer), num_writers, queue_depth);
+}
+
+// Saves synthetic Mono8 frames with the thread pool and the io_uring backend, without a device, and compares
+// frames per second and file system calls per frame. Like a QueueSink, the source has a fixed set of buffers,
+// and a frame is submitted as soon as a buffer is free again.
+static int run_benchmark(const std::string& writer, uint64_t frames, int width, int height, size_t num_writers, size_t queue_depth)
+{
+	ic4::ImageType image_type(ic4::PixelFormat::Mono8, width, height);
+	std::string extension = (writer == "raw" || writer == "raw-direct") ? ".raw" : ".bmp";
+
+	std::cout << "Benchmark: " << frames << " frames " << width << "x" << height << " Mono8, writer " << writer << std::endl;
+
+	for (std::string backend : { "threads", "uring" })
+	{
+		std::unique_ptr<UringFileWriter> uring;
+		auto writer_pool = create_writer_pool(writer, backend, num_writers, queue_depth, uring);
+		if (backend == "uring" && !uring)
+		{
+			continue;
+		}
+		writer_pool->print_files(false);
+
+		// As many buffers as the queue can hold, so that no frame is dropped because the queue is full
+		ic4::Error err;
+		ic4::BufferPool buffer_pool;
+		std::vector<std::shared_ptr<ic4::ImageBuffer>> buffers;
+		for (size_t i = 0; i < queue_depth; ++i)
+		{
+			auto buffer = buffer_pool.getBuffer(image_type, {}, err);
+			if (buffer == nullptr)
+			{
+				std::cerr << "Failed to allocate buffer: " << err.message() << std::endl;
+				return -3;
+			}
+			buffers.push_back(buffer);
+		}
+
+		std::string path_base = "./benchmark_" + backend + "_";
+		auto syscalls_before = direct_file_writer::syscall_counter().load();
+		auto begin = std::chrono::steady_clock::now();
+
+		for (uint64_t submitted = 0; submitted < frames; )
+		{
+			// A buffer is free if nobody but the source holds a reference
+			for (auto&& buffer : buffers)
+			{
+				if (submitted < frames && buffer.use_count() == 1)
+				{
+					writer_pool->submit(buffer, path_base + std::to_string(submitted) + extension);
+					submitted += 1;
+				}
 			}
+			std::this_thread::yield();
+		}
+		writer_pool->flush();
+
+		auto elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		auto syscalls = direct_file_writer::syscall_counter().load() - syscalls_before;
+		auto stats = writer_pool->statistics();
+
+		std::cout << backend << ": " << stats.files_written / elapsed_s << " frames/s, "
+			<< stats.files_written * static_cast<double>(buffers[0]->bufferSize()) / elapsed_s / (1024 * 1024) << " MB/s";
+		if (writer != "ic4")
+		{
+			std::cout << ", " << static_cast<double>(syscalls) / frames << " file system calls per frame";
+		}
+		std::cout << ", " << stats.write_errors << " errors" << std::endl;
+
+		for (uint64_t i = 0; i < frames; ++i)
+		{
+			std::remove((path_base + std::to_string(i) + extension).c_str());
 		}
 	}
-};
+	return 0;
+}
+
+static void print_usage()
+{
+	std::cout << "Usage: save-bmp-on-trigger [--writers <n>] [--queue-depth <n>] [--writer bitmap|ic4|raw|raw-direct] [--backend threads|uring] [--benchmark <frames> [<width> <height>]]" << std::endl;
+}
 
-int main()
+int main(int argc, char** argv)
 {
+	size_t num_writers = 2;
+	size_t queue_depth = 32;
+	std::string writer = "bitmap";
+	std::string backend = "threads";
+	bool benchmark = false;
+	uint64_t benchmark_frames = 0;
+	int benchmark_width = 640;
+	int benchmark_height = 480;
+
+	try
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "--writers" && i + 1 < argc)
+			{
+				num_writers = std::stoul(argv[++i]);
+			}
+			else if (arg == "--queue-depth" && i + 1 < argc)
+			{
+				queue_depth = std::stoul(argv[++i]);
+			}
+			else if (arg == "--writer" && i + 1 < argc)
+			{
+				writer = argv[++i];
+				if (writer != "bitmap" && writer != "ic4" && writer != "raw" && writer != "raw-direct")
+				{
+					print_usage();
+					return -1;
+				}
+			}
+			else if (arg == "--backend" && i + 1 < argc)
+			{
+				backend = argv[++i];
+				if (backend != "threads" && backend != "uring")
+				{
+					print_usage();
+					return -1;
+				}
+			}
+			else if (arg == "--benchmark" && i + 1 < argc)
+			{
+				benchmark = true;
+				benchmark_frames = std::stoull(argv[++i]);
+				if (i + 2 < argc)
+				{
+					benchmark_width = std::stoi(argv[++i]);
+					benchmark_height = std::stoi(argv[++i]);
+				}
+			}
+			else
+			{
+				print_usage();
+				return -1;
+			}
+		}
+	}
+	catch (const std::exception&)
+	{
+		print_usage();
+		return -1;
+	}
+
 	ic4::initLibrary();
 	std::atexit(ic4::exitLibrary);
 
+	if (benchmark)
+	{
+		return run_benchmark(writer, benchmark_frames, benchmark_width, benchmark_height, num_writers, queue_depth);
+	}
+
 	// Let the user select a device
 	auto device_list = ic4::DeviceEnum::enumDevices();
 	auto it = ic4_examples::console::select_from_list(device_list);
@@ -96,9 +329,14 @@ int main()
 		return -4;
 	}
 	
+	// Create the pool that writes the files
+	std::unique_ptr<UringFileWriter> uring;
+	auto writer_pool = create_writer_pool(writer, backend, num_writers, queue_depth, uring);
+	std::string extension = (writer == "raw" || writer == "raw-direct") ? ".raw" : ".bmp";
+
 	// Create an instance of the listener type defined above, specifyin a partial file name
 	std::string path_base = "./test_image";
-	SaveAsBmpListener listener(path_base);
+	SaveAsBmpListener listener(path_base, extension, *writer_pool);
 
 	// Create a QueueSink to capture all images arriving from the video capture device
 	auto sink = ic4::QueueSink::create(listener, err);
@@ -108,6 +346,12 @@ int main()
 		return -3;
 	}
 
+	// The sink allocates its buffers in streamSetup, buffers registered with the ring before are no longer valid
+	if (uring)
+	{
+		uring->buffers_changed();
+	}
+
 	// Start the video stream into the sink
 	if (!grabber.streamSetup(sink, ic4::StreamSetupOption::AcquisitionStart, err))
 	{
@@ -117,7 +361,13 @@ int main()
 
 	std::cout << "Stream started." << std::endl;
 	std::cout << "Waiting for triggers" << std::endl;
-	std::cout << "All images will be saved as " << path_base << "*.bmp" << std::endl;
+	std::cout << "All images will be saved as " << path_base << "*" << extension << std::endl;
+	if (extension == ".raw")
+	{
+		// Raw files have no header, the image type is needed to interpret them
+		auto image_type = sink->outputImageType(err);
+		std::cout << "Raw files contain the image buffer memory of " << ic4::to_string(image_type) << " frames" << std::endl;
+	}
 	std::cout << std::endl;
 
 	std::cout << "Input hardware triggers, or press ENTER to issue a software trigger" << std::endl;
@@ -141,5 +391,15 @@ int main()
 	grabber.streamStop();
 	grabber.deviceClose();
 
+	// Wait for the files that are still queued
+	writer_pool->flush();
+
+	auto stats = writer_pool->statistics();
+	std::cout << "Saved " << stats.files_written << " images, " << stats.write_errors << " errors, "
+		<< stats.queue_full_drops << " images dropped because the writer queue was full" << std::endl;
+	std::cout << "Writer queue: depth " << queue_depth << ", high-water mark " << stats.queue_high_water_mark << ", " << (uring ? "io_uring" : std::to_string(num_writers) + " writer threads") << std::endl;
+	std::cout << "Write time per file: mean " << stats.write_ms_mean << " ms, max " << stats.write_ms_max << " ms" << std::endl;
+	std::cout << "Latency from trigger callback to file written: mean " << stats.latency_ms_mean << " ms, max " << stats.latency_ms_max << " ms" << std::endl;
+
 	return 0;
 }
\ No newline at end of file
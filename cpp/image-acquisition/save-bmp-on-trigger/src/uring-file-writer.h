@@ -0,0 +1,706 @@
+#pragma once
+
+#include "direct-file-writer.h"
+#include "file-writer-pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// Older kernel headers lack the operations used below; io_uring_probe and IO_URING_OP_SUPPORTED were added with them in Linux 5.6
+#if defined(IO_URING_OP_SUPPORTED)
+#define IC4_EXAMPLES_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#if defined(IC4_EXAMPLES_HAVE_IO_URING)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Writes batches of files through an io_uring, as the BatchWriteFunction of a FileWriterPool with a single worker thread.
+//
+// A batch of N files takes two io_uring_enter calls instead of at least 3 * N system calls:
+//	1. openat for all files of the batch
+//	2. for every opened file, its writes and the close, linked into a chain
+//
+// Bitmap files are written with IORING_OP_WRITEV from the same iovecs direct_file_writer::save_bitmap uses.
+// Raw files are written with IORING_OP_WRITE_FIXED from registered buffers: the sink reuses a fixed set of buffers,
+// so after the first few frames all of them are registered. A registration is identified by address and size; call
+// buffers_changed before the sink allocates a new set of buffers, e.g. before every streamSetup, so that memory that was
+// freed and reallocated at the same address is registered again.
+//
+// Raw files are opened with O_DIRECT if the buffer is aligned. If the file system rejects O_DIRECT with EINVAL, the file is
+// opened or written again without it, and O_DIRECT is not used for later files.
+//
+// The ring is set up with raw system calls, liburing is not required. init fails if the kernel does not support io_uring
+// or one of the operations (Linux 5.6 or newer is required), or io_uring is blocked, e.g. by a container's seccomp profile.
+class UringFileWriter
+{
+public:
+	enum class Format
+	{
+		Bitmap,
+		Raw,
+		RawDirect,
+	};
+
+	static const size_t max_batch = 16;
+
+#if defined(IC4_EXAMPLES_HAVE_IO_URING)
+private:
+	static const unsigned ring_entries = 64;
+	static const size_t max_registered_buffers = 64;
+
+	enum OpKind
+	{
+		OpOpen,
+		OpWrite,
+		OpClose,
+		OpFallocate,
+	};
+
+	struct FileOp
+	{
+		bool use_ring;
+		int fd;
+		int open_flags;
+		int error;
+		uint64_t bytes_expected;
+		uint64_t bytes_written;
+		std::vector<uint8_t> header;
+		std::vector<iovec> iov;
+	};
+
+	Format format_;
+
+	int ring_fd_ = -1;
+	void* sq_ptr_ = nullptr;
+	size_t sq_size_ = 0;
+	void* cq_ptr_ = nullptr;
+	size_t cq_size_ = 0;
+	io_uring_sqe* sqes_ = nullptr;
+	size_t sqes_size_ = 0;
+
+	unsigned* sq_tail_ = nullptr;
+	unsigned* sq_mask_ = nullptr;
+	unsigned* sq_array_ = nullptr;
+	unsigned sq_entries_ = 0;
+	unsigned sq_tail_local_ = 0;
+
+	unsigned* cq_head_ = nullptr;
+	unsigned* cq_tail_ = nullptr;
+	unsigned* cq_mask_ = nullptr;
+	io_uring_cqe* cqes_ = nullptr;
+
+	bool registration_enabled_ = true;
+	bool buffers_registered_ = false;
+	std::vector<iovec> registered_;
+	std::unordered_map<const void*, int> registered_index_;
+	std::atomic<unsigned> buffers_generation_{ 0 };
+	unsigned registered_generation_ = 0;
+
+	bool direct_io_supported_ = true;
+
+	// Set when io_uring_enter failed, later files are written by direct_file_writer
+	bool ring_failed_ = false;
+
+	std::vector<FileOp> ops_;
+
+	static int sys_io_uring_setup(unsigned entries, io_uring_params* p)
+	{
+		return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+	}
+
+	static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+	{
+		return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+	}
+
+	static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+	{
+		return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+	}
+
+	bool probe_ops(std::string& error_message)
+	{
+		const unsigned num_ops = 256;
+		std::vector<uint8_t> mem(sizeof(io_uring_probe) + num_ops * sizeof(io_uring_probe_op), 0);
+		auto probe = reinterpret_cast<io_uring_probe*>(mem.data());
+		if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PROBE, probe, num_ops) < 0)
+		{
+			error_message = std::string("io_uring does not support probing operations: ") + std::strerror(errno);
+			return false;
+		}
+
+		for (auto op : { IORING_OP_OPENAT, IORING_OP_WRITEV, IORING_OP_WRITE, IORING_OP_WRITE_FIXED, IORING_OP_CLOSE, IORING_OP_FALLOCATE })
+		{
+			if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+			{
+				error_message = "io_uring does not support operation " + std::to_string(static_cast<int>(op));
+				return false;
+			}
+		}
+		return true;
+	}
+
+	io_uring_sqe* next_sqe(OpKind kind, size_t file_index)
+	{
+		unsigned index = sq_tail_local_ & *sq_mask_;
+		auto sqe = &sqes_[index];
+		std::memset(sqe, 0, sizeof(*sqe));
+		sqe->user_data = (static_cast<uint64_t>(file_index) << 2) | kind;
+		sq_array_[index] = index;
+		sq_tail_local_ += 1;
+		return sqe;
+	}
+
+	// Submits the prepared entries and calls on_complete for each of their completions.
+	//
+	// If io_uring_enter fails, the ring is not used again. The entries the kernel already took still use the batch's
+	// buffers and file descriptors, so their completions are waited for before returning the error.
+	template<typename F>
+	int submit_and_wait(unsigned count, F on_complete)
+	{
+		__atomic_store_n(sq_tail_, sq_tail_local_, __ATOMIC_RELEASE);
+
+		unsigned to_submit = count;
+		unsigned completed = 0;
+		int error = 0;
+		while (completed < count - (error != 0 ? to_submit : 0))
+		{
+			unsigned wait_for = count - (error != 0 ? to_submit : 0) - completed;
+			int ret = sys_io_uring_enter(ring_fd_, error != 0 ? 0 : to_submit, wait_for, IORING_ENTER_GETEVENTS);
+			direct_file_writer::count_syscall();
+			if (ret < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				if (error != 0)
+				{
+					// The submitted entries cannot be waited for. The ring is not used again, so at least their
+					// completions are not mistaken for those of a later batch.
+					return error;
+				}
+				error = errno;
+				ring_failed_ = true;
+				std::cerr << "io_uring_enter failed, writing without io_uring: " << std::strerror(error) << std::endl;
+				continue;
+			}
+			if (error == 0)
+			{
+				to_submit -= std::min(to_submit, static_cast<unsigned>(ret));
+			}
+
+			unsigned head = *cq_head_;
+			while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+			{
+				auto& cqe = cqes_[head & *cq_mask_];
+				on_complete(static_cast<size_t>(cqe.user_data >> 2), static_cast<OpKind>(cqe.user_data & 3), cqe.res);
+				head += 1;
+				completed += 1;
+			}
+			__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+		}
+		return error;
+	}
+
+	void unregister_buffers()
+	{
+		if (buffers_registered_)
+		{
+			sys_io_uring_register(ring_fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+			direct_file_writer::count_syscall();
+			buffers_registered_ = false;
+		}
+		registered_.clear();
+		registered_index_.clear();
+	}
+
+	// Index of the registered buffer for the memory of buffer, or -1
+	int find_registered(const ic4::ImageBuffer& buffer) const
+	{
+		auto it = registered_index_.find(buffer.ptr());
+		if (it == registered_index_.end() || registered_[it->second].iov_len != buffer.bufferSize())
+		{
+			return -1;
+		}
+		return it->second;
+	}
+
+	// Registers the buffers of the batch that are not registered yet. The registration is replaced as a whole,
+	// which only happens until the sink's buffers are all known, or after buffers_changed.
+	void register_buffers(const std::vector<FileWriterPool::WriteRequest>& batch)
+	{
+		if (!registration_enabled_)
+		{
+			return;
+		}
+
+		// A new set of buffers, or a buffer of a different size at a registered address
+		bool stale = buffers_generation_ != registered_generation_;
+		for (auto&& req : batch)
+		{
+			auto it = registered_index_.find(req.buffer->ptr());
+			stale = stale || (it != registered_index_.end() && registered_[it->second].iov_len != req.buffer->bufferSize());
+		}
+		if (stale)
+		{
+			unregister_buffers();
+			registered_generation_ = buffers_generation_;
+		}
+
+		bool changed = false;
+		for (auto&& req : batch)
+		{
+			auto ptr = req.buffer->ptr();
+			if (registered_index_.count(ptr) || registered_.size() >= max_registered_buffers)
+			{
+				continue;
+			}
+			registered_index_[ptr] = static_cast<int>(registered_.size());
+			registered_.push_back({ ptr, req.buffer->bufferSize() });
+			changed = true;
+		}
+		if (!changed)
+		{
+			return;
+		}
+
+		if (buffers_registered_)
+		{
+			sys_io_uring_register(ring_fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+			direct_file_writer::count_syscall();
+			buffers_registered_ = false;
+		}
+		int ret = sys_io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, registered_.data(), static_cast<unsigned>(registered_.size()));
+		direct_file_writer::count_syscall();
+		buffers_registered_ = ret >= 0;
+		if (ret < 0)
+		{
+			// Usually RLIMIT_MEMLOCK is too small to pin the buffers
+			std::cerr << "Failed to register buffers with io_uring, writing without registered buffers: " << std::strerror(errno) << std::endl;
+			registration_enabled_ = false;
+			registered_.clear();
+			registered_index_.clear();
+		}
+	}
+
+	unsigned sqes_needed(const FileOp& op) const
+	{
+		if (format_ == Format::Bitmap)
+		{
+			return static_cast<unsigned>((op.iov.size() + IOV_MAX - 1) / IOV_MAX) + 1;
+		}
+		return (format_ == Format::RawDirect ? 3 : 2);
+	}
+
+	void write_direct(FileWriterPool::WriteRequest& req)
+	{
+		req.ok = format_ == Format::Bitmap
+			? direct_file_writer::save_bitmap(*req.buffer, *req.file_name, req.error_message)
+			: direct_file_writer::save_raw(*req.buffer, *req.file_name, format_ == Format::RawDirect && direct_io_supported_, req.error_message);
+	}
+
+	void prepare_chain(size_t i, const FileWriterPool::WriteRequest& req)
+	{
+		auto& op = ops_[i];
+
+		if (format_ == Format::Bitmap)
+		{
+			uint64_t offset = 0;
+			for (size_t first = 0; first < op.iov.size(); first += IOV_MAX)
+			{
+				auto count = std::min<size_t>(op.iov.size() - first, IOV_MAX);
+				auto sqe = next_sqe(OpWrite, i);
+				sqe->opcode = IORING_OP_WRITEV;
+				sqe->fd = op.fd;
+				sqe->addr = reinterpret_cast<uint64_t>(op.iov.data() + first);
+				sqe->len = static_cast<uint32_t>(count);
+				sqe->off = offset;
+				sqe->flags = IOSQE_IO_LINK;
+				for (size_t k = first; k < first + count; ++k)
+				{
+					offset += op.iov[k].iov_len;
+				}
+			}
+		}
+		else
+		{
+			if (format_ == Format::RawDirect)
+			{
+				// Allocate the file's blocks before the write
+				auto sqe = next_sqe(OpFallocate, i);
+				sqe->opcode = IORING_OP_FALLOCATE;
+				sqe->fd = op.fd;
+				sqe->off = 0;
+				sqe->addr = op.bytes_expected;
+				sqe->len = 0;
+				sqe->flags = IOSQE_IO_LINK;
+			}
+
+			auto registered = find_registered(*req.buffer);
+			auto sqe = next_sqe(OpWrite, i);
+			sqe->opcode = registered >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+			sqe->fd = op.fd;
+			sqe->addr = reinterpret_cast<uint64_t>(req.buffer->ptr());
+			sqe->len = static_cast<uint32_t>(op.bytes_expected);
+			sqe->off = 0;
+			sqe->flags = IOSQE_IO_LINK;
+			if (registered >= 0)
+			{
+				sqe->buf_index = static_cast<uint16_t>(registered);
+			}
+		}
+
+		auto sqe = next_sqe(OpClose, i);
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = op.fd;
+	}
+
+	void unmap()
+	{
+		if (sqes_)
+		{
+			::munmap(sqes_, sqes_size_);
+		}
+		if (cq_ptr_ && cq_ptr_ != sq_ptr_)
+		{
+			::munmap(cq_ptr_, cq_size_);
+		}
+		if (sq_ptr_)
+		{
+			::munmap(sq_ptr_, sq_size_);
+		}
+		sqes_ = nullptr;
+		cq_ptr_ = nullptr;
+		sq_ptr_ = nullptr;
+	}
+
+public:
+	explicit UringFileWriter(Format format)
+		: format_(format)
+	{
+	}
+
+	UringFileWriter(const UringFileWriter&) = delete;
+	UringFileWriter& operator=(const UringFileWriter&) = delete;
+
+	~UringFileWriter()
+	{
+		unmap();
+		if (ring_fd_ >= 0)
+		{
+			// Closing the ring also releases the registered buffers
+			::close(ring_fd_);
+		}
+	}
+
+	// Call before the sink allocates new buffers, the registered buffers are then replaced by the next batch.
+	// Can be called from any thread.
+	void buffers_changed()
+	{
+		buffers_generation_ += 1;
+	}
+
+	bool init(std::string& error_message)
+	{
+		io_uring_params p = {};
+		ring_fd_ = sys_io_uring_setup(ring_entries, &p);
+		if (ring_fd_ < 0)
+		{
+			error_message = std::string("io_uring_setup failed: ") + std::strerror(errno);
+			return false;
+		}
+
+		if (!probe_ops(error_message))
+		{
+			return false;
+		}
+
+		sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single_mmap)
+		{
+			sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+		}
+
+		sq_ptr_ = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+		if (sq_ptr_ == MAP_FAILED)
+		{
+			sq_ptr_ = nullptr;
+			error_message = std::string("Failed to map io_uring: ") + std::strerror(errno);
+			return false;
+		}
+		if (single_mmap)
+		{
+			cq_ptr_ = sq_ptr_;
+		}
+		else
+		{
+			cq_ptr_ = ::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+			if (cq_ptr_ == MAP_FAILED)
+			{
+				cq_ptr_ = nullptr;
+				error_message = std::string("Failed to map io_uring: ") + std::strerror(errno);
+				return false;
+			}
+		}
+		sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+		auto sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+		{
+			error_message = std::string("Failed to map io_uring: ") + std::strerror(errno);
+			return false;
+		}
+		sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+		auto sq = static_cast<uint8_t*>(sq_ptr_);
+		sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+		sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+		sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+		sq_entries_ = p.sq_entries;
+		sq_tail_local_ = *sq_tail_;
+
+		auto cq = static_cast<uint8_t*>(cq_ptr_);
+		cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+		cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+		cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+		cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+		return true;
+	}
+
+	// Called on the pool's worker thread
+	void write_batch(std::vector<FileWriterPool::WriteRequest>& batch)
+	{
+		if (ring_failed_)
+		{
+			for (auto&& req : batch)
+			{
+				write_direct(req);
+			}
+			return;
+		}
+
+		ops_.resize(batch.size());
+
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			auto& req = batch[i];
+			auto& op = ops_[i];
+			op.use_ring = true;
+			op.fd = -1;
+			op.open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+			op.error = 0;
+			op.bytes_written = 0;
+
+			if (format_ == Format::Bitmap)
+			{
+				op.use_ring = direct_file_writer::make_bitmap_iovecs(*req.buffer, op.header, op.iov);
+				op.bytes_expected = 0;
+				for (auto&& v : op.iov)
+				{
+					op.bytes_expected += v.iov_len;
+				}
+			}
+			else
+			{
+				op.bytes_expected = req.buffer->bufferSize();
+				// In the ring, O_DIRECT cannot be cleared for an unaligned remainder, so only use it if the whole buffer is aligned
+				if (format_ == Format::RawDirect && direct_io_supported_ && reinterpret_cast<uintptr_t>(req.buffer->ptr()) % 4096 == 0 && op.bytes_expected % 4096 == 0)
+				{
+					op.open_flags |= O_DIRECT;
+				}
+			}
+			if (op.use_ring && sqes_needed(op) > sq_entries_)
+			{
+				op.use_ring = false;
+			}
+
+			if (!op.use_ring)
+			{
+				// Pixel formats that cannot be written from the image buffer directly
+				write_direct(req);
+			}
+		}
+
+		if (format_ != Format::Bitmap)
+		{
+			register_buffers(batch);
+		}
+
+		// Phase 1: open all files of the batch. A second round opens the files without O_DIRECT that the file system
+		// rejected with EINVAL.
+		int err = 0;
+		for (int round = 0; round < 2 && err == 0; ++round)
+		{
+			unsigned count = 0;
+			for (size_t i = 0; i < batch.size(); ++i)
+			{
+				auto& op = ops_[i];
+				if (!op.use_ring || op.fd >= 0)
+				{
+					continue;
+				}
+				if (round > 0)
+				{
+					if (op.error != EINVAL || !(op.open_flags & O_DIRECT))
+					{
+						continue;
+					}
+					op.open_flags &= ~O_DIRECT;
+					op.error = 0;
+					direct_io_supported_ = false;
+				}
+				auto sqe = next_sqe(OpOpen, i);
+				sqe->opcode = IORING_OP_OPENAT;
+				sqe->fd = AT_FDCWD;
+				sqe->addr = reinterpret_cast<uint64_t>(batch[i].file_name->c_str());
+				sqe->len = 0644;
+				sqe->open_flags = static_cast<uint32_t>(op.open_flags);
+				count += 1;
+			}
+			if (count == 0)
+			{
+				break;
+			}
+
+			err = submit_and_wait(count, [this](size_t i, OpKind, int res)
+			{
+				if (res >= 0)
+				{
+					ops_[i].fd = res;
+				}
+				else
+				{
+					ops_[i].error = -res;
+				}
+			});
+		}
+
+		// Phase 2: write and close the opened files, as many chains per submission as fit into the ring
+		size_t next = 0;
+		while (err == 0 && next < batch.size())
+		{
+			unsigned used = 0;
+			for (; next < batch.size(); ++next)
+			{
+				auto& op = ops_[next];
+				if (!op.use_ring || op.fd < 0)
+				{
+					continue;
+				}
+				auto needed = sqes_needed(op);
+				if (used + needed > sq_entries_)
+				{
+					break;
+				}
+				prepare_chain(next, batch[next]);
+				used += needed;
+			}
+			if (used == 0)
+			{
+				break;
+			}
+
+			err = submit_and_wait(used, [this](size_t i, OpKind kind, int res)
+			{
+				auto& op = ops_[i];
+				if (kind == OpClose)
+				{
+					if (res == -ECANCELED)
+					{
+						// An earlier operation of the chain failed, the file is still open
+						::close(op.fd);
+						direct_file_writer::count_syscall();
+					}
+					op.fd = -1;
+				}
+				else if (res < 0)
+				{
+					if (op.error == 0 && res != -ECANCELED)
+					{
+						op.error = -res;
+					}
+				}
+				else if (kind == OpWrite)
+				{
+					op.bytes_written += static_cast<uint64_t>(res);
+				}
+			});
+		}
+
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			auto& op = ops_[i];
+			if (!op.use_ring)
+			{
+				continue;
+			}
+			bool closed = op.fd < 0;
+			if (op.fd >= 0)
+			{
+				// Only if a submission failed
+				::close(op.fd);
+				direct_file_writer::count_syscall();
+				op.fd = -1;
+			}
+			if (err != 0 && !(closed && op.error == 0 && op.bytes_written == op.bytes_expected))
+			{
+				// The file's operations were not all submitted, write it again without the ring
+				write_direct(batch[i]);
+				continue;
+			}
+
+			if (op.error == 0 && err != 0)
+			{
+				op.error = err;
+			}
+			if (op.error == EINVAL && (op.open_flags & O_DIRECT))
+			{
+				// The file system accepted O_DIRECT, but not the write. Write the file again without it.
+				direct_io_supported_ = false;
+				batch[i].ok = direct_file_writer::save_raw(*batch[i].buffer, *batch[i].file_name, false, batch[i].error_message);
+				continue;
+			}
+			batch[i].ok = op.error == 0 && op.bytes_written == op.bytes_expected;
+			if (!batch[i].ok)
+			{
+				batch[i].error_message = op.error != 0 ? std::strerror(op.error) : "Short write";
+			}
+		}
+	}
+#else
+public:
+	explicit UringFileWriter(Format)
+	{
+	}
+
+	void buffers_changed()
+	{
+	}
+
+	bool init(std::string& error_message)
+	{
+		error_message = "io_uring is only available on Linux, built with the headers of Linux 5.6 or newer";
+		return false;
+	}
+
+	void write_batch(std::vector<FileWriterPool::WriteRequest>&)
+	{
+	}
+#endif
+};
@@ -0,0 +1,469 @@
+#pragma once
+
+#include "jpeg-front-end.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+// A minimal baseline JPEG encoder for the planes produced by jpeg_front_end::convert.
+//
+// Writes a JFIF file with 4:2:0 subsampled chroma (or a grayscale file for Mono8), the quantization tables of the JPEG standard
+// scaled by the quality setting in the same way as libjpeg, the standard Huffman tables, and a floating point AAN DCT.
+// It exists so that the time spent in the color conversion front-end can be compared to the time of the whole encode.
+namespace baseline_jpeg
+{
+	// Position in the 8x8 block of the i-th coefficient in zigzag order
+	static const uint8_t zigzag_order[64] =
+	{
+		0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+		12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+		35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+		58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+	};
+
+	static const uint8_t std_luma_quant[64] =
+	{
+		16, 11, 10, 16, 24, 40, 51, 61,
+		12, 12, 14, 19, 26, 58, 60, 55,
+		14, 13, 16, 24, 40, 57, 69, 56,
+		14, 17, 22, 29, 51, 87, 80, 62,
+		18, 22, 37, 56, 68, 109, 103, 77,
+		24, 35, 55, 64, 81, 104, 113, 92,
+		49, 64, 78, 87, 103, 121, 120, 101,
+		72, 92, 95, 98, 112, 100, 103, 99,
+	};
+
+	static const uint8_t std_chroma_quant[64] =
+	{
+		17, 18, 24, 47, 99, 99, 99, 99,
+		18, 21, 26, 66, 99, 99, 99, 99,
+		24, 26, 56, 99, 99, 99, 99, 99,
+		47, 66, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99,
+	};
+
+	static const uint8_t std_dc_luma_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+	static const uint8_t std_dc_chroma_bits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+	static const uint8_t std_dc_values[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+	static const uint8_t std_ac_luma_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+	static const uint8_t std_ac_luma_values[162] =
+	{
+		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+		0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+		0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+		0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+		0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+		0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+		0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+		0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+		0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+		0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+		0xf9, 0xfa,
+	};
+
+	static const uint8_t std_ac_chroma_bits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+	static const uint8_t std_ac_chroma_values[162] =
+	{
+		0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+		0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+		0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+		0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+		0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+		0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+		0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+		0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+		0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+		0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+		0xf9, 0xfa,
+	};
+
+	struct huffman_table
+	{
+		const uint8_t* bits;
+		const uint8_t* values;
+		int num_values;
+		uint16_t code[256];
+		uint8_t size[256];
+
+		void init(const uint8_t* table_bits, const uint8_t* table_values, int count)
+		{
+			bits = table_bits;
+			values = table_values;
+			num_values = count;
+
+			uint16_t next_code = 0;
+			int k = 0;
+			for (int len = 1; len <= 16; ++len)
+			{
+				for (int i = 0; i < bits[len - 1]; ++i, ++k)
+				{
+					code[values[k]] = next_code++;
+					size[values[k]] = static_cast<uint8_t>(len);
+				}
+				next_code <<= 1;
+			}
+		}
+	};
+
+	class encoder
+	{
+		uint8_t quant_[2][64];			// Natural order
+		float divisors_[2][64];
+		huffman_table dc_[2];
+		huffman_table ac_[2];
+
+		std::vector<uint8_t> out_;
+		uint64_t bit_buffer_ = 0;
+		int bit_count_ = 0;
+
+		void put_u8(int v)
+		{
+			out_.push_back(static_cast<uint8_t>(v));
+		}
+
+		void put_u16(int v)
+		{
+			put_u8(v >> 8);
+			put_u8(v & 0xFF);
+		}
+
+		void put_bits(uint32_t bits, int size)
+		{
+			bit_buffer_ = (bit_buffer_ << size) | bits;
+			bit_count_ += size;
+			while (bit_count_ >= 8)
+			{
+				auto byte = static_cast<uint8_t>(bit_buffer_ >> (bit_count_ - 8));
+				out_.push_back(byte);
+				if (byte == 0xFF)
+				{
+					out_.push_back(0);
+				}
+				bit_count_ -= 8;
+			}
+		}
+
+		void flush_bits()
+		{
+			// Fill the last byte with 1-bits
+			if (bit_count_ > 0)
+			{
+				put_bits((1u << (8 - bit_count_)) - 1, 8 - bit_count_);
+			}
+			bit_buffer_ = 0;
+			bit_count_ = 0;
+		}
+
+		// Floating point AAN forward DCT, as in libjpeg's jfdctflt.c. The output is scaled; the scale factors are part of divisors_.
+		static void forward_dct(float* data)
+		{
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				// Rows, then columns
+				int step = pass == 0 ? 1 : 8;
+				int next = pass == 0 ? 8 : 1;
+
+				for (int i = 0; i < 8; ++i)
+				{
+					float* d = data + i * next;
+
+					float tmp0 = d[0 * step] + d[7 * step];
+					float tmp7 = d[0 * step] - d[7 * step];
+					float tmp1 = d[1 * step] + d[6 * step];
+					float tmp6 = d[1 * step] - d[6 * step];
+					float tmp2 = d[2 * step] + d[5 * step];
+					float tmp5 = d[2 * step] - d[5 * step];
+					float tmp3 = d[3 * step] + d[4 * step];
+					float tmp4 = d[3 * step] - d[4 * step];
+
+					float tmp10 = tmp0 + tmp3;
+					float tmp13 = tmp0 - tmp3;
+					float tmp11 = tmp1 + tmp2;
+					float tmp12 = tmp1 - tmp2;
+
+					d[0 * step] = tmp10 + tmp11;
+					d[4 * step] = tmp10 - tmp11;
+
+					float z1 = (tmp12 + tmp13) * 0.707106781f;
+					d[2 * step] = tmp13 + z1;
+					d[6 * step] = tmp13 - z1;
+
+					tmp10 = tmp4 + tmp5;
+					tmp11 = tmp5 + tmp6;
+					tmp12 = tmp6 + tmp7;
+
+					float z5 = (tmp10 - tmp12) * 0.382683433f;
+					float z2 = 0.541196100f * tmp10 + z5;
+					float z4 = 1.306562965f * tmp12 + z5;
+					float z3 = tmp11 * 0.707106781f;
+
+					float z11 = tmp7 + z3;
+					float z13 = tmp7 - z3;
+
+					d[5 * step] = z13 + z2;
+					d[3 * step] = z13 - z2;
+					d[1 * step] = z11 + z4;
+					d[7 * step] = z11 - z4;
+				}
+			}
+		}
+
+		static int bit_length(int v)
+		{
+			int n = 0;
+			while (v)
+			{
+				n += 1;
+				v >>= 1;
+			}
+			return n;
+		}
+
+		// Transforms, quantizes and Huffman-codes the 8x8 block at (x, y) of a plane
+		void encode_block(const uint8_t* plane, ptrdiff_t pitch, int x, int y, int table, int& dc_pred)
+		{
+			float data[64];
+			for (int row = 0; row < 8; ++row)
+			{
+				auto src = plane + (y + row) * pitch + x;
+				for (int col = 0; col < 8; ++col)
+				{
+					data[row * 8 + col] = static_cast<float>(src[col]) - 128.0f;
+				}
+			}
+
+			forward_dct(data);
+
+			int coef[64];
+			for (int i = 0; i < 64; ++i)
+			{
+				int pos = zigzag_order[i];
+				// Round to nearest; the offset keeps the float to int conversion on positive numbers
+				coef[i] = static_cast<int>(data[pos] * divisors_[table][pos] + 16384.5f) - 16384;
+			}
+
+			auto& dc = dc_[table];
+			auto& ac = ac_[table];
+
+			int diff = coef[0] - dc_pred;
+			dc_pred = coef[0];
+			put_value(dc, 0, diff);
+
+			int run = 0;
+			for (int i = 1; i < 64; ++i)
+			{
+				if (coef[i] == 0)
+				{
+					run += 1;
+					continue;
+				}
+				while (run > 15)
+				{
+					put_bits(ac.code[0xF0], ac.size[0xF0]);
+					run -= 16;
+				}
+				put_value(ac, run, coef[i]);
+				run = 0;
+			}
+			if (run > 0)
+			{
+				put_bits(ac.code[0x00], ac.size[0x00]);
+			}
+		}
+
+		// Huffman code of (run, category), followed by the category's bits of the value
+		void put_value(const huffman_table& table, int run, int value)
+		{
+			int magnitude = value < 0 ? -value : value;
+			int category = bit_length(magnitude);
+			int symbol = (run << 4) | category;
+			put_bits(table.code[symbol], table.size[symbol]);
+			if (category > 0)
+			{
+				uint32_t bits = static_cast<uint32_t>(value < 0 ? value - 1 : value) & ((1u << category) - 1);
+				put_bits(bits, category);
+			}
+		}
+
+		void write_huffman_table(int table_class, int id, const huffman_table& table)
+		{
+			put_u8((table_class << 4) | id);
+			for (int i = 0; i < 16; ++i)
+			{
+				put_u8(table.bits[i]);
+			}
+			for (int i = 0; i < table.num_values; ++i)
+			{
+				put_u8(table.values[i]);
+			}
+		}
+
+		void write_headers(int width, int height, int components)
+		{
+			// SOI, APP0 (JFIF 1.01, no density, no thumbnail)
+			put_u16(0xFFD8);
+			put_u16(0xFFE0);
+			put_u16(16);
+			for (char c : { 'J', 'F', 'I', 'F', '\0' })
+			{
+				put_u8(c);
+			}
+			put_u8(1);
+			put_u8(1);
+			put_u8(0);
+			put_u16(1);
+			put_u16(1);
+			put_u8(0);
+			put_u8(0);
+
+			int num_tables = components == 3 ? 2 : 1;
+
+			// DQT
+			put_u16(0xFFDB);
+			put_u16(2 + 65 * num_tables);
+			for (int t = 0; t < num_tables; ++t)
+			{
+				put_u8(t);
+				for (int i = 0; i < 64; ++i)
+				{
+					put_u8(quant_[t][zigzag_order[i]]);
+				}
+			}
+
+			// SOF0
+			put_u16(0xFFC0);
+			put_u16(8 + 3 * components);
+			put_u8(8);
+			put_u16(height);
+			put_u16(width);
+			put_u8(components);
+			for (int c = 0; c < components; ++c)
+			{
+				put_u8(c + 1);
+				put_u8(c == 0 && components == 3 ? 0x22 : 0x11);
+				put_u8(c == 0 ? 0 : 1);
+			}
+
+			// DHT
+			int dht_length = 2;
+			for (int t = 0; t < num_tables; ++t)
+			{
+				dht_length += 2 * 17 + dc_[t].num_values + ac_[t].num_values;
+			}
+			put_u16(0xFFC4);
+			put_u16(dht_length);
+			for (int t = 0; t < num_tables; ++t)
+			{
+				write_huffman_table(0, t, dc_[t]);
+				write_huffman_table(1, t, ac_[t]);
+			}
+
+			// SOS
+			put_u16(0xFFDA);
+			put_u16(6 + 2 * components);
+			put_u8(components);
+			for (int c = 0; c < components; ++c)
+			{
+				put_u8(c + 1);
+				put_u8(c == 0 ? 0x00 : 0x11);
+			}
+			put_u8(0);
+			put_u8(63);
+			put_u8(0);
+		}
+
+	public:
+		explicit encoder(int quality_pct = 75)
+		{
+			dc_[0].init(std_dc_luma_bits, std_dc_values, 12);
+			dc_[1].init(std_dc_chroma_bits, std_dc_values, 12);
+			ac_[0].init(std_ac_luma_bits, std_ac_luma_values, 162);
+			ac_[1].init(std_ac_chroma_bits, std_ac_chroma_values, 162);
+			set_quality(quality_pct);
+		}
+
+		// Scales the standard quantization tables like libjpeg's jpeg_quality_scaling
+		void set_quality(int quality_pct)
+		{
+			int quality = std::min(std::max(quality_pct, 1), 100);
+			int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+			static const float aan_scale[8] = { 1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f };
+
+			for (int t = 0; t < 2; ++t)
+			{
+				auto base = t == 0 ? std_luma_quant : std_chroma_quant;
+				for (int i = 0; i < 64; ++i)
+				{
+					int q = (base[i] * scale + 50) / 100;
+					quant_[t][i] = static_cast<uint8_t>(std::min(std::max(q, 1), 255));
+					divisors_[t][i] = 1.0f / (quant_[t][i] * aan_scale[i / 8] * aan_scale[i % 8] * 8.0f);
+				}
+			}
+		}
+
+		// Encodes the planes into a JPEG file in memory. The returned data is valid until the next call.
+		const std::vector<uint8_t>& encode(const jpeg_front_end::planar_image& image)
+		{
+			out_.clear();
+			bit_buffer_ = 0;
+			bit_count_ = 0;
+
+			int components = image.has_chroma() ? 3 : 1;
+			write_headers(image.width(), image.height(), components);
+
+			int dc_pred[3] = {};
+			if (components == 3)
+			{
+				// One MCU: 4 Y blocks, 1 Cb block, 1 Cr block
+				for (int y = 0; y < image.padded_height(); y += 16)
+				{
+					for (int x = 0; x < image.padded_width(); x += 16)
+					{
+						encode_block(image.y_row(0), image.y_pitch(), x, y, 0, dc_pred[0]);
+						encode_block(image.y_row(0), image.y_pitch(), x + 8, y, 0, dc_pred[0]);
+						encode_block(image.y_row(0), image.y_pitch(), x, y + 8, 0, dc_pred[0]);
+						encode_block(image.y_row(0), image.y_pitch(), x + 8, y + 8, 0, dc_pred[0]);
+						encode_block(image.cb_row(0), image.chroma_pitch(), x / 2, y / 2, 1, dc_pred[1]);
+						encode_block(image.cr_row(0), image.chroma_pitch(), x / 2, y / 2, 1, dc_pred[2]);
+					}
+				}
+			}
+			else
+			{
+				// A single-component scan covers only the blocks that contain image pixels
+				for (int y = 0; y < image.height(); y += 8)
+				{
+					for (int x = 0; x < image.width(); x += 8)
+					{
+						encode_block(image.y_row(0), image.y_pitch(), x, y, 0, dc_pred[0]);
+					}
+				}
+			}
+
+			flush_bits();
+			put_u16(0xFFD9);
+			return out_;
+		}
+	};
+
+	inline bool write_file(const std::vector<uint8_t>& data, const std::string& file_name, std::string& error_message)
+	{
+		std::ofstream f(file_name, std::ios::binary | std::ios::trunc);
+		f.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		if (!f)
+		{
+			error_message = "Failed to write file";
+			return false;
+		}
+		return true;
+	}
+}
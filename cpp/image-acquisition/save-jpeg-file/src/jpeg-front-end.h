@@ -0,0 +1,654 @@
+#pragma once
+
+#include <ic4/ic4.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define JPEG_FRONT_END_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define JPEG_FRONT_END_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC and clang only accept SSE4.1/AVX2 intrinsics in functions compiled for these instruction sets.
+// MSVC accepts them everywhere, so the kernels are built without special compiler flags and selected at runtime.
+#if defined(JPEG_FRONT_END_X86) && (defined(__GNUC__) || defined(__clang__))
+#define JPEG_FRONT_END_TARGET(isa) __attribute__((target(isa)))
+#else
+#define JPEG_FRONT_END_TARGET(isa)
+#endif
+
+// The color conversion front-end of a JPEG encoder: converts BGR8 or BGRa8 frames into a Y plane and 4:2:0 subsampled Cb and Cr planes.
+//
+// Both steps are done in one pass over the image buffer: two rows are read at a time, the Y values of both rows are written,
+// and every 2x2 block of pixels gives one Cb and one Cr value. The conversion uses the JFIF equations in 16-bit fixed point;
+// the chroma values are computed from the sum of the four pixels, so the averaging does not round twice.
+//
+// There is a scalar kernel and SSE4.1, AVX2 and NEON kernels. All kernels produce exactly the same output (see --self-test).
+namespace jpeg_front_end
+{
+	// Y, Cb and Cr planes, padded to multiples of 16 pixels (one MCU) by repeating the last column and row
+	class planar_image
+	{
+		int width_ = 0;
+		int height_ = 0;
+		int padded_width_ = 0;
+		int padded_height_ = 0;
+		bool has_chroma_ = false;
+		std::vector<uint8_t> y_;
+		std::vector<uint8_t> cb_;
+		std::vector<uint8_t> cr_;
+
+	public:
+		void resize(int width, int height, bool has_chroma)
+		{
+			width_ = width;
+			height_ = height;
+			padded_width_ = (width + 15) & ~15;
+			padded_height_ = (height + 15) & ~15;
+			has_chroma_ = has_chroma;
+
+			y_.resize(static_cast<size_t>(padded_width_) * padded_height_);
+			cb_.resize(has_chroma ? y_.size() / 4 : 0);
+			cr_.resize(has_chroma ? y_.size() / 4 : 0);
+		}
+
+		int width() const { return width_; }
+		int height() const { return height_; }
+		int padded_width() const { return padded_width_; }
+		int padded_height() const { return padded_height_; }
+		bool has_chroma() const { return has_chroma_; }
+
+		ptrdiff_t y_pitch() const { return padded_width_; }
+		ptrdiff_t chroma_pitch() const { return padded_width_ / 2; }
+
+		uint8_t* y_row(int row) { return y_.data() + row * y_pitch(); }
+		uint8_t* cb_row(int row) { return cb_.data() + row * chroma_pitch(); }
+		uint8_t* cr_row(int row) { return cr_.data() + row * chroma_pitch(); }
+		const uint8_t* y_row(int row) const { return y_.data() + row * y_pitch(); }
+		const uint8_t* cb_row(int row) const { return cb_.data() + row * chroma_pitch(); }
+		const uint8_t* cr_row(int row) const { return cr_.data() + row * chroma_pitch(); }
+
+		bool operator==(const planar_image& other) const
+		{
+			return width_ == other.width_ && height_ == other.height_ && has_chroma_ == other.has_chroma_
+				&& y_ == other.y_ && cb_ == other.cb_ && cr_ == other.cr_;
+		}
+	};
+
+	enum class kernel
+	{
+		scalar,
+		sse41,
+		avx2,
+		neon,
+	};
+
+	inline const char* kernel_name(kernel k)
+	{
+		switch (k)
+		{
+		case kernel::sse41:
+			return "sse4.1";
+		case kernel::avx2:
+			return "avx2";
+		case kernel::neon:
+			return "neon";
+		default:
+			return "scalar";
+		}
+	}
+
+	// Converts two rows of width pixels: src0/src1 -> y0/y1, and one row of (width + 1) / 2 chroma values.
+	// For an odd height, src0 and src1 are the same row.
+	using row_pair_function = void (*)(const uint8_t* src0, const uint8_t* src1, int width, uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr);
+
+	// 16-bit fixed point JFIF coefficients, as in libjpeg
+	static const int32_t fix_y_r = 19595;
+	static const int32_t fix_y_g = 38470;
+	static const int32_t fix_y_b = 7471;
+	static const int32_t fix_cb_r = -11059;
+	static const int32_t fix_cb_g = -21709;
+	static const int32_t fix_cb_b = 32768;
+	static const int32_t fix_cr_r = 32768;
+	static const int32_t fix_cr_g = -27439;
+	static const int32_t fix_cr_b = -5329;
+
+	static const int32_t y_bias = 1 << 15;
+	// Chroma is computed from the sum of 4 pixels: 4 * 128 offset, rounding bias just below one half so that the result never reaches 256
+	static const int32_t chroma_bias = (512 << 16) + (1 << 17) - 1;
+
+	inline uint8_t luma(const uint8_t* bgr)
+	{
+		return static_cast<uint8_t>((fix_y_r * bgr[2] + fix_y_g * bgr[1] + fix_y_b * bgr[0] + y_bias) >> 16);
+	}
+
+	template<int BytesPerPixel>
+	void convert_rows_scalar(const uint8_t* src0, const uint8_t* src1, int x0, int width, uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr)
+	{
+		for (int x = x0; x < width; x += 2)
+		{
+			// For an odd width, the last pixel is used twice
+			int x1 = std::min(x + 1, width - 1);
+			const uint8_t* p[4] = { src0 + x * BytesPerPixel, src0 + x1 * BytesPerPixel, src1 + x * BytesPerPixel, src1 + x1 * BytesPerPixel };
+
+			y0[x] = luma(p[0]);
+			y1[x] = luma(p[2]);
+			if (x1 != x)
+			{
+				y0[x1] = luma(p[1]);
+				y1[x1] = luma(p[3]);
+			}
+
+			int32_t b = p[0][0] + p[1][0] + p[2][0] + p[3][0];
+			int32_t g = p[0][1] + p[1][1] + p[2][1] + p[3][1];
+			int32_t r = p[0][2] + p[1][2] + p[2][2] + p[3][2];
+			cb[x / 2] = static_cast<uint8_t>((fix_cb_r * r + fix_cb_g * g + fix_cb_b * b + chroma_bias) >> 18);
+			cr[x / 2] = static_cast<uint8_t>((fix_cr_r * r + fix_cr_g * g + fix_cr_b * b + chroma_bias) >> 18);
+		}
+	}
+
+	template<int BytesPerPixel>
+	void convert_rows_scalar(const uint8_t* src0, const uint8_t* src1, int width, uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr)
+	{
+		convert_rows_scalar<BytesPerPixel>(src0, src1, 0, width, y0, y1, cb, cr);
+	}
+
+#if defined(JPEG_FRONT_END_X86)
+	namespace x86
+	{
+		inline int pair_coefficients(int32_t lo, int32_t hi)
+		{
+			return static_cast<int>(static_cast<uint32_t>(static_cast<uint16_t>(lo)) | (static_cast<uint32_t>(static_cast<uint16_t>(hi)) << 16));
+		}
+
+		// Splits 16 BGR8 pixels into B, G and R bytes
+		JPEG_FRONT_END_TARGET("sse4.1")
+		inline void deinterleave_bgr8(const uint8_t* src, __m128i& b, __m128i& g, __m128i& r)
+		{
+			const __m128i b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+			const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+			const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+			const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+			const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+			const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+			const __m128i r0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+			const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+			const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+			__m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+			__m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+			__m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+
+			b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, b0), _mm_shuffle_epi8(v1, b1)), _mm_shuffle_epi8(v2, b2));
+			g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, g0), _mm_shuffle_epi8(v1, g1)), _mm_shuffle_epi8(v2, g2));
+			r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, r0), _mm_shuffle_epi8(v1, r1)), _mm_shuffle_epi8(v2, r2));
+		}
+
+		// Splits 16 BGRa8 pixels into B, G and R bytes
+		JPEG_FRONT_END_TARGET("sse4.1")
+		inline void deinterleave_bgra8(const uint8_t* src, __m128i& b, __m128i& g, __m128i& r)
+		{
+			// Each group of 4 pixels becomes B0-3 G0-3 R0-3 A0-3, then the 4 groups are transposed
+			const __m128i planar = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+			__m128i v0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), planar);
+			__m128i v1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16)), planar);
+			__m128i v2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32)), planar);
+			__m128i v3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48)), planar);
+
+			__m128i bg01 = _mm_unpacklo_epi32(v0, v1);
+			__m128i bg23 = _mm_unpacklo_epi32(v2, v3);
+			__m128i ra01 = _mm_unpackhi_epi32(v0, v1);
+			__m128i ra23 = _mm_unpackhi_epi32(v2, v3);
+
+			b = _mm_unpacklo_epi64(bg01, bg23);
+			g = _mm_unpackhi_epi64(bg01, bg23);
+			r = _mm_unpacklo_epi64(ra01, ra23);
+		}
+
+		// Y of 8 pixels, 16-bit R, G and B values. G is split into two coefficients so that all of them fit into int16.
+		JPEG_FRONT_END_TARGET("sse4.1")
+		inline __m128i luma_8(__m128i r, __m128i g, __m128i b)
+		{
+			const __m128i c_rg = _mm_set1_epi32(pair_coefficients(fix_y_r, fix_y_g - 16384));
+			const __m128i c_bg = _mm_set1_epi32(pair_coefficients(fix_y_b, 16384));
+			const __m128i bias = _mm_set1_epi32(y_bias);
+
+			__m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), c_rg), _mm_madd_epi16(_mm_unpacklo_epi16(b, g), c_bg));
+			__m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), c_rg), _mm_madd_epi16(_mm_unpackhi_epi16(b, g), c_bg));
+			lo = _mm_srli_epi32(_mm_add_epi32(lo, bias), 16);
+			hi = _mm_srli_epi32(_mm_add_epi32(hi, bias), 16);
+			return _mm_packs_epi32(lo, hi);
+		}
+
+		// Cb or Cr of 8 2x2 blocks from the sums of their R, G and B values. The coefficient 32768 of the main component is a shift.
+		JPEG_FRONT_END_TARGET("sse4.1")
+		inline __m128i chroma_8(__m128i a, __m128i b, __m128i main, __m128i c_ab)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i bias = _mm_set1_epi32(chroma_bias);
+
+			__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c_ab);
+			__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c_ab);
+			lo = _mm_add_epi32(lo, _mm_slli_epi32(_mm_unpacklo_epi16(main, zero), 15));
+			hi = _mm_add_epi32(hi, _mm_slli_epi32(_mm_unpackhi_epi16(main, zero), 15));
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, bias), 18);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, bias), 18);
+			return _mm_packs_epi32(lo, hi);
+		}
+
+		// 16 pixels of two rows
+		JPEG_FRONT_END_TARGET("sse4.1")
+		inline void convert_16(__m128i b0, __m128i g0, __m128i r0, __m128i b1, __m128i g1, __m128i r1, uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i ones = _mm_set1_epi8(1);
+
+			__m128i y0_lo = luma_8(_mm_cvtepu8_epi16(r0), _mm_cvtepu8_epi16(g0), _mm_cvtepu8_epi16(b0));
+			__m128i y0_hi = luma_8(_mm_unpackhi_epi8(r0, zero), _mm_unpackhi_epi8(g0, zero), _mm_unpackhi_epi8(b0, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(y0), _mm_packus_epi16(y0_lo, y0_hi));
+
+			__m128i y1_lo = luma_8(_mm_cvtepu8_epi16(r1), _mm_cvtepu8_epi16(g1), _mm_cvtepu8_epi16(b1));
+			__m128i y1_hi = luma_8(_mm_unpackhi_epi8(r1, zero), _mm_unpackhi_epi8(g1, zero), _mm_unpackhi_epi8(b1, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(y1), _mm_packus_epi16(y1_lo, y1_hi));
+
+			// Sums of the 2x2 blocks: horizontal pairs, then both rows
+			__m128i bs = _mm_add_epi16(_mm_maddubs_epi16(b0, ones), _mm_maddubs_epi16(b1, ones));
+			__m128i gs = _mm_add_epi16(_mm_maddubs_epi16(g0, ones), _mm_maddubs_epi16(g1, ones));
+			__m128i rs = _mm_add_epi16(_mm_maddubs_epi16(r0, ones), _mm_maddubs_epi16(r1, ones));
+
+			__m128i cb16 = chroma_8(rs, gs, bs, _mm_set1_epi32(pair_coefficients(fix_cb_r, fix_cb_g)));
+			__m128i cr16 = chroma_8(gs, bs, rs, _mm_set1_epi32(pair_coefficients(fix_cr_g, fix_cr_b)));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(cb), _mm_packus_epi16(cb16, cb16));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(cr), _mm_packus_epi16(cr16, cr16));
+		}
+
+		template<int BytesPerPixel>
+		JPEG_FRONT_END_TARGET("sse4.1")
+		void convert_rows_sse41(const uint8_t* src0, const uint8_t* src1, int width, uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr)
+		{
+			int x = 0;
+			for (; x + 16 <= width; x += 16)
+			{
+				__m128i b0, g0, r0, b1, g1, r1;
+				if (BytesPerPixel == 3)
+				{
+					deinterleave_bgr8(src0 + x * 3, b0, g0, r0);
+					deinterleave_bgr8(src1 + x * 3, b1, g1, r1);
+				}
+				else
+				{
+					deinterleave_bgra8(src0 + x * 4, b0, g0, r0);
+					deinterleave_bgra8(src1 + x * 4, b1, g1, r1);
+				}
+				convert_16(b0, g0, r0, b1, g1, r1, y0 + x, y1 + x, cb + x / 2, cr + x / 2);
+			}
+			convert_rows_scalar<BytesPerPixel>(src0, src1, x, width, y0, y1, cb, cr);
+		}
+
+		// Same as above for 16 pixels of a 256-bit vector. All operations stay within 128-bit lanes, and every unpack is undone by
+		// a pack of the same lanes, so the results come out in pixel order.
+		JPEG_FRONT_END_TARGET("avx2")
+		inline __m256i luma_16(__m256i r, __m256i g, __m256i b)
+		{
+			const __m256i c_rg = _mm256_set1_epi32(pair_coefficients(fix_y_r, fix_y_g - 16384));
+			const __m256i c_bg = _mm256_set1_epi32(pair_coefficients(fix_y_b, 16384));
+			const __m256i bias = _mm256_set1_epi32(y_bias);
+
+			__m256i lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), c_rg), _mm256_madd_epi16(_mm256_unpacklo_epi16(b, g), c_bg));
+			__m256i hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), c_rg), _mm256_madd_epi16(_mm256_unpackhi_epi16(b, g), c_bg));
+			lo = _mm256_srli_epi32(_mm256_add_epi32(lo, bias), 16);
+			hi = _mm256_srli_epi32(_mm256_add_epi32(hi, bias), 16);
+			return _mm256_packs_epi32(lo, hi);
+		}
+
+		JPEG_FRONT_END_TARGET("avx2")
+		inline __m256i chroma_16(__m256i a, __m256i b, __m256i main, __m256i c_ab)
+		{
+			const __m256i zero = _mm256_setzero_si256();
+			const __m256i bias = _mm256_set1_epi32(chroma_bias);
+
+			__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), c_ab);
+			__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), c_ab);
+			lo = _mm256_add_epi32(lo, _mm256_slli_epi32(_mm256_unpacklo_epi16(main, zero), 15));
+			hi = _mm256_add_epi32(hi, _mm256_slli_epi32(_mm256_unpackhi_epi16(main, zero), 15));
+			lo = _mm256_srai_epi32(_mm256_add_epi32(lo, bias), 18);
+			hi = _mm256_srai_epi32(_mm256_add_epi32(hi, bias), 18);
+			return _mm256_packs_epi32(lo, hi);
+		}
+
+		// Splits 32 pixels into B, G and R bytes, in pixel order
+		template<int BytesPerPixel>
+		JPEG_FRONT_END_TARGET("avx2")
+		inline void deinterleave_32(const uint8_t* src, __m256i& b, __m256i& g, __m256i& r)
+		{
+			if (BytesPerPixel == 3)
+			{
+				// The byte shuffles cannot cross 128-bit lanes, so the 3-byte pixels are split as two halves of 16 pixels
+				__m128i b_lo, g_lo, r_lo, b_hi, g_hi, r_hi;
+				deinterleave_bgr8(src, b_lo, g_lo, r_lo);
+				deinterleave_bgr8(src + 48, b_hi, g_hi, r_hi);
+				b = _mm256_inserti128_si256(_mm256_castsi128_si256(b_lo), b_hi, 1);
+				g = _mm256_inserti128_si256(_mm256_castsi128_si256(g_lo), g_hi, 1);
+				r = _mm256_inserti128_si256(_mm256_castsi128_si256(r_lo), r_hi, 1);
+			}
+			else
+			{
+				const __m256i planar = _mm256_setr_epi8(
+					0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+					0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+				// After the transpose, lane 0 holds pixels 0-3, 8-11, 16-19, 24-27 and lane 1 holds pixels 4-7, 12-15, 20-23, 28-31
+				const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+				__m256i v0 = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)), planar);
+				__m256i v1 = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32)), planar);
+				__m256i v2 = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 64)), planar);
+				__m256i v3 = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 96)), planar);
+
+				__m256i bg01 = _mm256_unpacklo_epi32(v0, v1);
+				__m256i bg23 = _mm256_unpacklo_epi32(v2, v3);
+				__m256i ra01 = _mm256_unpackhi_epi32(v0, v1);
+				__m256i ra23 = _mm256_unpackhi_epi32(v2, v3);
+
+				b = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(bg01, bg23), order);
+				g = _mm256_permutevar8x32_epi32(_mm256_unpackhi_epi64(bg01, bg23), order);
+				r = _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(ra01, ra23), order);
+			}
+		}
+
+		template<int BytesPerPixel>
+		JPEG_FRONT_END_TARGET("avx2")
+		void convert_rows_avx2(const uint8_t* src0, const uint8_t* src1, int width, uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr)
+		{
+			const __m256i zero = _mm256_setzero_si256();
+			const __m256i ones = _mm256_set1_epi8(1);
+			const __m256i c_cb = _mm256_set1_epi32(pair_coefficients(fix_cb_r, fix_cb_g));
+			const __m256i c_cr = _mm256_set1_epi32(pair_coefficients(fix_cr_g, fix_cr_b));
+
+			int x = 0;
+			for (; x + 32 <= width; x += 32)
+			{
+				__m256i b0, g0, r0, b1, g1, r1;
+				deinterleave_32<BytesPerPixel>(src0 + x * BytesPerPixel, b0, g0, r0);
+				deinterleave_32<BytesPerPixel>(src1 + x * BytesPerPixel, b1, g1, r1);
+
+				__m256i y0_lo = luma_16(_mm256_unpacklo_epi8(r0, zero), _mm256_unpacklo_epi8(g0, zero), _mm256_unpacklo_epi8(b0, zero));
+				__m256i y0_hi = luma_16(_mm256_unpackhi_epi8(r0, zero), _mm256_unpackhi_epi8(g0, zero), _mm256_unpackhi_epi8(b0, zero));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(y0 + x), _mm256_packus_epi16(y0_lo, y0_hi));
+
+				__m256i y1_lo = luma_16(_mm256_unpacklo_epi8(r1, zero), _mm256_unpacklo_epi8(g1, zero), _mm256_unpacklo_epi8(b1, zero));
+				__m256i y1_hi = luma_16(_mm256_unpackhi_epi8(r1, zero), _mm256_unpackhi_epi8(g1, zero), _mm256_unpackhi_epi8(b1, zero));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(y1 + x), _mm256_packus_epi16(y1_lo, y1_hi));
+
+				__m256i bs = _mm256_add_epi16(_mm256_maddubs_epi16(b0, ones), _mm256_maddubs_epi16(b1, ones));
+				__m256i gs = _mm256_add_epi16(_mm256_maddubs_epi16(g0, ones), _mm256_maddubs_epi16(g1, ones));
+				__m256i rs = _mm256_add_epi16(_mm256_maddubs_epi16(r0, ones), _mm256_maddubs_epi16(r1, ones));
+
+				// Pack 16 chroma values per lane pair, then move the low halves of both lanes together
+				__m256i cb16 = chroma_16(rs, gs, bs, c_cb);
+				__m256i cr16 = chroma_16(gs, bs, rs, c_cr);
+				__m256i cb8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(cb16, cb16), 0x08);
+				__m256i cr8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(cr16, cr16), 0x08);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(cb + x / 2), _mm256_castsi256_si128(cb8));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(cr + x / 2), _mm256_castsi256_si128(cr8));
+			}
+			if (x + 16 <= width)
+			{
+				__m128i b0, g0, r0, b1, g1, r1;
+				if (BytesPerPixel == 3)
+				{
+					deinterleave_bgr8(src0 + x * 3, b0, g0, r0);
+					deinterleave_bgr8(src1 + x * 3, b1, g1, r1);
+				}
+				else
+				{
+					deinterleave_bgra8(src0 + x * 4, b0, g0, r0);
+					deinterleave_bgra8(src1 + x * 4, b1, g1, r1);
+				}
+				convert_16(b0, g0, r0, b1, g1, r1, y0 + x, y1 + x, cb + x / 2, cr + x / 2);
+				x += 16;
+			}
+			convert_rows_scalar<BytesPerPixel>(src0, src1, x, width, y0, y1, cb, cr);
+		}
+
+		struct cpu_features
+		{
+			bool sse41;
+			bool avx2;
+		};
+
+		inline cpu_features detect()
+		{
+			cpu_features features = {};
+#if defined(_MSC_VER) && !defined(__clang__)
+			int regs[4];
+			__cpuid(regs, 0);
+			int max_leaf = regs[0];
+
+			__cpuid(regs, 1);
+			features.sse41 = (regs[2] & (1 << 19)) != 0;
+			bool os_avx = (regs[2] & (1 << 27)) != 0 && (regs[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+			if (os_avx && max_leaf >= 7)
+			{
+				__cpuidex(regs, 7, 0);
+				features.avx2 = (regs[1] & (1 << 5)) != 0;
+			}
+#else
+			__builtin_cpu_init();
+			features.sse41 = __builtin_cpu_supports("sse4.1") != 0;
+			features.avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+			return features;
+		}
+	}
+#endif
+
+#if defined(JPEG_FRONT_END_NEON)
+	namespace neon
+	{
+		// vld3/vld4 split the pixels into B, G and R. The chroma sums are computed in unsigned 32-bit arithmetic:
+		// intermediate values may wrap around, but the result is the same as with signed integers, because the final value is not negative.
+		inline uint8x8_t chroma_8(uint16x8_t main, uint16x8_t a, uint16x8_t b, uint16_t c_a, uint16_t c_b)
+		{
+			const uint32x4_t bias = vdupq_n_u32(chroma_bias);
+
+			uint32x4_t lo = vmlal_n_u16(bias, vget_low_u16(main), 32768);
+			uint32x4_t hi = vmlal_n_u16(bias, vget_high_u16(main), 32768);
+			lo = vmlsl_n_u16(vmlsl_n_u16(lo, vget_low_u16(a), c_a), vget_low_u16(b), c_b);
+			hi = vmlsl_n_u16(vmlsl_n_u16(hi, vget_high_u16(a), c_a), vget_high_u16(b), c_b);
+			return vmovn_u16(vcombine_u16(vmovn_u32(vshrq_n_u32(lo, 18)), vmovn_u32(vshrq_n_u32(hi, 18))));
+		}
+
+		inline uint16x4_t luma_4(uint16x4_t r, uint16x4_t g, uint16x4_t b)
+		{
+			uint32x4_t y = vmlal_n_u16(vmlal_n_u16(vmull_n_u16(r, fix_y_r), g, fix_y_g), b, fix_y_b);
+			return vshrn_n_u32(vaddq_u32(y, vdupq_n_u32(y_bias)), 16);
+		}
+
+		inline uint8x16_t luma_16(uint8x16_t r, uint8x16_t g, uint8x16_t b)
+		{
+			uint16x8_t r_lo = vmovl_u8(vget_low_u8(r)), r_hi = vmovl_u8(vget_high_u8(r));
+			uint16x8_t g_lo = vmovl_u8(vget_low_u8(g)), g_hi = vmovl_u8(vget_high_u8(g));
+			uint16x8_t b_lo = vmovl_u8(vget_low_u8(b)), b_hi = vmovl_u8(vget_high_u8(b));
+
+			uint16x8_t lo = vcombine_u16(luma_4(vget_low_u16(r_lo), vget_low_u16(g_lo), vget_low_u16(b_lo)), luma_4(vget_high_u16(r_lo), vget_high_u16(g_lo), vget_high_u16(b_lo)));
+			uint16x8_t hi = vcombine_u16(luma_4(vget_low_u16(r_hi), vget_low_u16(g_hi), vget_low_u16(b_hi)), luma_4(vget_high_u16(r_hi), vget_high_u16(g_hi), vget_high_u16(b_hi)));
+			return vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+		}
+
+		template<int BytesPerPixel>
+		inline void load_16(const uint8_t* src, uint8x16_t& b, uint8x16_t& g, uint8x16_t& r)
+		{
+			if (BytesPerPixel == 3)
+			{
+				uint8x16x3_t v = vld3q_u8(src);
+				b = v.val[0];
+				g = v.val[1];
+				r = v.val[2];
+			}
+			else
+			{
+				uint8x16x4_t v = vld4q_u8(src);
+				b = v.val[0];
+				g = v.val[1];
+				r = v.val[2];
+			}
+		}
+
+		template<int BytesPerPixel>
+		void convert_rows_neon(const uint8_t* src0, const uint8_t* src1, int width, uint8_t* y0, uint8_t* y1, uint8_t* cb, uint8_t* cr)
+		{
+			int x = 0;
+			for (; x + 16 <= width; x += 16)
+			{
+				uint8x16_t b0, g0, r0, b1, g1, r1;
+				load_16<BytesPerPixel>(src0 + x * BytesPerPixel, b0, g0, r0);
+				load_16<BytesPerPixel>(src1 + x * BytesPerPixel, b1, g1, r1);
+
+				vst1q_u8(y0 + x, luma_16(r0, g0, b0));
+				vst1q_u8(y1 + x, luma_16(r1, g1, b1));
+
+				uint16x8_t bs = vpadalq_u8(vpaddlq_u8(b0), b1);
+				uint16x8_t gs = vpadalq_u8(vpaddlq_u8(g0), g1);
+				uint16x8_t rs = vpadalq_u8(vpaddlq_u8(r0), r1);
+
+				vst1_u8(cb + x / 2, chroma_8(bs, rs, gs, static_cast<uint16_t>(-fix_cb_r), static_cast<uint16_t>(-fix_cb_g)));
+				vst1_u8(cr + x / 2, chroma_8(rs, gs, bs, static_cast<uint16_t>(-fix_cr_g), static_cast<uint16_t>(-fix_cr_b)));
+			}
+			convert_rows_scalar<BytesPerPixel>(src0, src1, x, width, y0, y1, cb, cr);
+		}
+	}
+#endif
+
+	// Kernels that can run on this CPU, scalar first
+	inline std::vector<kernel> available_kernels()
+	{
+		std::vector<kernel> result = { kernel::scalar };
+#if defined(JPEG_FRONT_END_X86)
+		static const auto features = x86::detect();
+		if (features.sse41)
+		{
+			result.push_back(kernel::sse41);
+		}
+		if (features.avx2)
+		{
+			result.push_back(kernel::avx2);
+		}
+#elif defined(JPEG_FRONT_END_NEON)
+		result.push_back(kernel::neon);
+#endif
+		return result;
+	}
+
+	inline kernel best_kernel()
+	{
+		return available_kernels().back();
+	}
+
+	inline bool is_available(kernel k)
+	{
+		auto kernels = available_kernels();
+		return std::find(kernels.begin(), kernels.end(), k) != kernels.end();
+	}
+
+	template<int BytesPerPixel>
+	row_pair_function select_function(kernel k)
+	{
+		switch (k)
+		{
+#if defined(JPEG_FRONT_END_X86)
+		case kernel::sse41:
+			return &x86::convert_rows_sse41<BytesPerPixel>;
+		case kernel::avx2:
+			return &x86::convert_rows_avx2<BytesPerPixel>;
+#endif
+#if defined(JPEG_FRONT_END_NEON)
+		case kernel::neon:
+			return &neon::convert_rows_neon<BytesPerPixel>;
+#endif
+		default:
+			return &convert_rows_scalar<BytesPerPixel>;
+		}
+	}
+
+	// Repeats the last column and row of a plane into its padding
+	inline void pad_plane(uint8_t* plane, ptrdiff_t pitch, int width, int height, int padded_width, int padded_height)
+	{
+		for (int row = 0; row < height; ++row)
+		{
+			auto p = plane + row * pitch;
+			std::fill(p + width, p + padded_width, p[width - 1]);
+		}
+		for (int row = height; row < padded_height; ++row)
+		{
+			std::memcpy(plane + row * pitch, plane + (height - 1) * pitch, static_cast<size_t>(padded_width));
+		}
+	}
+
+	// Converts a BGR8 (bytes_per_pixel = 3), BGRa8 (4) or Mono8 (1) image with any pitch into dst
+	inline void convert(const uint8_t* src, ptrdiff_t pitch, int bytes_per_pixel, int width, int height, planar_image& dst, kernel k)
+	{
+		dst.resize(width, height, bytes_per_pixel != 1);
+
+		if (bytes_per_pixel == 1)
+		{
+			for (int row = 0; row < height; ++row)
+			{
+				std::memcpy(dst.y_row(row), src + row * pitch, static_cast<size_t>(width));
+			}
+			pad_plane(dst.y_row(0), dst.y_pitch(), width, height, dst.padded_width(), dst.padded_height());
+			return;
+		}
+
+		auto fn = bytes_per_pixel == 3 ? select_function<3>(k) : select_function<4>(k);
+		for (int row = 0; row < height; row += 2)
+		{
+			auto src0 = src + row * pitch;
+			auto src1 = row + 1 < height ? src0 + pitch : src0;
+			fn(src0, src1, width, dst.y_row(row), dst.y_row(row + 1), dst.cb_row(row / 2), dst.cr_row(row / 2));
+		}
+
+		pad_plane(dst.y_row(0), dst.y_pitch(), width, height, dst.padded_width(), dst.padded_height());
+		pad_plane(dst.cb_row(0), dst.chroma_pitch(), (width + 1) / 2, (height + 1) / 2, dst.padded_width() / 2, dst.padded_height() / 2);
+		pad_plane(dst.cr_row(0), dst.chroma_pitch(), (width + 1) / 2, (height + 1) / 2, dst.padded_width() / 2, dst.padded_height() / 2);
+	}
+
+	inline int bytes_per_pixel(ic4::PixelFormat pixel_format)
+	{
+		switch (pixel_format)
+		{
+		case ic4::PixelFormat::Mono8:
+			return 1;
+		case ic4::PixelFormat::BGR8:
+			return 3;
+		case ic4::PixelFormat::BGRa8:
+			return 4;
+		default:
+			return 0;
+		}
+	}
+
+	// Converts the image buffer's memory in place, without copying it first. Returns false for pixel formats other than Mono8, BGR8 and BGRa8.
+	inline bool convert(const ic4::ImageBuffer& buffer, planar_image& dst, kernel k)
+	{
+		auto image_type = buffer.imageType();
+		int bpp = bytes_per_pixel(image_type.pixel_format());
+		if (bpp == 0)
+		{
+			return false;
+		}
+
+		convert(static_cast<const uint8_t*>(buffer.ptr()), static_cast<ptrdiff_t>(buffer.pitch()), bpp, image_type.width(), image_type.height(), dst, k);
+		return true;
+	}
+}
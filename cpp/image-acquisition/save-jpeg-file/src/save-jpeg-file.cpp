@@ -1,13 +1,628 @@
 
 #include <iostream>
 #include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <ic4/ic4.h>
 
 #include <console-helper.h>
 
-int main()
+#include "baseline-jpeg-encoder.h"
+#include "jpeg-front-end.h"
+
+struct EncoderSettings
+{
+	bool builtin;						// Use baseline_jpeg::encoder instead of ic4::imageBufferSaveAsJpeg
+	int quality_pct;
+	jpeg_front_end::kernel kernel;		// Color conversion kernel of the built-in encoder
+};
+
+// Saves image buffers as JPEG files with the encoder selected by EncoderSettings. Not thread-safe, every encoder thread has its own.
+//
+// The built-in encoder converts Mono8, BGR8 and BGRa8 buffers directly from ImageBuffer::ptr() into its planes (see jpeg-front-end.h).
+// Other pixel formats are always saved by ic4::imageBufferSaveAsJpeg.
+class JpegFileEncoder
+{
+	EncoderSettings settings_;
+	jpeg_front_end::planar_image planes_;
+	baseline_jpeg::encoder encoder_;
+
+public:
+	explicit JpegFileEncoder(const EncoderSettings& settings)
+		: settings_(settings)
+		, encoder_(settings.quality_pct)
+	{
+	}
+
+	bool save(const ic4::ImageBuffer& buffer, const std::string& file_name, std::string& error_message)
+	{
+		if (settings_.builtin && jpeg_front_end::convert(buffer, planes_, settings_.kernel))
+		{
+			return baseline_jpeg::write_file(encoder_.encode(planes_), file_name, error_message);
+		}
+
+		ic4::SaveJpegOptions options = {};
+		options.quality_pct = settings_.quality_pct;
+
+		ic4::Error err;
+		if (!ic4::imageBufferSaveAsJpeg(buffer, file_name, options, err))
+		{
+			error_message = err.message();
+			return false;
+		}
+		return true;
+	}
+};
+
+// Define QueueSinkListener-derived class that encodes the received frames into JPEG files on N encoder threads
+//
+// framesQueued numbers the frames and pushes them into a bounded queue, it never waits for an encoder.
+// Both encoders write straight into a file, so every encoder writes a temporary file <name>.part.
+// A dedicated I/O thread renames the finished files to their final names strictly in frame order: image_<n>.jpg
+// only appears after all frames before it, no matter which encoder finished first.
+class JpegBurstListener : public ic4::QueueSinkListener
+{
+public:
+	struct Statistics
+	{
+		uint64_t frames_accepted;
+		uint64_t frames_saved;
+		uint64_t encode_errors;
+		uint64_t queue_full_drops;
+		size_t reorder_high_water_mark;
+		double encode_ms_mean;
+		double encode_ms_max;
+	};
+
+private:
+	struct Job
+	{
+		std::shared_ptr<ic4::ImageBuffer> buffer;
+		uint64_t index;
+	};
+
+	std::string path_base_;
+	EncoderSettings settings_;
+	uint64_t max_frames_;
+	size_t queue_capacity_;
+
+	std::atomic<bool> do_save_frames_;
+	std::atomic<uint64_t> frames_accepted_;
+	std::atomic<uint64_t> queue_full_drops_;
+
+	std::mutex mtx_;
+	std::condition_variable job_cond_;
+	std::condition_variable done_cond_;
+	std::deque<Job> queue_;
+	std::map<uint64_t, bool> done_;			// Encoded, but not yet renamed. Index -> success
+	uint64_t next_commit_;
+	uint64_t frames_committed_;
+	bool stop_encoders_;
+	bool stop_io_;
+
+	// Protected by mtx_
+	uint64_t frames_saved_;
+	uint64_t encode_errors_;
+	size_t reorder_high_water_mark_;
+	double encode_ms_total_;
+	double encode_ms_max_;
+
+	std::vector<std::thread> encoders_;
+	std::thread io_thread_;
+
+	std::string file_name(uint64_t index) const
+	{
+		return path_base_ + std::to_string(index) + ".jpg";
+	}
+
+	void encoder_proc()
+	{
+		JpegFileEncoder encoder(settings_);
+
+		std::unique_lock<std::mutex> lck(mtx_);
+
+		while (true)
+		{
+			job_cond_.wait(lck, [this] { return stop_encoders_ || !queue_.empty(); });
+			if (queue_.empty())
+			{
+				return;
+			}
+			auto job = std::move(queue_.front());
+			queue_.pop_front();
+			lck.unlock();
+
+			auto begin = std::chrono::steady_clock::now();
+
+			std::string error_message;
+			auto part_name = file_name(job.index) + ".part";
+			bool ok = encoder.save(*job.buffer, part_name, error_message);
+			if (!ok)
+			{
+				std::cerr << "Failed to save image file: " << error_message << std::endl;
+				std::remove(part_name.c_str());
+			}
+
+			// Return the buffer to the sink before doing anything else
+			job.buffer.reset();
+
+			double encode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+			lck.lock();
+			done_[job.index] = ok;
+			reorder_high_water_mark_ = std::max(reorder_high_water_mark_, done_.size());
+			if (ok)
+			{
+				encode_ms_total_ += encode_ms;
+				encode_ms_max_ = std::max(encode_ms_max_, encode_ms);
+			}
+			done_cond_.notify_all();
+		}
+	}
+
+	void io_proc()
+	{
+		std::unique_lock<std::mutex> lck(mtx_);
+
+		while (true)
+		{
+			done_cond_.wait(lck, [this] { return stop_io_ || done_.count(next_commit_); });
+			auto it = done_.find(next_commit_);
+			if (it == done_.end())
+			{
+				return;
+			}
+			bool ok = it->second;
+			done_.erase(it);
+			auto index = next_commit_;
+			lck.unlock();
+
+			if (ok)
+			{
+				auto final_name = file_name(index);
+				std::remove(final_name.c_str());
+				ok = std::rename((final_name + ".part").c_str(), final_name.c_str()) == 0;
+				if (ok)
+				{
+					std::cout << "Saved image file " << final_name << std::endl;
+				}
+				else
+				{
+					std::cerr << "Failed to rename " << final_name << ".part" << std::endl;
+					std::remove((final_name + ".part").c_str());
+				}
+			}
+
+			lck.lock();
+			if (ok)
+			{
+				frames_saved_ += 1;
+			}
+			else
+			{
+				encode_errors_ += 1;
+			}
+			next_commit_ += 1;
+			frames_committed_ += 1;
+			done_cond_.notify_all();
+		}
+	}
+
+public:
+	JpegBurstListener(std::string path_base, const EncoderSettings& settings, uint64_t max_frames, size_t num_encoders, size_t queue_capacity)
+		: path_base_(std::move(path_base))
+		, settings_(settings)
+		, max_frames_(max_frames)
+		, queue_capacity_(queue_capacity)
+		, do_save_frames_(false)
+		, frames_accepted_(0)
+		, queue_full_drops_(0)
+		, next_commit_(0)
+		, frames_committed_(0)
+		, stop_encoders_(false)
+		, stop_io_(false)
+		, frames_saved_(0)
+		, encode_errors_(0)
+		, reorder_high_water_mark_(0)
+		, encode_ms_total_(0)
+		, encode_ms_max_(0)
+	{
+		for (size_t i = 0; i < std::max<size_t>(num_encoders, 1); ++i)
+		{
+			encoders_.emplace_back([this] { encoder_proc(); });
+		}
+		io_thread_ = std::thread([this] { io_proc(); });
+	}
+
+	~JpegBurstListener()
+	{
+		{
+			std::lock_guard<std::mutex> lck(mtx_);
+			stop_encoders_ = true;
+		}
+		job_cond_.notify_all();
+		for (auto&& t : encoders_)
+		{
+			t.join();
+		}
+
+		{
+			std::lock_guard<std::mutex> lck(mtx_);
+			stop_io_ = true;
+		}
+		done_cond_.notify_all();
+		io_thread_.join();
+	}
+
+	// Inherited via QueueSinkListener, called when the sink is connected to the stream
+	bool sinkConnected(ic4::QueueSink& sink, const ic4::ImageType& frameType, size_t min_buffers_required) override
+	{
+		// Every buffer that is queued or being encoded is missing from the sink's free queue
+		ic4::Error err;
+		if (!sink.allocAndQueueBuffers(min_buffers_required + queue_capacity_ + encoders_.size(), err))
+		{
+			std::cerr << "Failed to allocate buffers: " << err.message() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Inherited via QueueSinkListener, called when there are frames available in the sink's output queue
+	void framesQueued(ic4::QueueSink& sink) override
+	{
+		ic4::Error err;
+
+		// Remove a buffer from the sink's output queue even if not saving; otherwise the device runs out of buffers
+		auto buffer = sink.popOutputBuffer(err);
+		if (buffer == nullptr)
+		{
+			std::cerr << "Failed to get frame from sink: " << err.message() << std::endl;
+			return;
+		}
+
+		if (!do_save_frames_ || frames_accepted_ >= max_frames_)
+		{
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lck(mtx_);
+			if (queue_.size() >= queue_capacity_)
+			{
+				queue_full_drops_ += 1;
+				return;
+			}
+			queue_.push_back({ std::move(buffer), frames_accepted_ });
+			frames_accepted_ += 1;
+		}
+		job_cond_.notify_one();
+	}
+
+	void enable_saving(bool enable)
+	{
+		do_save_frames_ = enable;
+	}
+
+	uint64_t frames_accepted() const
+	{
+		return frames_accepted_;
+	}
+
+	// Waits until all accepted frames are encoded and renamed
+	void flush()
+	{
+		std::unique_lock<std::mutex> lck(mtx_);
+		done_cond_.wait(lck, [this] { return frames_committed_ == frames_accepted_; });
+	}
+
+	Statistics statistics()
+	{
+		std::lock_guard<std::mutex> lck(mtx_);
+
+		Statistics stats = {};
+		stats.frames_accepted = frames_accepted_;
+		stats.frames_saved = frames_saved_;
+		stats.encode_errors = encode_errors_;
+		stats.queue_full_drops = queue_full_drops_;
+		stats.reorder_high_water_mark = reorder_high_water_mark_;
+		stats.encode_ms_mean = frames_saved_ ? encode_ms_total_ / frames_saved_ : 0.0;
+		stats.encode_ms_max = encode_ms_max_;
+		return stats;
+	}
+};
+
+// Saves a burst of frames at the full frame rate, see JpegBurstListener
+static int run_burst(ic4::Grabber& grabber, uint64_t frames, size_t num_encoders, const EncoderSettings& settings)
+{
+	ic4::Error err;
+
+	JpegBurstListener listener("image_", settings, frames, num_encoders, 4 * num_encoders);
+
+	auto sink = ic4::QueueSink::create(listener, err);
+	if (!sink)
+	{
+		std::cerr << "Failed to create sink: " << err.message() << std::endl;
+		return -3;
+	}
+
+	if (!grabber.streamSetup(sink, ic4::StreamSetupOption::AcquisitionStart, err))
+	{
+		std::cerr << "Failed to setup stream: " << err.message() << std::endl;
+		return -4;
+	}
+
+	std::cout << "Press any key to save a burst of " << frames << " jpeg images with " << num_encoders << " encoders" << std::endl;
+	(void)std::getchar();
+
+	// Give up if the burst takes more than twice as long as expected at the configured frame rate,
+	// e.g. because the camera waits for triggers or frames are dropped
+	auto frame_rate = grabber.devicePropertyMap().getValueDouble(ic4::PropId::AcquisitionFrameRate, err);
+	if (err.isError() || !(frame_rate > 0))
+	{
+		frame_rate = 1.0;
+	}
+	auto timeout = std::chrono::duration<double>(2.0 * frames / frame_rate + 5.0);
+
+	auto begin = std::chrono::steady_clock::now();
+	auto deadline = begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+	listener.enable_saving(true);
+	bool complete = true;
+	while (listener.frames_accepted() < frames)
+	{
+		if (std::chrono::steady_clock::now() >= deadline)
+		{
+			complete = false;
+			std::cerr << "Timeout after " << timeout.count() << " s: only " << listener.frames_accepted() << " of " << frames << " frames were acquired" << std::endl;
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	auto acquired_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	listener.enable_saving(false);
+	listener.flush();
+	auto saved_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	auto stats = listener.statistics();
+	std::cout << std::endl;
+	std::cout << "Saved " << stats.frames_saved << " of " << stats.frames_accepted << " frames, " << stats.queue_full_drops << " frames dropped because all encoders were busy" << std::endl;
+	std::cout << "Acquired at " << stats.frames_accepted / acquired_s << " fps, saved at " << stats.frames_saved / saved_s << " fps" << std::endl;
+	std::cout << "Encode time per frame: mean " << stats.encode_ms_mean << " ms, max " << stats.encode_ms_max << " ms" << std::endl;
+	std::cout << "Largest number of files waiting for an earlier frame: " << stats.reorder_high_water_mark << std::endl;
+
+	// We have to call streamStop before exiting the function, because we have the listener defined as a stack variable.
+	grabber.streamStop();
+	return complete ? 0 : -5;
+}
+
+// Compares every SIMD color conversion kernel with the scalar kernel on random images of many sizes and pitches
+static int run_self_test()
+{
+	std::mt19937 rng(1);
+	int num_tests = 0;
+	int num_failed = 0;
+
+	for (int bytes_per_pixel : { 3, 4 })
+	{
+		for (int width = 1; width <= 100; ++width)
+		{
+			for (int height : { 1, 2, 3, 15, 16, 17 })
+			{
+				ptrdiff_t pitch = width * bytes_per_pixel + static_cast<ptrdiff_t>(rng() % 67);
+				std::vector<uint8_t> image(static_cast<size_t>(pitch) * height);
+				for (auto& v : image)
+				{
+					// Mix in black and white to hit the limits of the fixed point arithmetic
+					auto r = rng();
+					v = static_cast<uint8_t>(r % 4 == 0 ? ((r >> 8) & 1) * 255 : r >> 16);
+				}
+
+				jpeg_front_end::planar_image expected;
+				jpeg_front_end::convert(image.data(), pitch, bytes_per_pixel, width, height, expected, jpeg_front_end::kernel::scalar);
+
+				for (auto k : jpeg_front_end::available_kernels())
+				{
+					jpeg_front_end::planar_image actual;
+					jpeg_front_end::convert(image.data(), pitch, bytes_per_pixel, width, height, actual, k);
+
+					num_tests += 1;
+					if (!(actual == expected))
+					{
+						num_failed += 1;
+						std::cerr << "Mismatch: kernel " << jpeg_front_end::kernel_name(k) << ", " << bytes_per_pixel << " bytes per pixel, "
+							<< width << "x" << height << ", pitch " << pitch << std::endl;
+					}
+				}
+			}
+		}
+	}
+
+	std::cout << "Kernels:";
+	for (auto k : jpeg_front_end::available_kernels())
+	{
+		std::cout << " " << jpeg_front_end::kernel_name(k);
+	}
+	std::cout << std::endl;
+	std::cout << num_tests - num_failed << " of " << num_tests << " conversions are identical to the scalar kernel" << std::endl;
+	return num_failed == 0 ? 0 : -1;
+}
+
+// Encodes a synthetic BGR8 frame with the built-in encoder and every available color conversion kernel
+static int run_benchmark(uint64_t frames, int width, int height, int quality)
+{
+	// The pitch is not a multiple of a vector size, as with an image buffer that has row padding
+	ptrdiff_t pitch = width * 3 + 40;
+	std::vector<uint8_t> image(static_cast<size_t>(pitch) * height);
+
+	// Gradients with some noise, so that the entropy coding has a realistic amount of work
+	std::mt19937 rng(1);
+	for (int y = 0; y < height; ++y)
+	{
+		auto row = image.data() + y * pitch;
+		for (int x = 0; x < width; ++x)
+		{
+			int noise = static_cast<int>(rng() % 16) - 8;
+			row[x * 3 + 0] = static_cast<uint8_t>(std::min(std::max(x * 255 / width + noise, 0), 255));
+			row[x * 3 + 1] = static_cast<uint8_t>(std::min(std::max(y * 255 / height + noise, 0), 255));
+			row[x * 3 + 2] = static_cast<uint8_t>(std::min(std::max((x + y) * 255 / (width + height) + noise, 0), 255));
+		}
+	}
+
+	std::cout << "Encoding " << frames << " BGR8 frames of " << width << "x" << height << " at quality " << quality << std::endl;
+
+	jpeg_front_end::planar_image planes;
+	baseline_jpeg::encoder encoder(quality);
+	std::vector<uint8_t> scalar_jpeg;
+	double scalar_convert_ms = 0;
+	double scalar_total_ms = 0;
+
+	for (auto k : jpeg_front_end::available_kernels())
+	{
+		// One frame to allocate the planes and the output buffer
+		jpeg_front_end::convert(image.data(), pitch, 3, width, height, planes, k);
+		std::vector<uint8_t> jpeg = encoder.encode(planes);
+
+		double convert_s = 0;
+		double encode_s = 0;
+		for (uint64_t i = 0; i < frames; ++i)
+		{
+			auto t0 = std::chrono::steady_clock::now();
+			jpeg_front_end::convert(image.data(), pitch, 3, width, height, planes, k);
+			auto t1 = std::chrono::steady_clock::now();
+			encoder.encode(planes);
+			auto t2 = std::chrono::steady_clock::now();
+
+			convert_s += std::chrono::duration<double>(t1 - t0).count();
+			encode_s += std::chrono::duration<double>(t2 - t1).count();
+		}
+
+		double convert_ms = convert_s * 1000.0 / frames;
+		double total_ms = (convert_s + encode_s) * 1000.0 / frames;
+		if (k == jpeg_front_end::kernel::scalar)
+		{
+			scalar_jpeg = jpeg;
+			scalar_convert_ms = convert_ms;
+			scalar_total_ms = total_ms;
+		}
+
+		std::cout << jpeg_front_end::kernel_name(k) << ": color conversion " << convert_ms << " ms (" << scalar_convert_ms / convert_ms << "x), "
+			<< "whole encode " << total_ms << " ms (" << scalar_total_ms / total_ms << "x) per frame, "
+			<< jpeg.size() << " bytes" << (jpeg == scalar_jpeg ? "" : ", output differs from scalar kernel!") << std::endl;
+	}
+
+	return 0;
+}
+
+static bool parse_kernel(const std::string& name, jpeg_front_end::kernel& k)
+{
+	for (auto candidate : { jpeg_front_end::kernel::scalar, jpeg_front_end::kernel::sse41, jpeg_front_end::kernel::avx2, jpeg_front_end::kernel::neon })
+	{
+		if (name == jpeg_front_end::kernel_name(candidate) && jpeg_front_end::is_available(candidate))
+		{
+			k = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void print_usage()
+{
+	std::cout << "Usage: save-jpeg-file [--quality <pct>] [--encoder ic4|builtin] [--kernel scalar|sse4.1|avx2|neon] [--burst <frames>] [--encoders <n>]" << std::endl;
+	std::cout << "       save-jpeg-file --benchmark <frames> [<width> <height>] [--quality <pct>]" << std::endl;
+	std::cout << "       save-jpeg-file --self-test" << std::endl;
+}
+
+int main(int argc, char** argv)
 {
+	EncoderSettings settings = { false, 90, jpeg_front_end::best_kernel() };
+	uint64_t burst_frames = 0;
+	size_t num_encoders = std::max(1u, std::thread::hardware_concurrency());
+	bool self_test = false;
+	uint64_t benchmark_frames = 0;
+	int benchmark_width = 1920;
+	int benchmark_height = 1080;
+
+	try
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "--quality" && i + 1 < argc)
+			{
+				settings.quality_pct = std::stoi(argv[++i]);
+			}
+			else if (arg == "--encoder" && i + 1 < argc && (std::string(argv[i + 1]) == "ic4" || std::string(argv[i + 1]) == "builtin"))
+			{
+				settings.builtin = std::string(argv[++i]) == "builtin";
+			}
+			else if (arg == "--kernel" && i + 1 < argc)
+			{
+				if (!parse_kernel(argv[++i], settings.kernel))
+				{
+					std::cerr << "Kernel " << argv[i] << " is unknown or not available on this CPU" << std::endl;
+					return -1;
+				}
+			}
+			else if (arg == "--self-test")
+			{
+				self_test = true;
+			}
+			else if (arg == "--benchmark" && i + 1 < argc)
+			{
+				benchmark_frames = std::stoull(argv[++i]);
+				if (i + 2 < argc && argv[i + 1][0] != '-')
+				{
+					benchmark_width = std::stoi(argv[++i]);
+					benchmark_height = std::stoi(argv[++i]);
+				}
+			}
+			else if (arg == "--burst" && i + 1 < argc)
+			{
+				burst_frames = std::stoull(argv[++i]);
+			}
+			else if (arg == "--encoders" && i + 1 < argc)
+			{
+				num_encoders = std::stoul(argv[++i]);
+			}
+			else
+			{
+				print_usage();
+				return -1;
+			}
+		}
+	}
+	catch (const std::exception&)
+	{
+		print_usage();
+		return -1;
+	}
+
+	if (settings.quality_pct < 1 || settings.quality_pct > 100)
+	{
+		std::cerr << "--quality must be between 1 and 100" << std::endl;
+		return -1;
+	}
+
+	if (self_test)
+	{
+		return run_self_test();
+	}
+	if (benchmark_frames > 0)
+	{
+		return run_benchmark(benchmark_frames, benchmark_width, benchmark_height, settings.quality_pct);
+	}
+
 	ic4::initLibrary();
 	std::atexit(ic4::exitLibrary);
 
@@ -28,6 +643,18 @@ int main()
 
 	// #TODO: Insert format configuration
 
+	if (settings.builtin)
+	{
+		std::cout << "Using the built-in encoder with the " << jpeg_front_end::kernel_name(settings.kernel) << " color conversion kernel" << std::endl;
+	}
+
+	if (burst_frames > 0)
+	{
+		int result = run_burst(grabber, burst_frames, num_encoders, settings);
+		grabber.deviceClose();
+		return result;
+	}
+
 	auto sink = ic4::SnapSink::create(err);
 	if (!sink)
 	{
@@ -41,6 +668,8 @@ int main()
 		return -4;
 	}
 
+	JpegFileEncoder encoder(settings);
+
 	for (int i = 0; i < 10; ++i)
 	{
 		std::cout << "Press any key to snap and save a jpeg image" << std::endl;
@@ -55,13 +684,10 @@ int main()
 
 		auto file_name = "image_" + std::to_string(i) + ".jpg";
 
-		ic4::SaveJpegOptions options =
-		{
-			90	// .quality_pct =
-		};
-		if (!ic4::imageBufferSaveAsJpeg(*image_buffer, file_name, options, err))
+		std::string error_message;
+		if (!encoder.save(*image_buffer, file_name, error_message))
 		{
-			std::cerr << "Failed to save image file: " << err.message() << std::endl;
+			std::cerr << "Failed to save image file: " << error_message << std::endl;
 			continue;
 		}
 
@@ -74,4 +700,4 @@ int main()
 	grabber.deviceClose();
 
 	return 0;
-}
\ No newline at end of file
+}